@@ -78,15 +78,22 @@ static char list[1024];
 
 static uint32_t edx_features;
 static uint32_t ecx_features;
+static uint32_t ext_edx_features;
 
 /**
  * @brief Checks if the given CPU feature is supported. Useful for checking if we can use features such as SSE, x87 and
  * so on.
  * @param p_feature The feature to check for. Defined in the header.
- * @param reg The register to check from. If the value is in ECX, this is 0. If the value is in EDX, this is 1.
+ * @param reg The register to check from. If the value is in ECX, this is 0. If the value is in EDX, this is 1. If the
+ * value is in the EDX of the extended leaf (`0x80000001`), this is 2.
  */
 bool cpuid_supports_feature(enum CPU_Features p_feature, int reg)
 {
+	if (reg == 2)
+	{
+		return ext_edx_features & p_feature;
+	}
+
 	if (reg > 0 && edx_features & p_feature)
 	{
 		return true;
@@ -168,6 +175,14 @@ bool cpuid_initialize(struct CPU_Config *out_config)
 	unsigned int string[12];
 	__get_cpuid(0x80000000, &string[0], &string[1], &string[2], &string[3]);
 
+	// Some features, such as the NX bit, are only listed in the extended leaf
+	if (string[0] >= 0x80000001)
+	{
+		unsigned int ext[4];
+		__get_cpuid(0x80000001, &ext[0], &ext[1], &ext[2], &ext[3]);
+		ext_edx_features = ext[3];
+	}
+
 	if (regs[0] >= 0x8000004)
 	{
 		__get_cpuid(0x80000002, &string[0], &string[1], &string[2], &string[3]);
@@ -132,8 +132,8 @@ struct FAT_Info
 {
 	uint8_t drive_count;
 	struct FAT_DriveConfig **drives;
-	uint32_t file_count;
-	struct FAT_File *files;
+	struct KmemCache *file_cache; // Cache that every opened `FAT_File` is allocated from
+	struct Arena *lookup_arena;	  // Scratch memory for the directories passed through while looking up a path
 
 	struct FAT_File root;
 	uint32_t data_section_lba;
@@ -205,14 +205,46 @@ static bool fat_is_eof(uint8_t type, uint32_t p_value)
 	return false;
 }
 
+/**
+ * @brief Searches a block of directory entries for an entry with the given name.
+ * @param p_entries The entries to search through
+ * @param p_count The number of entries in the block
+ * @param p_name The 11-character name to look for, padded with spaces and without the dot.
+ * @param out_end Set to `true` if the block holds the entry that marks the end of the directory.
+ * @return The matching entry, or `NULL` if it isn't in the block.
+ */
+static struct FAT_DirectoryEntry *fat_search_entries(
+	struct FAT_DirectoryEntry *p_entries, uint32_t p_count, const char *p_name, bool *out_end)
+{
+	*out_end = false;
+	for (uint32_t i = 0; i < p_count; i++)
+	{
+		// Null entry, end
+		if (!p_entries[i].file_name[0])
+		{
+			*out_end = true;
+			return NULL;
+		}
+
+		if (memcmp(p_name, p_entries[i].file_name, 11) == 0)
+		{
+			return &p_entries[i];
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * @brief Checks to see if the given directory contains the directory entry pointed to by `p_name`.
  * @param out_entry The entry to output to the user if found
  * @param p_file The "file" (directory) to look in for if the entry exists.
  * @param p_name The name of the directory entry to look for.
+ * @param p_arena Arena to take scratch memory from if the directory has to be read from disk.
  * @return `true` if the entry exists and is owned, `false` if not.
  */
-static bool fat_dir_has_entry(struct FAT_DirectoryEntry *out_entry, struct FAT_File *p_file, const char *p_name)
+static bool fat_dir_has_entry(
+	struct FAT_DirectoryEntry *out_entry, struct FAT_File *p_file, const char *p_name, struct Arena *p_arena)
 {
 	if (!p_file->is_directory)
 		return false;
@@ -240,44 +272,71 @@ static bool fat_dir_has_entry(struct FAT_DirectoryEntry *out_entry, struct FAT_F
 		}
 	}
 
-	// Allocate directory if it's not yet been written to
-	if (!p_file->data)
+	bool end_reached				 = false;
+	struct FAT_DirectoryEntry *found = NULL;
+	if (p_file->data)
+	{
+		// Directory is already loaded (i.e. the root directory), so search it in place
+		found = fat_search_entries((struct FAT_DirectoryEntry *)p_file->data,
+								   p_file->loaded_size / sizeof(struct FAT_DirectoryEntry),
+								   filename,
+								   &end_reached);
+	}
+	else
 	{
-		bool end_reached = false;
-		// Read all directories into a buffer
-		while (!end_reached)
+		// Read the directory one cluster at a time into scratch memory, stopping as soon as the entry is found
+		struct FAT_DriveConfig *cfg = info.drives[p_file->drive_id];
+		uint32_t cluster_size		= cfg->bs.sectors_per_cluster * cfg->bs.bytes_per_sector;
+		void *buffer				= arena_alloc(p_arena, cluster_size);
+		if (!buffer)
+		{
+			LOG_ERROR("Failed to allocate a buffer for reading directory clusters.");
+			return false;
+		}
+
+		uint32_t cluster = p_file->first_cluster;
+		while (!found && !end_reached && !fat_is_eof(cfg->type, cluster))
 		{
-			struct FAT_DirectoryEntry entry;
-			void *ref_entry = &entry;
-			if (!fat_read_bytes(p_file, sizeof(struct FAT_DirectoryEntry), &ref_entry))
+			int lba = fat_cluster_to_lba(cfg, cluster);
+			if (!hal_read_bytes(p_file->drive_id, lba, buffer, cluster_size))
 			{
 				LOG_ERROR("Failed to read bytes from buffer.");
 				return false;
 			}
 
-			// Null entry, end
-			if (!entry.file_name[0])
-			{
-				end_reached = true;
-				break;
-			}
+			found = fat_search_entries(
+				buffer, cluster_size / sizeof(struct FAT_DirectoryEntry), filename, &end_reached);
+			cluster = fat_find_next_cluster(cfg, cluster);
 		}
 	}
 
-	uint8_t *data = p_file->data;
-
-	while (data)
+	if (!found)
 	{
-		if (memcmp(filename, data, 11) == 0)
-		{
-			memcpy(out_entry, data, sizeof(struct FAT_DirectoryEntry));
-			return true;
-		}
-
-		data += sizeof(struct FAT_DirectoryEntry);
+		return false;
 	}
 
-	return false;
+	memcpy(out_entry, found, sizeof(struct FAT_DirectoryEntry));
+	return true;
+}
+
+/**
+ * @brief Sets up a file from the given directory entry. The data buffer is NULL until required, usually when being
+ * read.
+ * @param p_file The file to set up
+ * @param p_entry The directory entry for the file
+ */
+static void fat_file_init(struct FAT_File *p_file, struct FAT_DirectoryEntry *p_entry)
+{
+	p_file->first_cluster	= (p_entry->first_cluster_no_high << 16) + p_entry->first_cluster_no_low;
+	p_file->is_directory	= p_entry->attribs & FAT_DIRECTORY;
+	p_file->is_in_use		= true;
+	p_file->is_root			= false;
+	p_file->size			= p_entry->size;
+	p_file->loaded_size		= 0;
+	p_file->data			= NULL;
+	p_file->drive_id		= 0;
+	p_file->current_cluster = p_file->first_cluster;
+	p_file->position		= 0;
 }
 
 /**
@@ -286,33 +345,14 @@ static bool fat_dir_has_entry(struct FAT_DirectoryEntry *out_entry, struct FAT_F
  */
 static struct FAT_File *fat_file_open_entry(struct FAT_DirectoryEntry *p_entry)
 {
-	struct FAT_File *ret = NULL;
-	for (int i = 0; i < info.file_count; i++)
-	{
-		if (!info.files[i].is_in_use)
-		{
-			ret = &info.files[i];
-			break;
-		}
-	}
-
+	struct FAT_File *ret = kmem_cache_alloc(info.file_cache);
 	if (ret == NULL)
 	{
-		info.files = realloc(info.files, (info.file_count + 1) * sizeof(struct FAT_File));
-		info.file_count++;
-		ret = &info.files[info.file_count - 1];
+		LOG_ERROR("Failed to allocate a new FAT file.");
+		return NULL;
 	}
 
-	ret->first_cluster	 = (p_entry->first_cluster_no_high << 16) + p_entry->first_cluster_no_low;
-	ret->is_directory	 = p_entry->attribs & FAT_DIRECTORY;
-	ret->is_in_use		 = true;
-	ret->is_root		 = false;
-	ret->size			 = p_entry->size;
-	ret->loaded_size	 = 0;
-	ret->data			 = NULL;
-	ret->drive_id		 = 0;
-	ret->current_cluster = ret->first_cluster;
-	ret->position		 = 0;
+	fat_file_init(ret, p_entry);
 	return ret;
 }
 
@@ -329,6 +369,21 @@ bool fat_initialize(uint8_t p_drive_no, void *p_bootsector)
 	info.drives = (struct FAT_DriveConfig **)calloc(1, sizeof(struct FAT_DriveConfig *));
 	memset(info.drives, 0, sizeof(struct FAT_DriveConfig *));
 
+	// Files are opened and closed all the time, so give them a cache rather than growing an array of them
+	info.file_cache = kmem_cache_create("FAT_File", sizeof(struct FAT_File), NULL);
+	if (!info.file_cache)
+	{
+		LOG_ERROR("Failed to create the FAT file cache.");
+		return false;
+	}
+
+	info.lookup_arena = arena_create(0);
+	if (!info.lookup_arena)
+	{
+		LOG_ERROR("Failed to create the FAT path lookup arena.");
+		return false;
+	}
+
 	struct FAT_BootSector *bs	= (struct FAT_BootSector *)p_bootsector;
 	struct FAT_DriveConfig *cfg = malloc(sizeof(struct FAT_DriveConfig));
 
@@ -378,7 +433,7 @@ bool fat_initialize(uint8_t p_drive_no, void *p_bootsector)
 	fat_table = calloc(spf, bs->bytes_per_sector);
 	if (!hal_read_bytes(p_drive_no,
 						bs->reserved_sector_count,
-						pvirtual_to_physical(fat_table),
+						fat_table,
 						spf * bs->bytes_per_sector))
 	{
 		LOG_ERROR("Failed to read FAT table into memory.");
@@ -414,7 +469,8 @@ bool fat_initialize(uint8_t p_drive_no, void *p_bootsector)
 		dir += 32;
 		new_count += 32;
 	}
-	info.root.data = realloc(info.root.data, new_count);
+	info.root.data		  = realloc(info.root.data, new_count);
+	info.root.loaded_size = new_count;
 
 	return true;
 }
@@ -426,53 +482,60 @@ void *fat_open(const char *p_file, uint8_t p_drive_id)
 	if (p_file[0] == '/')
 		p_file++;
 
+	// Directories passed through on the way to the file are only needed for the lookup itself, so they live in the
+	// lookup arena and are all dropped at once when the next lookup begins.
+	arena_reset(info.lookup_arena);
+
 	struct FAT_File *current = &info.root;
 
 	while (*p_file)
 	{
-		bool last		  = false;
 		const char *delim = strchr(p_file, '/');
-
-		if (delim)
-		{
-			memcpy(name, p_file, delim - p_file);
-			name[delim - p_file + 1] = 0;
-			p_file					 = delim + 1;
-		}
-		else
+		uint32_t len	  = delim ? (uint32_t)(delim - p_file) : strlen(p_file);
+		if (len >= MAX_FILE_PATH)
 		{
-			uint32_t len = strlen(p_file);
-			memcpy(name, p_file, len);
-			name[len] = 0;
-			p_file += len;
-			last = true;
+			LOG_ERROR("Path component is too long.");
+			return NULL;
 		}
 
+		memcpy(name, p_file, len);
+		name[len] = 0;
+		p_file += delim ? len + 1 : len;
+
+		// A trailing slash still makes this the last entry
+		bool last = (*p_file == 0);
+
 		struct FAT_DirectoryEntry entry;
-		if (!fat_dir_has_entry(&entry, current, name))
+		if (!fat_dir_has_entry(&entry, current, name, info.lookup_arena))
 		{
-			// Close file
-
 			LOG_ERROR("Could not find/read directory %s.", name);
 			return NULL;
 		}
+
+		if (!last && !(entry.attribs & FAT_DIRECTORY))
+		{
+			LOG_ERROR("Entry %s is not a directory.", name);
+			return NULL;
+		}
+
+		if (last)
+		{
+			// Only the entry that was asked for outlives the lookup
+			current = fat_file_open_entry(&entry);
+		}
 		else
 		{
-			// Close file
-			if (!last && !(entry.attribs & FAT_DIRECTORY))
+			current = arena_alloc(info.lookup_arena, sizeof(struct FAT_File));
+			if (current)
 			{
-				LOG_ERROR("Entry %s is not a directory.", name);
-				return NULL;
+				fat_file_init(current, &entry);
 			}
-
-			// Open directory
-			current = fat_file_open_entry(&entry);
 		}
-	}
 
-	if (current == NULL)
-	{
-		return NULL;
+		if (current == NULL)
+		{
+			return NULL;
+		}
 	}
 
 	return current;
@@ -484,6 +547,15 @@ void fat_close(void *p_handle)
 		return;
 
 	struct FAT_File *h = (struct FAT_File *)p_handle;
+
+	// The root directory lives for as long as the driver does, and every lookup searches its loaded entries, so
+	// closing a handle to it only rewinds it
+	if (h == &info.root)
+	{
+		h->position = 0;
+		return;
+	}
+
 	if (h->data)
 	{
 		free(h->data);
@@ -499,6 +571,7 @@ void fat_close(void *p_handle)
 	h->loaded_size	   = 0;
 	h->drive_id		   = 0;
 	h->is_in_use	   = false;
+	kmem_cache_free(info.file_cache, h);
 }
 
 uint32_t fat_read_bytes(void *p_handle, uint32_t p_bytes, void **out_buffer)
@@ -579,13 +652,12 @@ uint32_t fat_read_bytes(void *p_handle, uint32_t p_bytes, void **out_buffer)
 		 * - Data is then copied to the output buffer, next cluster if found, repeat.
 		 */
 
-		void *physaddr =
-			pvirtual_to_physical(p_file->data + (p_file->current_cluster - p_file->first_cluster) * bytes_per_cluster);
+		void *to = p_file->data + (p_file->current_cluster - p_file->first_cluster) * bytes_per_cluster;
 
 		if (p_file->is_root)
 		{
 			// Root directory, read directly rather than via other means
-			if (!hal_read_bytes(p_file->drive_id, p_file->current_cluster, physaddr, read))
+			if (!hal_read_bytes(p_file->drive_id, p_file->current_cluster, to, read))
 			{
 				LOG_ERROR("Error reading bytes for FAT file.");
 				break;
@@ -595,7 +667,7 @@ uint32_t fat_read_bytes(void *p_handle, uint32_t p_bytes, void **out_buffer)
 		{
 			int lba = fat_cluster_to_lba(cfg, p_file->current_cluster);
 
-			if (!hal_read_bytes(p_file->drive_id, lba, physaddr, read))
+			if (!hal_read_bytes(p_file->drive_id, lba, to, read))
 			{
 				LOG_ERROR("Error reading bytes for FAT file.");
 				break;
@@ -29,9 +29,9 @@ enum DriveFormat
 
 struct VFS_Config
 {
-	struct VFS_Handle *handles; // Array of allocated file handles.
-	uint32_t allocated_handles; // Number of file handles currently allocated.
-	bool initialized;			// Whether the VFS has been initialized or not.
+	struct KmemCache *handle_cache; // Cache that file handles are allocated from.
+	uint32_t allocated_handles;		// Number of file handles currently allocated.
+	bool initialized;				// Whether the VFS has been initialized or not.
 };
 
 static struct VFS_Config cfg = {0};
@@ -48,12 +48,34 @@ bool vfs_initialize()
 		return false;
 	}
 
+	cfg.handle_cache = kmem_cache_create("VFS_Handle", sizeof(struct VFS_Handle), NULL);
+	if (!cfg.handle_cache)
+	{
+		LOG_ERROR("Failed to create the file handle cache.");
+		return false;
+	}
+
+	// Boot sectors are only needed while each drive is probed, so one arena holds them and is emptied per drive
+	struct Arena *scratch = arena_create(0);
+	if (!scratch)
+	{
+		LOG_ERROR("Failed to create an arena for reading boot sectors.");
+		return false;
+	}
+
 	uint8_t drives_to_check = hal_get_drive_count();
 
 	for (int i = 0; i < drives_to_check; i++)
 	{
-		void *temp_mem = malloc(VFS_BOOT_SIZE); // Read in BS
-		hal_read_bytes(i, 0, (void *)virtual_to_physical((uint32_t)temp_mem), VFS_BOOT_SIZE);
+		// Read in BS
+		arena_reset(scratch);
+		void *temp_mem = arena_alloc(scratch, VFS_BOOT_SIZE);
+		if (!temp_mem)
+		{
+			arena_destroy(scratch);
+			return false;
+		}
+		hal_read_bytes(i, 0, temp_mem, VFS_BOOT_SIZE);
 
 		// 0xAA55 tells us the disk is either an MBR or a FAT file
 		if (*((uint16_t *)(temp_mem + 0x1fe)) == MBR_BOOT_SIGNATURE && *((uint8_t *)temp_mem) == FAT_JMP_INSTRUCTION)
@@ -62,6 +84,7 @@ bool vfs_initialize()
 			if (!fat_initialize(i, temp_mem))
 			{
 				LOG_ERROR("Failed to initialise drive as FAT-formatted.");
+				arena_destroy(scratch);
 				return false;
 			}
 		}
@@ -70,11 +93,11 @@ bool vfs_initialize()
 			// Others, not done yet.
 			LOG_WARNING("File format of drive %d is unknown.", i);
 		}
-
-		// Done with the memory, free it
-		free(temp_mem);
 	}
 
+	// Done with the memory, free it
+	arena_destroy(scratch);
+
 	cfg.initialized = true;
 	return true;
 }
@@ -92,22 +115,13 @@ struct VFS_Handle *vfs_open(const char *p_path)
 		return NULL;
 
 	// Allocate new handle
-	struct VFS_Handle *ret = NULL;
-	for (int i = 0; i < cfg.allocated_handles; i++)
-	{
-		if (!cfg.handles[i].open)
-		{
-			ret = &cfg.handles[i];
-			break;
-		}
-	}
-
+	struct VFS_Handle *ret = kmem_cache_alloc(cfg.handle_cache);
 	if (ret == NULL)
 	{
-		cfg.allocated_handles++;
-		cfg.handles = realloc(cfg.handles, sizeof(struct VFS_Handle) * cfg.allocated_handles);
-		ret			= &cfg.handles[cfg.allocated_handles - 1];
+		fat_close(h);
+		return NULL;
 	}
+	cfg.allocated_handles++;
 
 	ret->handle = (int)h;
 	ret->open	= true;
@@ -127,6 +141,9 @@ void vfs_close(struct VFS_Handle *p_handle)
 	p_handle->pos	 = 0;
 	p_handle->size	 = 0;
 	p_handle->handle = 0;
+
+	kmem_cache_free(cfg.handle_cache, p_handle);
+	cfg.allocated_handles--;
 }
 
 void *vfs_read(struct VFS_Handle *p_handle, uint32_t p_count)
@@ -0,0 +1,376 @@
+#include <aurora/hal/hal.h>
+#include <aurora/memory.h>
+
+#define AUR_MODULE "block cache"
+#include <aurora/debug.h>
+
+#include <string.h>
+
+#define SECTOR_SIZE 512
+
+// Number of hash chains that entries are spread across
+#define BLOCK_CACHE_BUCKETS 64
+
+// Marks the end of a hash chain, as entry 0 is a valid entry
+#define BLOCK_NONE 0xffff
+
+// The largest capacity that entry indices can address
+#define BLOCK_CACHE_MAX_BLOCKS (BLOCK_NONE - 1)
+
+enum BlockFlags
+{
+	BLOCK_VALID		 = 1 << 0, // Entry holds the current contents of its sector
+	BLOCK_REFERENCED = 1 << 1, // Entry has been used since the clock hand last passed it
+};
+
+// A single cached sector. Its contents live at the same index of `BlockCache::data`.
+struct BlockCacheEntry
+{
+	uint16_t lba;  // Sector held by the entry
+	uint8_t drive; // Drive the sector is on
+	uint8_t flags; // `BlockFlags` for the entry
+	uint16_t pins; // Number of times the entry has been pinned and not unpinned yet
+	uint16_t next; // Next entry in the same hash chain, or `BLOCK_NONE`
+};
+
+struct BlockCache
+{
+	struct BlockCacheEntry *entries;	   // Descriptor for every sector the cache can hold
+	uint8_t *data;						   // Contents of every entry, one sector each
+	uint16_t buckets[BLOCK_CACHE_BUCKETS]; // First valid entry of each hash chain
+	uint16_t capacity;					   // Number of entries
+	uint16_t hand;						   // Entry the clock hand is on
+	struct BlockCacheStatistics stats;	   // Counters reported by `hal_get_cache_statistics()`
+};
+
+static struct BlockCache bcache = {0};
+
+static uint16_t block_cache_hash(uint8_t drive, uint16_t lba)
+{
+	return (lba ^ (drive << 5)) % BLOCK_CACHE_BUCKETS;
+}
+
+/**
+ * @brief Finds the entry holding a sector.
+ * @param drive The drive the sector is on
+ * @param lba The sector to look for
+ * @return The index of the entry, or `BLOCK_NONE` if the sector isn't cached.
+ */
+static uint16_t block_cache_find(uint8_t drive, uint16_t lba)
+{
+	for (uint16_t i = bcache.buckets[block_cache_hash(drive, lba)]; i != BLOCK_NONE; i = bcache.entries[i].next)
+	{
+		if (bcache.entries[i].drive == drive && bcache.entries[i].lba == lba)
+		{
+			return i;
+		}
+	}
+
+	return BLOCK_NONE;
+}
+
+/**
+ * @brief Takes an entry out of its hash chain and marks it as no longer holding its sector. Pinned entries keep their
+ * contents until they are unpinned, but are never found again.
+ * @param index The entry to drop
+ */
+static void block_cache_drop(uint16_t index)
+{
+	struct BlockCacheEntry *entry = &bcache.entries[index];
+	if (!(entry->flags & BLOCK_VALID))
+	{
+		return;
+	}
+
+	uint16_t *link = &bcache.buckets[block_cache_hash(entry->drive, entry->lba)];
+	while (*link != index)
+	{
+		link = &bcache.entries[*link].next;
+	}
+
+	*link		= entry->next;
+	entry->next = BLOCK_NONE;
+	entry->flags &= ~BLOCK_VALID;
+	bcache.stats.used--;
+}
+
+/**
+ * @brief Picks an entry for a new sector with the CLOCK algorithm. Entries used since the hand last passed get a
+ * second chance, and pinned entries are skipped.
+ * @return The index of a free entry, or `BLOCK_NONE` if every entry is pinned.
+ */
+static uint16_t block_cache_evict()
+{
+	// Two sweeps are enough to clear every referenced bit and come back round to the first unpinned entry
+	for (uint32_t i = 0; i < 2u * bcache.capacity; i++)
+	{
+		uint16_t index				  = bcache.hand;
+		struct BlockCacheEntry *entry = &bcache.entries[index];
+		bcache.hand					  = (bcache.hand + 1) % bcache.capacity;
+
+		if (entry->pins)
+		{
+			continue;
+		}
+
+		if (entry->flags & BLOCK_REFERENCED)
+		{
+			entry->flags &= ~BLOCK_REFERENCED;
+			continue;
+		}
+
+		if (entry->flags & BLOCK_VALID)
+		{
+			block_cache_drop(index);
+			bcache.stats.evictions++;
+		}
+
+		return index;
+	}
+
+	return BLOCK_NONE;
+}
+
+/**
+ * @brief Puts a sector into the cache, replacing whatever it held for it before.
+ * @param drive The drive the sector is on
+ * @param lba The sector
+ * @param from The contents of the sector, or `NULL` to leave the entry's contents to the caller.
+ * @return The index of the entry, or `BLOCK_NONE` if there was no room for it.
+ */
+static uint16_t block_cache_insert(uint8_t drive, uint16_t lba, const void *from)
+{
+	uint16_t index = block_cache_find(drive, lba);
+	if (index == BLOCK_NONE)
+	{
+		index = block_cache_evict();
+		if (index == BLOCK_NONE)
+		{
+			return BLOCK_NONE;
+		}
+
+		struct BlockCacheEntry *entry = &bcache.entries[index];
+		uint16_t bucket				  = block_cache_hash(drive, lba);
+		entry->drive				  = drive;
+		entry->lba					  = lba;
+		entry->flags				  = BLOCK_VALID | BLOCK_REFERENCED;
+		entry->next					  = bcache.buckets[bucket];
+		bcache.buckets[bucket]		  = index;
+		bcache.stats.used++;
+	}
+
+	if (from)
+	{
+		memcpy(bcache.data + index * SECTOR_SIZE, from, SECTOR_SIZE);
+	}
+
+	return index;
+}
+
+bool block_cache_initialize(uint32_t p_blocks)
+{
+	if (!p_blocks || p_blocks > BLOCK_CACHE_MAX_BLOCKS)
+	{
+		LOG_ERROR("Block cache can't hold %u sectors.", p_blocks);
+		return false;
+	}
+
+	for (int i = 0; i < bcache.capacity; i++)
+	{
+		if (bcache.entries[i].pins)
+		{
+			LOG_ERROR("Block cache can't be resized while sectors are pinned.");
+			return false;
+		}
+	}
+
+	struct BlockCacheEntry *entries = kalloc(p_blocks * sizeof(struct BlockCacheEntry));
+	// Page-aligned, so that every sector sits in a single page and can be read into in place
+	uint8_t *data = kalloc_large(p_blocks * SECTOR_SIZE);
+	if (!entries || !data)
+	{
+		LOG_ERROR("Failed to allocate a block cache of %u sectors.", p_blocks);
+		kfree(entries);
+		kfree(data);
+		return false;
+	}
+
+	kfree(bcache.entries);
+	kfree(bcache.data);
+
+	// Resizing starts from an empty cache, but the counters carry on
+	memset(entries, 0, p_blocks * sizeof(struct BlockCacheEntry));
+	memset(bcache.buckets, 0xff, sizeof(bcache.buckets));
+	bcache.entries		  = entries;
+	bcache.data			  = data;
+	bcache.capacity		  = p_blocks;
+	bcache.hand			  = 0;
+	bcache.stats.capacity = p_blocks;
+	bcache.stats.used	  = 0;
+	for (uint32_t i = 0; i < p_blocks; i++)
+	{
+		entries[i].next = BLOCK_NONE;
+	}
+
+	return true;
+}
+
+bool block_cache_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size)
+{
+	if (!bcache.capacity || !p_size)
+	{
+		return false;
+	}
+
+	// Requests are only served if every sector is cached, since one read of the whole range from the drive costs
+	// about as much as reading any part of it
+	uint16_t count = (p_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (block_cache_find(p_drive, p_lba + i) == BLOCK_NONE)
+		{
+			bcache.stats.misses += count;
+			return false;
+		}
+	}
+
+	uint8_t *to = p_to;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint16_t index = block_cache_find(p_drive, p_lba + i);
+		size_t bytes   = AMIN(p_size, SECTOR_SIZE);
+		bcache.entries[index].flags |= BLOCK_REFERENCED;
+		memcpy(to, bcache.data + index * SECTOR_SIZE, bytes);
+		to += bytes;
+		p_size -= bytes;
+	}
+
+	bcache.stats.hits += count;
+	return true;
+}
+
+void block_cache_fill(uint8_t p_drive, uint16_t p_lba, const void *p_from, size_t p_size)
+{
+	// A partial sector at the end of the range isn't known in full, so it is left out
+	const uint8_t *from = p_from;
+	for (uint16_t i = 0; bcache.capacity && p_size >= SECTOR_SIZE; i++)
+	{
+		block_cache_insert(p_drive, p_lba + i, from);
+		from += SECTOR_SIZE;
+		p_size -= SECTOR_SIZE;
+	}
+}
+
+void block_cache_update(uint8_t p_drive, uint16_t p_lba, const void *p_from, size_t p_size)
+{
+	// Writes go straight through to the drive, so only sectors that are already cached are brought up to date. Ones
+	// that can't be are dropped.
+	const uint8_t *from = p_from;
+	uint16_t count		= (p_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	for (uint16_t i = 0; bcache.capacity && i < count; i++)
+	{
+		uint16_t index = block_cache_find(p_drive, p_lba + i);
+		if (index == BLOCK_NONE)
+		{
+			continue;
+		}
+
+		if (from && p_size - i * SECTOR_SIZE >= SECTOR_SIZE)
+		{
+			memcpy(bcache.data + index * SECTOR_SIZE, from + i * SECTOR_SIZE, SECTOR_SIZE);
+		}
+		else
+		{
+			block_cache_drop(index);
+		}
+	}
+}
+
+void *block_cache_pin(uint8_t p_drive, uint16_t p_lba, bool *out_fresh)
+{
+	*out_fresh = false;
+	if (!bcache.capacity)
+	{
+		return NULL;
+	}
+
+	uint16_t index = block_cache_find(p_drive, p_lba);
+	if (index != BLOCK_NONE)
+	{
+		bcache.stats.hits++;
+	}
+	else
+	{
+		index = block_cache_insert(p_drive, p_lba, NULL);
+		if (index == BLOCK_NONE)
+		{
+			LOG_ERROR("Every sector in the block cache is pinned.");
+			return NULL;
+		}
+
+		bcache.stats.misses++;
+		*out_fresh = true;
+	}
+
+	struct BlockCacheEntry *entry = &bcache.entries[index];
+	entry->flags |= BLOCK_REFERENCED;
+	if (!entry->pins++)
+	{
+		bcache.stats.pinned++;
+	}
+
+	return bcache.data + index * SECTOR_SIZE;
+}
+
+/**
+ * @brief Finds the entry that a pointer handed out by `block_cache_pin()` belongs to.
+ * @param block The pointer to the sector's contents
+ * @return The index of the entry, or `BLOCK_NONE` if the pointer isn't a cached sector.
+ */
+static uint16_t block_cache_index_of(const void *block)
+{
+	uint32_t offset = (const uint8_t *)block - bcache.data;
+	if (!block || offset >= (uint32_t)bcache.capacity * SECTOR_SIZE || offset % SECTOR_SIZE)
+	{
+		LOG_WARNING("%p isn't a cached sector.", block);
+		return BLOCK_NONE;
+	}
+
+	return offset / SECTOR_SIZE;
+}
+
+void block_cache_unpin(const void *p_block)
+{
+	uint16_t index = block_cache_index_of(p_block);
+	if (index == BLOCK_NONE)
+	{
+		return;
+	}
+
+	struct BlockCacheEntry *entry = &bcache.entries[index];
+	if (entry->pins && !--entry->pins)
+	{
+		bcache.stats.pinned--;
+	}
+}
+
+void block_cache_discard(const void *p_block)
+{
+	uint16_t index = block_cache_index_of(p_block);
+	if (index != BLOCK_NONE)
+	{
+		block_cache_unpin(p_block);
+		block_cache_drop(index);
+	}
+}
+
+bool block_cache_get_statistics(struct BlockCacheStatistics *out_stats)
+{
+	if (!out_stats)
+	{
+		return false;
+	}
+
+	*out_stats = bcache.stats;
+	return true;
+}
@@ -0,0 +1,209 @@
+#include "block_queue.h"
+
+#include <sys/time.h>
+
+#define SECTOR_SIZE 512
+
+// ISA DMA can't cross a 64 KiB boundary in a single transfer
+#define DMA_BOUNDARY 0x10000
+
+// The largest transfer a request can carry, going by the width of its size
+#define MAX_TRANSFER_SIZE 0xffff
+
+static uint32_t block_queue_get_time_ms()
+{
+	timer_t timer;
+	return timer_get_time(&timer) ? timer.time_ms : 0;
+}
+
+/**
+ * @brief Gets the sector just after the last one a request covers, including the requests merged into it.
+ */
+static uint32_t block_queue_end(struct BlockRequest *request)
+{
+	return request->lba + (block_queue_transfer_size(request) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+/**
+ * @brief Gets where a request falls in the sweep. Cylinders behind the sweep are only reached once it has gone back to
+ * the start of the disk, so they come after every cylinder ahead of it.
+ */
+static uint32_t block_queue_key(struct BlockQueue *queue, uint16_t lba)
+{
+	uint16_t cylinder = lba / queue->sectors_per_cylinder;
+	return cylinder >= queue->cylinder ? cylinder : cylinder + 0x10000;
+}
+
+/**
+ * @brief Checks whether a request covers any of the same sectors as a queued one, with either of them writing. Moving
+ * the request ahead of such a one would change what is read or what ends up on the disk.
+ */
+static bool block_queue_conflicts_with(struct BlockRequest *queued, struct BlockRequest *request)
+{
+	uint32_t end = request->lba + (request->size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	return (queued->write || request->write) && queued->lba < end && block_queue_end(queued) > request->lba;
+}
+
+/**
+ * @brief Checks whether a request conflicts with any queued one, in the sense of `block_queue_conflicts_with()`.
+ */
+static bool block_queue_conflicts(struct BlockQueue *queue, struct BlockRequest *request)
+{
+	for (struct BlockRequest *queued = queue->head; queued; queued = queued->next)
+	{
+		if (block_queue_conflicts_with(queued, request))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Merges a request into a queued one that it carries on from, so that both are carried out by one transfer.
+ * @return `true` if the request was merged, and `false` if there is nothing it can be merged into.
+ */
+static bool block_queue_merge(struct BlockQueue *queue, struct BlockRequest *request)
+{
+	if (block_queue_conflicts(queue, request))
+	{
+		return false;
+	}
+
+	uint16_t last_cylinder = (request->lba + (request->size + SECTOR_SIZE - 1) / SECTOR_SIZE - 1) /
+							 queue->sectors_per_cylinder;
+	for (struct BlockRequest *queued = queue->head; queued; queued = queued->next)
+	{
+		uint32_t size	= block_queue_transfer_size(queued);
+		uint32_t buffer = (uint32_t)queued->buffer;
+		if (queued->write != request->write || size % SECTOR_SIZE ||
+			queued->lba + size / SECTOR_SIZE != request->lba || buffer + size != (uint32_t)request->buffer)
+		{
+			continue;
+		}
+
+		// A single command can't go past the end of a cylinder, and DMA has to be able to do it in one go
+		uint32_t total = size + request->size;
+		if (queued->lba / queue->sectors_per_cylinder != last_cylinder || total > MAX_TRANSFER_SIZE ||
+			buffer / DMA_BOUNDARY != (buffer + total - 1) / DMA_BOUNDARY)
+		{
+			continue;
+		}
+
+		struct BlockRequest *last = queued;
+		while (last->merged)
+		{
+			last = last->merged;
+		}
+
+		last->merged = request;
+		queue->stats.merged++;
+		return true;
+	}
+
+	return false;
+}
+
+void block_queue_initialize(struct BlockQueue *p_queue, uint16_t p_sectors_per_cylinder)
+{
+	p_queue->head				  = NULL;
+	p_queue->sectors_per_cylinder = AMAX(p_sectors_per_cylinder, 1);
+	p_queue->cylinder			  = 0;
+}
+
+void block_queue_add(struct BlockQueue *p_queue, struct BlockRequest *p_request)
+{
+	p_request->status	 = BLOCK_STATUS_PENDING;
+	p_request->attempts	 = 0;
+	p_request->next		 = NULL;
+	p_request->merged	 = NULL;
+	p_request->submitted = block_queue_get_time_ms();
+
+	struct BlockQueueStatistics *stats = &p_queue->stats;
+	stats->submitted++;
+	stats->depth++;
+	stats->max_depth = AMAX(stats->max_depth, stats->depth);
+
+	if (block_queue_merge(p_queue, p_request))
+	{
+		return;
+	}
+
+	// The request can't go ahead of any it conflicts with, wherever they fall in the sweep, so it is placed after the
+	// last of them
+	struct BlockRequest **link = &p_queue->head;
+	for (struct BlockRequest **queued = &p_queue->head; *queued; queued = &(*queued)->next)
+	{
+		if (block_queue_conflicts_with(*queued, p_request))
+		{
+			link = &(*queued)->next;
+		}
+	}
+
+	// Requests on the same cylinder keep the order they were submitted in
+	uint32_t key = block_queue_key(p_queue, p_request->lba);
+	while (*link && block_queue_key(p_queue, (*link)->lba) <= key)
+	{
+		link = &(*link)->next;
+	}
+
+	p_request->next = *link;
+	*link			= p_request;
+}
+
+struct BlockRequest *block_queue_take(struct BlockQueue *p_queue)
+{
+	struct BlockRequest *request = p_queue->head;
+	if (!request)
+	{
+		return NULL;
+	}
+
+	p_queue->head	  = request->next;
+	p_queue->cylinder = request->lba / p_queue->sectors_per_cylinder;
+	request->next	  = NULL;
+	return request;
+}
+
+uint32_t block_queue_transfer_size(struct BlockRequest *p_request)
+{
+	uint32_t size = 0;
+	for (struct BlockRequest *request = p_request; request; request = request->merged)
+	{
+		size += request->size;
+	}
+
+	return size;
+}
+
+void block_queue_complete(struct BlockQueue *p_queue, struct BlockRequest *p_request, uint8_t p_status)
+{
+	struct BlockQueueStatistics *stats = &p_queue->stats;
+	uint32_t now					   = block_queue_get_time_ms();
+	while (p_request)
+	{
+		// The completion function is free to submit the request again, so nothing is read from it afterwards
+		struct BlockRequest *merged = p_request->merged;
+		uint32_t latency			= now - p_request->submitted;
+		stats->depth--;
+		stats->total_latency_ms += latency;
+		stats->max_latency_ms = AMAX(stats->max_latency_ms, latency);
+		if (p_status == BLOCK_STATUS_DONE)
+		{
+			stats->completed++;
+		}
+		else
+		{
+			stats->failed++;
+		}
+
+		p_request->status = p_status;
+		if (p_request->on_complete)
+		{
+			p_request->on_complete(p_request);
+		}
+
+		p_request = merged;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <aurora/hal/hal.h>
+
+// Pending requests for a single drive, kept in the order they will be carried out
+struct BlockQueue
+{
+	struct BlockRequest *head;		   // Next request to carry out
+	uint16_t sectors_per_cylinder;	   // Size of a cylinder, which requests are sorted and merged by
+	uint16_t cylinder;				   // Cylinder of the last request taken off the queue, where the sweep is up to
+	struct BlockQueueStatistics stats; // Counters reported by `hal_get_queue_statistics()`
+};
+
+/**
+ * @brief Sets up an empty queue for a drive.
+ * @param p_queue The queue to set up
+ * @param p_sectors_per_cylinder The number of sectors in each cylinder of the drive
+ */
+void block_queue_initialize(struct BlockQueue *p_queue, uint16_t p_sectors_per_cylinder);
+
+/**
+ * @brief Adds a request to a queue. It is merged into a queued request that it carries on from if they are both on the
+ * same cylinder and their buffers are contiguous, and is otherwise put in order of cylinder with C-SCAN: requests on
+ * or after the cylinder the sweep is up to come first, then the rest from the start of the disk. Must be called with
+ * interrupts disabled if the queue is also used by an interrupt handler.
+ * @param p_queue The queue to add the request to
+ * @param p_request The request to add. Its status is set to `BLOCK_STATUS_PENDING`.
+ */
+void block_queue_add(struct BlockQueue *p_queue, struct BlockRequest *p_request);
+
+/**
+ * @brief Takes the next request off a queue, moving the sweep up to its cylinder.
+ * @param p_queue The queue to take the request from
+ * @return The request, along with any merged into it, or `NULL` if the queue is empty.
+ */
+struct BlockRequest *block_queue_take(struct BlockQueue *p_queue);
+
+/**
+ * @brief Gets the number of bytes a request covers once the requests merged into it are added on.
+ * @param p_request The request taken off the queue
+ * @return The size of the whole transfer in bytes.
+ */
+uint32_t block_queue_transfer_size(struct BlockRequest *p_request);
+
+/**
+ * @brief Sets the status of a request taken off a queue and of every request merged into it, calls their completion
+ * functions, and updates the queue's counters.
+ * @param p_queue The queue the request was taken from
+ * @param p_request The request that finished
+ * @param p_status The `BlockStatus` it finished with
+ */
+void block_queue_complete(struct BlockQueue *p_queue, struct BlockRequest *p_request, uint8_t p_status);
@@ -1,6 +1,8 @@
 #include "floppy.h"
+#include "../block_queue.h"
 
 #include <aurora/arch/interrupts.h>
+#include <aurora/memory.h>
 
 #include <sys/time.h>
 
@@ -9,6 +11,8 @@
 #define AUR_MODULE "floppy"
 #include <aurora/debug.h>
 
+#include <string.h>
+
 enum FloppyRegisters
 {
 	REGISTER_STATUS_A		   = 0x3f0, // read-only, status of drive A (SRA)
@@ -85,12 +89,63 @@ enum FloppyCommands
 
 // Custom data structures
 
+// Number of times the MSR is polled before the controller is taken to be stuck. Reading an ISA port takes about a
+// microsecond, so this is a few hundred milliseconds.
+#define FLOPPY_POLL_LIMIT 200000
+
+// Milliseconds the motor needs to get up to speed before the drive can seek
+#define FLOPPY_MOTOR_SPINUP_MS 50
+
+// Milliseconds a drive has to go unused for before its motor is turned off
+#define FLOPPY_MOTOR_IDLE_MS 3000
+
+// Milliseconds to wait for the interrupt that ends a command before giving up on it
+#define FLOPPY_COMMAND_TIMEOUT_MS 2000
+
+// Number of times a transfer is tried before its request fails
+#define FLOPPY_MAX_ATTEMPTS 3
+
+#define SECTOR_SIZE 512
+
+// Number of cylinders kept in memory. With two, the next cylinder can be read ahead while the last one is used.
+#define FLOPPY_TRACK_COUNT 2
+
+// Size of the buffer that writes, and reads skipping the cylinders in memory, go through. It is a single page, so
+// pieces that fit in it never cross a page either.
+#define FLOPPY_BOUNCE_SIZE 0x1000
+
+// ISA DMA only reaches the first 16 MiB of physical memory
+#define FLOPPY_DMA_LIMIT 0x1000000
+
+// Steps a request goes through. Each one ends with IRQ6, apart from spinning up which ends on a timer tick.
+enum FloppyState
+{
+	FLOPPY_STATE_IDLE		 = 0, // No request is being carried out
+	FLOPPY_STATE_SPINUP		 = 1, // Waiting for the motor to get up to speed
+	FLOPPY_STATE_SEEK		 = 2, // Waiting for the heads to reach the cylinder
+	FLOPPY_STATE_TRANSFER	 = 3, // Waiting for the data to be read or written
+	FLOPPY_STATE_RESET		 = 4, // Waiting for the controller to come out of a reset after a command timed out
+	FLOPPY_STATE_RECALIBRATE = 5, // Waiting for the heads to go back to cylinder 0 after a reset
+};
+
+// A whole cylinder of a drive, read with a single multitrack command into memory that DMA can reach
+struct FloppyTrack
+{
+	struct BlockRequest request; // Read that fills the buffer. The track holds the cylinder once it is done.
+	uint8_t *data;				 // Virtual address of the buffer
+	bool stale;					 // Whether the cylinder was written to while the buffer was being filled
+};
+
 struct FloppyDrive
 {
 	bool exists;
 	uint8_t dsr_value;
 	uint8_t step_rate_head_unload;
 	uint8_t head_load_use_dma;
+	bool motor_on;		// Whether the drive's motor is running
+	uint32_t motor_off; // Time in milliseconds at which the motor is turned off, unless the drive is used again
+	int16_t cylinder;	// Cylinder the heads are on, or -1 if it isn't known
+	uint16_t cylinders; // Number of cylinders on the disk in the drive, or 0 if it isn't known
 };
 
 struct FloppyConfig
@@ -101,6 +156,17 @@ struct FloppyConfig
 	uint8_t current_drive;
 	struct FloppyDrive drives[2];
 	bool initialized;
+	bool implied_seek;							   // Whether READ/WRITE DATA seek to the cylinder on their own
+	volatile uint8_t state;						   // `FloppyState` of the request being carried out
+	uint32_t deadline;							   // Time in milliseconds at which the current state ends or times out
+	struct BlockRequest *active;				   // Request being carried out
+	struct BlockQueue queues[2];				   // Requests waiting to be carried out on each drive
+	struct FloppyTrack tracks[FLOPPY_TRACK_COUNT]; // Cylinders kept in memory
+	uint32_t track_size;						   // Size of a cylinder in bytes, or 0 if reads aren't cached
+	uint32_t bounce;							   // Physical address of the buffer other transfers go through, or 0
+	uint8_t last_track;							   // Index of the track that was read from most recently
+	uint8_t next_drive;							   // Drive the last read was from
+	uint16_t next_lba;							   // Sector just after the last read, to spot sequential reads
 };
 
 static struct FloppyConfig fc;
@@ -108,40 +174,66 @@ static struct FloppyConfig fc;
 static volatile bool irq_handled = 0;
 
 static void floppy_drive_reset(uint8_t drive_id);
+static void floppy_seek_done();
+static void floppy_issue_transfer();
+static void floppy_transfer_done();
+static void floppy_reset_done();
+static void floppy_recalibrate_done();
 
 bool floppy_disk_handler(struct Registers *p_regs)
 {
 	irq_handled = true;
 
+	// Interrupts outside of a request come from resets and recalibrations, which wait on `irq_handled` instead
+	switch (fc.state)
+	{
+		case FLOPPY_STATE_SEEK:
+			floppy_seek_done();
+			break;
+		case FLOPPY_STATE_TRANSFER:
+			floppy_transfer_done();
+			break;
+		case FLOPPY_STATE_RESET:
+			floppy_reset_done();
+			break;
+		case FLOPPY_STATE_RECALIBRATE:
+			floppy_recalibrate_done();
+			break;
+		default:
+			break;
+	}
+
 	send_end_of_interrupt(p_regs->interrupt);
 	return true;
 }
 
-static void floppy_write_command(uint8_t command)
+static uint32_t floppy_get_time_ms()
+{
+	timer_t timer;
+	return timer_get_time(&timer) ? timer.time_ms : 0;
+}
+
+static bool floppy_write_command(uint8_t command)
 {
-	// Check every N times to see if the drive is up to speed.
-	for (int i = 0; i < 120; i++)
+	// The controller takes the next byte as soon as RQM is set, which is usually within a few microseconds
+	for (int i = 0; i < FLOPPY_POLL_LIMIT; i++)
 	{
-		timer_sleep(2); // Wait 2ms until issuing another command
 		if ((inb(REGISTER_MAIN_STATUS) & (MSR_RQM | MSR_DIO)) == MSR_RQM)
 		{
 			outb(REGISTER_DATA_FIFO, command);
-			return;
+			return true;
 		}
 	}
 
 	LOG_ERROR("Controller timed out, waited too long on command %hhx.", command);
+	return false;
 }
 
 static uint8_t floppy_read_data()
 {
-	while ((inb(REGISTER_MAIN_STATUS) & (MSR_RQM | MSR_DIO)) != (MSR_RQM | MSR_DIO))
-		;
-
-	for (int i = 0; i < 120; i++)
+	for (int i = 0; i < FLOPPY_POLL_LIMIT; i++)
 	{
-		timer_sleep(2);
-		if (inb(REGISTER_MAIN_STATUS) & MSR_RQM)
+		if ((inb(REGISTER_MAIN_STATUS) & (MSR_RQM | MSR_DIO)) == (MSR_RQM | MSR_DIO))
 		{
 			return inb(REGISTER_DATA_FIFO);
 		}
@@ -151,6 +243,29 @@ static uint8_t floppy_read_data()
 	return 0;
 }
 
+/**
+ * @brief Waits for IRQ6 outside of a request, halting the CPU until an interrupt arrives. `irq_handled` must be
+ * cleared before the command that raises it is sent.
+ * @return `true` if the interrupt arrived, and `false` if it timed out.
+ */
+static bool floppy_wait_for_irq()
+{
+	uint32_t deadline = floppy_get_time_ms() + FLOPPY_COMMAND_TIMEOUT_MS;
+	uint32_t flags	  = interrupts_enable_save();
+	while (!irq_handled && (int32_t)(deadline - floppy_get_time_ms()) > 0)
+	{
+		__asm__ volatile("hlt");
+	}
+
+	interrupts_restore(flags);
+	if (!irq_handled)
+	{
+		LOG_ERROR("Controller timed out, no interrupt was raised.");
+	}
+
+	return irq_handled;
+}
+
 static void floppy_drive_reset(uint8_t drive_id)
 {
 	// Prevent race condition with IRQ 6
@@ -158,14 +273,10 @@ static void floppy_drive_reset(uint8_t drive_id)
 	// Set reset flag in DSR plus the drive info
 	outb(REGISTER_DATARATE_SELECTOR, fc.drives[drive_id].dsr_value | 0x80);
 
-	while (!irq_handled)
-		;
+	floppy_wait_for_irq();
 
 	// Check for interrupt
 	floppy_write_command(FLOPPY_SENSE_INTERRUPT);
-	while ((inb(REGISTER_MAIN_STATUS) & MSR_RQM) == 0)
-	{
-	}
 	(void)floppy_read_data();
 	(void)floppy_read_data();
 
@@ -188,9 +299,7 @@ static void floppy_recalibrate(uint8_t drive_id)
 		floppy_write_command(FLOPPY_RECALIBRATE);
 		floppy_write_command(drive_id);
 
-		while (!irq_handled)
-		{
-		}
+		floppy_wait_for_irq();
 
 		floppy_write_command(FLOPPY_SENSE_INTERRUPT);
 		uint8_t st0 = floppy_read_data();
@@ -198,6 +307,7 @@ static void floppy_recalibrate(uint8_t drive_id)
 
 		if (st0 & (1 << 5))
 		{
+			fc.drives[drive_id].cylinder = 0;
 			return;
 		}
 	}
@@ -212,133 +322,547 @@ static void floppy_lba_to_chs(uint16_t lba, uint16_t *cylinder, uint16_t *sector
 	*sector	  = (lba % fc.sectors) + 1;
 }
 
-static bool floppy_drive_begin_rw(uint8_t drive_id, uint16_t lba, void *start, size_t size, bool is_write)
+/**
+ * @brief Starts an attempt at the request being carried out, with a seek or by going straight to the transfer if no
+ * seek is needed. The drive's motor must be up to speed.
+ */
+static void floppy_issue_seek()
 {
-	// Start up the motor
-	uint8_t dor = inb(REGISTER_DIGITAL_OUTPUT);
-	outb(REGISTER_DIGITAL_OUTPUT,
-		 dor | (DOR_MOTA << drive_id) | (drive_id > 0 ? DOR_DSELB << (drive_id - 1) : DOR_DSELA));
-	timer_sleep(50); // Wait 50ms to turn the motor on
+	struct BlockRequest *request = fc.active;
+	uint8_t drive_id			  = request->drive;
 
-	// Check if current drive is set
-	if (fc.current_drive != drive_id)
+	uint16_t cylinder, sector, head;
+	floppy_lba_to_chs(request->lba, &cylinder, &sector, &head);
+	request->attempts++;
+
+	// The controller seeks on its own as part of the transfer with implied seeks on, and there's nothing to do if the
+	// heads are already on the cylinder
+	if (fc.implied_seek || fc.drives[drive_id].cylinder == cylinder)
 	{
-		outb(REGISTER_CONFIG_CONTROL, fc.drives[drive_id].dsr_value);
+		floppy_issue_transfer();
+		return;
 	}
 
-	// Specify the new drive
-	floppy_write_command(FLOPPY_SPECIFY);
-	floppy_write_command(fc.drives[drive_id].step_rate_head_unload);
-	floppy_write_command(fc.drives[drive_id].head_load_use_dma);
+	fc.state	= FLOPPY_STATE_SEEK;
+	fc.deadline = floppy_get_time_ms() + FLOPPY_COMMAND_TIMEOUT_MS;
+	floppy_write_command(FLOPPY_SEEK);
+	floppy_write_command((head << 2) | drive_id);
+	floppy_write_command(cylinder);
+}
+
+/**
+ * @brief Sets up DMA and sends the read or write for the request being carried out. The heads must already be
+ * on the right cylinder.
+ */
+static void floppy_issue_transfer()
+{
+	struct BlockRequest *request = fc.active;
+	uint8_t drive_id			  = request->drive;
 
 	uint16_t cylinder, sector, head;
-	floppy_lba_to_chs(lba, &cylinder, &sector, &head);
+	floppy_lba_to_chs(request->lba, &cylinder, &sector, &head);
 
-	// Seek + sense interrupt
-	floppy_write_command(FLOPPY_SEEK);
+	floppy_dma_setup_for_location(request->buffer, block_queue_transfer_size(request));
+	if (request->write)
+	{
+		floppy_dma_write();
+	}
+	else
+	{
+		floppy_dma_read();
+	}
+
+	fc.state	= FLOPPY_STATE_TRANSFER;
+	fc.deadline = floppy_get_time_ms() + FLOPPY_COMMAND_TIMEOUT_MS;
+	floppy_write_command((request->write ? FLOPPY_WRITE_DATA : FLOPPY_READ_DATA) | BIT_MULTITRACK | BIT_MFM);
 	floppy_write_command((head << 2) | drive_id);
 	floppy_write_command(cylinder);
+	floppy_write_command(head);
+	floppy_write_command(sector);
+	floppy_write_command(2);
+	floppy_write_command(fc.sectors);
+	floppy_write_command(0x1b);
+	floppy_write_command(0xff);
+}
+
+/**
+ * @brief Selects the drive for the request being carried out and starts its motor. If the motor was already
+ * running the seek is sent straight away, otherwise it is left to the timer once the motor is up to speed.
+ */
+static void floppy_start_request()
+{
+	uint8_t drive_id		  = fc.active->drive;
+	struct FloppyDrive *drive = &fc.drives[drive_id];
 
-	while (!irq_handled)
+	bool spinning = drive->motor_on;
+	uint8_t dor	  = inb(REGISTER_DIGITAL_OUTPUT);
+	outb(REGISTER_DIGITAL_OUTPUT, (dor & ~DOR_DSELD) | (DOR_MOTA << drive_id) | drive_id);
+	drive->motor_on = true;
+
+	// The data rate and timings are shared by both drives, so they only need to be sent when the other drive was used
+	// last
+	if (fc.current_drive != drive_id)
+	{
+		outb(REGISTER_CONFIG_CONTROL, drive->dsr_value);
+		floppy_write_command(FLOPPY_SPECIFY);
+		floppy_write_command(drive->step_rate_head_unload);
+		floppy_write_command(drive->head_load_use_dma);
+		fc.current_drive = drive_id;
+	}
+
+	if (!spinning)
 	{
+		fc.state	= FLOPPY_STATE_SPINUP;
+		fc.deadline = floppy_get_time_ms() + FLOPPY_MOTOR_SPINUP_MS;
+		return;
 	}
 
+	floppy_issue_seek();
+}
+
+/**
+ * @brief Takes the next request off the queues and starts it. The drive that was used last is kept to while it has
+ * requests waiting, so that the controller isn't switched between drives more than it needs to be.
+ */
+static void floppy_start_next_request()
+{
+	struct BlockRequest *request = block_queue_take(&fc.queues[fc.current_drive]);
+	if (!request && fc.drive_count > 1)
+	{
+		request = block_queue_take(&fc.queues[!fc.current_drive]);
+	}
+
+	fc.active = request;
+	if (request)
+	{
+		floppy_start_request();
+	}
+}
+
+/**
+ * @brief Finishes the request being carried out, starts the next one and then reports the result.
+ * @param p_status The `BlockStatus` the request finished with
+ */
+static void floppy_finish_request(uint8_t p_status)
+{
+	struct BlockRequest *request = fc.active;
+
+	// The heads may have been left anywhere by a failed request
+	struct FloppyDrive *drive = &fc.drives[request->drive];
+	drive->motor_off		  = floppy_get_time_ms() + FLOPPY_MOTOR_IDLE_MS;
+	if (p_status != BLOCK_STATUS_DONE)
+	{
+		drive->cylinder = -1;
+	}
+
+	// The next request is started first, so that a callback which submits another one only adds it to the queue
+	fc.state = FLOPPY_STATE_IDLE;
+	floppy_start_next_request();
+	block_queue_complete(&fc.queues[request->drive], request, p_status);
+}
+
+/**
+ * @brief Tries the request being carried out again, or fails the request once it has been tried too many times.
+ */
+static void floppy_retry_request()
+{
+	if (fc.active->attempts < FLOPPY_MAX_ATTEMPTS)
+	{
+		floppy_issue_seek();
+		return;
+	}
+
+	LOG_ERROR("Read/write operation failed after %d attempts.", FLOPPY_MAX_ATTEMPTS);
+	floppy_finish_request(BLOCK_STATUS_FAILED);
+}
+
+/**
+ * @brief Resets the controller after it stopped answering the request being carried out. It is still in the middle of
+ * the command that hung, and refuses the bytes of any new one until it is reset. The request is tried again once the
+ * heads have been recalibrated.
+ */
+static void floppy_begin_reset()
+{
+	// The heads may have been left anywhere on either drive
+	for (int i = 0; i < fc.drive_count; i++)
+	{
+		fc.drives[i].cylinder = -1;
+	}
+
+	fc.state	= FLOPPY_STATE_RESET;
+	fc.deadline = floppy_get_time_ms() + FLOPPY_COMMAND_TIMEOUT_MS;
+	outb(REGISTER_DATARATE_SELECTOR, fc.drives[fc.active->drive].dsr_value | 0x80);
+}
+
+static void floppy_reset_done()
+{
+	uint8_t drive_id		  = fc.active->drive;
+	struct FloppyDrive *drive = &fc.drives[drive_id];
+
+	floppy_write_command(FLOPPY_SENSE_INTERRUPT);
+	(void)floppy_read_data();
+	(void)floppy_read_data();
+
+	// A reset loses the data rate and timings, but the locked configuration survives it
+	outb(REGISTER_CONFIG_CONTROL, drive->dsr_value);
+	floppy_write_command(FLOPPY_SPECIFY);
+	floppy_write_command(drive->step_rate_head_unload);
+	floppy_write_command(drive->head_load_use_dma);
+	fc.current_drive = drive_id;
+
+	fc.state	= FLOPPY_STATE_RECALIBRATE;
+	fc.deadline = floppy_get_time_ms() + FLOPPY_COMMAND_TIMEOUT_MS;
+	floppy_write_command(FLOPPY_RECALIBRATE);
+	floppy_write_command(drive_id);
+}
+
+static void floppy_recalibrate_done()
+{
+	uint8_t drive_id = fc.active->drive;
+
 	floppy_write_command(FLOPPY_SENSE_INTERRUPT);
+	uint8_t st0 = floppy_read_data();
+	(void)floppy_read_data();
 
-	while ((inb(REGISTER_MAIN_STATUS) & MSR_RQM) == 0)
+	if (st0 & (1 << 5))
 	{
+		fc.drives[drive_id].cylinder = 0;
 	}
 
+	floppy_retry_request();
+}
+
+static void floppy_seek_done()
+{
+	uint8_t drive_id = fc.active->drive;
+
+	floppy_write_command(FLOPPY_SENSE_INTERRUPT);
 	uint8_t st0 = floppy_read_data();
 	(void)floppy_read_data();
 
-	if (st0 != (0x20 | drive_id))
+	// ST0 carries the head the seek was sent with, which doesn't matter here
+	if ((st0 & ~0x04) != (0x20 | drive_id))
 	{
 		LOG_ERROR("Seek command failed, got 0x%hhx, expected 0x%hhx.", st0, (0x20 | drive_id));
+		fc.drives[drive_id].cylinder = -1;
+		floppy_retry_request();
+		return;
 	}
 
-	fc.current_drive = drive_id;
-	floppy_dma_setup_for_location(start, size);
-	if (is_write)
+	uint16_t cylinder, sector, head;
+	floppy_lba_to_chs(fc.active->lba, &cylinder, &sector, &head);
+	fc.drives[drive_id].cylinder = cylinder;
+	floppy_issue_transfer();
+}
+
+static void floppy_transfer_done()
+{
+	uint8_t st0 = floppy_read_data();
+	uint8_t st1 = floppy_read_data();
+	uint8_t st2 = floppy_read_data();
+	(void)floppy_read_data();
+	(void)floppy_read_data();
+	(void)floppy_read_data();
+	uint8_t two = floppy_read_data();
+
+	// The heads may have ended up on another cylinder if the transfer failed, so they are moved again on a retry
+	fc.drives[fc.active->drive].cylinder = -1;
+	if (two != 2 || (st0 & 0x80) || (st0 & 0x40))
 	{
-		floppy_dma_write();
+		floppy_retry_request();
+	}
+	else if (st1 & 0x80)
+	{
+		LOG_ERROR("Insufficient sector count to complete the read/write operation.");
+		floppy_finish_request(BLOCK_STATUS_FAILED);
+	}
+	else if (st1 & 0x10)
+	{
+		LOG_ERROR("Driver took too long to get bytes in and out of the FIFO port.");
+		floppy_retry_request();
+	}
+	else if (st1 & 0x02)
+	{
+		LOG_ERROR("Media is write-protected, unable to write.");
+		floppy_finish_request(BLOCK_STATUS_FAILED);
+	}
+	else if (st2 != 0)
+	{
+		LOG_ERROR("Potential bad drive/media problems.");
+		floppy_retry_request();
 	}
 	else
 	{
-		floppy_dma_read();
+		uint16_t cylinder, sector, head;
+		floppy_lba_to_chs(fc.active->lba, &cylinder, &sector, &head);
+		fc.drives[fc.active->drive].cylinder = cylinder;
+		floppy_finish_request(BLOCK_STATUS_DONE);
 	}
+}
 
-	for (int i = 0; i < 3; i++)
+/**
+ * @brief Moves the request being carried out on once its current step has run out of time. The motor has spun up by
+ * then, while a command the controller never answered is given up on and the controller is reset.
+ * @param now The current time in milliseconds
+ */
+static void floppy_check_deadline(uint32_t now)
+{
+	if (fc.state == FLOPPY_STATE_IDLE || (int32_t)(now - fc.deadline) < 0)
 	{
-		irq_handled = false;
-		// Ready for reading
-		floppy_write_command((is_write ? FLOPPY_WRITE_DATA : FLOPPY_READ_DATA) | BIT_MULTITRACK | BIT_MFM);
-		floppy_write_command((head << 2) | drive_id);
-		floppy_write_command(cylinder);
-		floppy_write_command(head);
-		floppy_write_command(sector);
-		floppy_write_command(2);
-		floppy_write_command(fc.sectors);
-		floppy_write_command(0x1b);
-		floppy_write_command(0xff);
-
-		while (!irq_handled)
-		{
-		}
-		while (!(inb(REGISTER_MAIN_STATUS) & (MSR_RQM | MSR_DIO)))
+		return;
+	}
+
+	switch (fc.state)
+	{
+		case FLOPPY_STATE_SPINUP:
+			floppy_issue_seek();
+			break;
+		case FLOPPY_STATE_SEEK:
+			LOG_ERROR("Controller timed out on seek to sector %hu.", fc.active->lba);
+			floppy_begin_reset();
+			break;
+		case FLOPPY_STATE_TRANSFER:
+			LOG_ERROR("Controller timed out on read/write operation.");
+			floppy_begin_reset();
+			break;
+		case FLOPPY_STATE_RESET:
+		case FLOPPY_STATE_RECALIBRATE:
+			LOG_ERROR("Controller didn't recover from a reset.");
+			floppy_finish_request(BLOCK_STATUS_FAILED);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief Called on every timer tick. Turns off motors that have been idle for long enough, and moves the request being
+ * carried out on once its current step has run out of time.
+ */
+static void floppy_timer_tick()
+{
+	uint32_t now = floppy_get_time_ms();
+
+	// Motors are left running between requests, and only turned off once a drive has gone unused for a while
+	for (int i = 0; i < fc.drive_count; i++)
+	{
+		struct FloppyDrive *drive = &fc.drives[i];
+		if (drive->motor_on && (!fc.active || fc.active->drive != i) && (int32_t)(now - drive->motor_off) >= 0)
 		{
+			outb(REGISTER_DIGITAL_OUTPUT, inb(REGISTER_DIGITAL_OUTPUT) & ~(DOR_MOTA << i));
+			drive->motor_on = false;
 		}
+	}
 
-		st0			= floppy_read_data();
-		uint8_t st1 = floppy_read_data();
-		uint8_t st2 = floppy_read_data();
-		(void)floppy_read_data();
-		(void)floppy_read_data();
-		(void)floppy_read_data();
-		uint8_t two = floppy_read_data();
+	floppy_check_deadline(now);
+}
 
-		if (two != 2)
+/**
+ * @brief Waits for a submitted request to finish. The CPU is halted between interrupts rather than spinning, and
+ * interrupts are enabled for the wait since requests are completed from IRQ6.
+ * @return `true` if the request finished without errors, and `false` if not.
+ */
+static bool floppy_wait_for_request(struct BlockRequest *p_request)
+{
+	uint32_t flags = interrupts_enable_save();
+	while (p_request->status == BLOCK_STATUS_PENDING)
+	{
+		__asm__ volatile("hlt");
+
+		// Deadlines are checked here as well as on the timer, so that every step of a request still ends even if the
+		// timer never calls back
+		interrupts_disable_save();
+		floppy_check_deadline(floppy_get_time_ms());
+		interrupts_enable_save();
+	}
+
+	interrupts_restore(flags);
+	return p_request->status == BLOCK_STATUS_DONE;
+}
+
+static bool floppy_drive_begin_rw(uint8_t drive_id, uint16_t lba, void *start, size_t size, bool is_write)
+{
+	struct BlockRequest request = {0};
+	request.drive				 = drive_id;
+	request.write				 = is_write;
+	request.lba					 = lba;
+	request.buffer				 = start;
+	request.size				 = size;
+	if (!floppy_submit(&request))
+	{
+		return false;
+	}
+
+	return floppy_wait_for_request(&request);
+}
+
+/**
+ * @brief Transfers to or from a drive through the bounce buffer a piece at a time, copying each piece in or out. The
+ * caller's buffer doesn't have to be reachable by DMA, or even physically contiguous. Pieces that already sit in a
+ * single page that DMA can reach are transferred in place instead. Swap's own buffer is always such a page, which
+ * matters because copying to or from the bounce buffer can fault and swap a page in or out part of the way through.
+ * @param drive_id The drive to transfer to or from
+ * @param lba The sector to start at
+ * @param buffer The virtual address to copy the data to or from
+ * @param size The number of bytes to transfer
+ * @param is_write Whether to write the buffer to the drive, rather than read into it.
+ * @return `true` if every piece was transferred, and `false` if not.
+ */
+static bool floppy_transfer_bounced(uint8_t drive_id, uint16_t lba, uint8_t *buffer, size_t size, bool is_write)
+{
+	uint8_t *bounce		  = (uint8_t *)physical_to_virtual(fc.bounce);
+	uint16_t per_cylinder = fc.sectors * fc.heads;
+	while (size > 0)
+	{
+		// A single command can't go past the end of a cylinder
+		uint32_t count	  = AMIN(size, AMIN(FLOPPY_BOUNCE_SIZE, (per_cylinder - lba % per_cylinder) * SECTOR_SIZE));
+		uint32_t physical = virtual_to_physical((uint32_t)buffer);
+		bool in_page	  = (uint32_t)buffer % 0x1000 + count <= 0x1000;
+		bool direct		  = physical && in_page && physical + count <= FLOPPY_DMA_LIMIT;
+		if (!direct && !fc.bounce)
 		{
-			continue;
+			return false;
 		}
 
-		if ((st0 & 0x80) || (st0 & 0x40))
+		if (is_write && !direct)
 		{
-			continue;
+			memcpy(bounce, buffer, count);
 		}
 
-		if (st1 & 0x80)
+		void *target = direct ? (void *)physical : (void *)fc.bounce;
+		if (!floppy_drive_begin_rw(drive_id, lba, target, count, is_write))
 		{
-			LOG_ERROR("Insufficient sector count to complete the read/write operation.");
 			return false;
 		}
 
-		if (st1 & 0x10)
+		if (!is_write && !direct)
 		{
-			LOG_ERROR("Driver took too long to get bytes in and out of the FIFO port.");
-			continue;
+			memcpy(buffer, bounce, count);
 		}
 
-		if (st1 & 0x02)
+		buffer += count;
+		size -= count;
+		lba += count / SECTOR_SIZE;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Finds the track that holds, or is being filled with, a cylinder.
+ * @param drive_id The drive the cylinder is on
+ * @param lba The first sector of the cylinder
+ * @return The track, or `NULL` if the cylinder isn't in memory.
+ */
+static struct FloppyTrack *floppy_find_track(uint8_t drive_id, uint16_t lba)
+{
+	for (int i = 0; i < FLOPPY_TRACK_COUNT; i++)
+	{
+		struct FloppyTrack *track = &fc.tracks[i];
+		if (track->data && !track->stale && track->request.drive == drive_id && track->request.lba == lba &&
+			track->request.status != BLOCK_STATUS_FAILED)
 		{
-			LOG_ERROR("Media is write-protected, unable to write.");
-			return false;
+			return track;
 		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Starts reading a cylinder into the track that wasn't read from most recently, without waiting for it.
+ * @param drive_id The drive the cylinder is on
+ * @param lba The first sector of the cylinder
+ * @return The track being filled, or `NULL` if it is still busy or the read couldn't be queued.
+ */
+static struct FloppyTrack *floppy_fill_track(uint8_t drive_id, uint16_t lba)
+{
+	struct FloppyTrack *track = &fc.tracks[(fc.last_track + 1) % FLOPPY_TRACK_COUNT];
+	if (track->request.status == BLOCK_STATUS_PENDING)
+	{
+		return NULL;
+	}
+
+	// Whatever the track held is gone from here on, even if the read can't be queued
+	track->request.status = BLOCK_STATUS_FAILED;
+	track->stale		  = false;
+	track->request.drive  = drive_id;
+	track->request.write  = false;
+	track->request.lba	  = lba;
+	track->request.size	  = fc.track_size;
+	return floppy_submit(&track->request) ? track : NULL;
+}
+
+/**
+ * @brief Gets a cylinder into memory, reading it from the drive if it isn't there already.
+ * @param drive_id The drive the cylinder is on
+ * @param lba The first sector of the cylinder
+ * @return The track holding the cylinder, or `NULL` if it couldn't be read.
+ */
+static struct FloppyTrack *floppy_load_track(uint8_t drive_id, uint16_t lba)
+{
+	struct FloppyTrack *track = floppy_find_track(drive_id, lba);
+	if (!track)
+	{
+		// A read ahead into the other track has to finish before the track can be reused
+		floppy_wait_for_request(&fc.tracks[(fc.last_track + 1) % FLOPPY_TRACK_COUNT].request);
+		track = floppy_fill_track(drive_id, lba);
+	}
+
+	if (!track || !floppy_wait_for_request(&track->request))
+	{
+		return NULL;
+	}
+
+	fc.last_track = track - fc.tracks;
+	return track;
+}
+
+/**
+ * @brief Allocates the buffers that cylinders are read into, and the one that every other transfer goes through. Reads
+ * go straight to the drive if the cylinder buffers can't be allocated.
+ */
+static void floppy_allocate_buffers()
+{
+	fc.bounce = kalloc_dma(FLOPPY_BOUNCE_SIZE);
+	if (!fc.bounce)
+	{
+		LOG_WARNING("No memory that DMA can reach for a bounce buffer, uncached reads and writes may fail.");
+	}
 
-		if (st2 != 0)
+	uint16_t per_cylinder = fc.sectors * fc.heads;
+	uint32_t size		  = per_cylinder * SECTOR_SIZE;
+	// DMA counts are 16 bits wide, so a cylinder has to be read in a single transfer of under 64 KiB
+	if (size == 0 || size >= 0x10000)
+	{
+		LOG_WARNING("Cylinders of %u bytes can't be read whole, reads will not be cached.", size);
+		return;
+	}
+
+	for (int i = 0; i < FLOPPY_TRACK_COUNT; i++)
+	{
+		uint32_t buffer = kalloc_dma(size);
+		if (!buffer)
 		{
-			LOG_ERROR("Potential bad drive/media problems.");
-			continue;
+			LOG_WARNING("No memory that DMA can reach for track buffers, reads will not be cached.");
+			for (int j = 0; j < i; j++)
+			{
+				kfree_dma((uint32_t)fc.tracks[j].request.buffer, size);
+				fc.tracks[j].data = NULL;
+			}
+
+			return;
 		}
 
-		return true;
+		fc.tracks[i].request.buffer = (void *)buffer;
+		fc.tracks[i].request.status = BLOCK_STATUS_FAILED;
+		fc.tracks[i].data			= (uint8_t *)physical_to_virtual(buffer);
 	}
 
-	LOG_ERROR("Controller timed out on read/write operation.");
-	return false;
+	fc.track_size = size;
 }
 
-void floppy_initialize()
+void floppy_initialize(uint8_t p_boot_drive)
 {
 	if (fc.drive_count > 0)
 	{
@@ -369,6 +893,12 @@ void floppy_initialize()
 	fc.sectors = *(uint16_t *)(0x7c00 + 0x18);
 	fc.heads   = *(uint16_t *)(0x7c00 + 0x1a);
 
+	// Only the size of the boot disk is known, so reads are only read ahead on its drive
+	if (p_boot_drive < fc.drive_count && fc.sectors && fc.heads)
+	{
+		fc.drives[p_boot_drive].cylinders = *(uint16_t *)(0x7c00 + 0x13) / (fc.sectors * fc.heads);
+	}
+
 	floppy_write_command(FLOPPY_VERSION);
 	if (floppy_read_data() != 0x90)
 	{
@@ -378,18 +908,20 @@ void floppy_initialize()
 	}
 
 	// Configure device
-	floppy_write_command(FLOPPY_CONFIGURE);
-	floppy_write_command(0);
+	bool configured = floppy_write_command(FLOPPY_CONFIGURE);
+	configured		= floppy_write_command(0) && configured;
 	// Enable (LTR) implied seeks ON, FIFO ON, drive polling OFF, threshold 8
-	floppy_write_command((1 << 6) | (0 << 5) | 1 << 4 | 9);
+	configured = floppy_write_command((1 << 6) | (0 << 5) | 1 << 4 | 9) && configured;
 	// Disable precompensation
-	floppy_write_command(0);
+	configured = floppy_write_command(0) && configured;
 
-	// Lock FIFO configuration so we don't re-enable it on reset
+	// Lock FIFO configuration so we don't re-enable it on reset. Without the lock, a reset after a timeout turns
+	// implied seeks back off, so the driver sends its own seeks instead.
 	floppy_write_command(FLOPPY_LOCK | BIT_MULTITRACK);
-	if (floppy_read_data() != (1 << 4))
+	fc.implied_seek = floppy_read_data() == (1 << 4) && configured;
+	if (!fc.implied_seek)
 	{
-		return;
+		LOG_WARNING("Controller configuration couldn't be locked, seeks will be sent before each transfer.");
 	}
 
 	// Enable DMA now that the FDC is hopefully ready to work
@@ -406,6 +938,7 @@ void floppy_initialize()
 		// 10ms head load time, use DMA
 		// HLT = ms * data_rate / 1000000
 		fc.drives[i].head_load_use_dma = 5 << 4 | 0;
+		fc.drives[i].cylinder		   = -1;
 
 		floppy_drive_reset(i);
 		uint8_t dor = inb(REGISTER_DIGITAL_OUTPUT);
@@ -417,51 +950,167 @@ void floppy_initialize()
 			outb(REGISTER_DIGITAL_OUTPUT, dor | (i > 0 ? DOR_DSELB + (i - 1) : DOR_DSELA));
 			floppy_recalibrate(i);
 		}
+
+		// A motor the BIOS left running is turned off by the timer if nothing uses the drive
+		fc.drives[i].motor_on  = dor & (DOR_MOTA << i);
+		fc.drives[i].motor_off = floppy_get_time_ms() + FLOPPY_MOTOR_IDLE_MS;
+	}
+
+	// Each reset sends the drive's data rate and timings, so the last drive reset is the one the controller is set up
+	// for
+	fc.current_drive = fc.drive_count - 1;
+
+	// Spin-up delays and timeouts are measured on the timer, so that nothing has to wait for them
+	if (!timer_add_callback(floppy_timer_tick))
+	{
+		LOG_ERROR("Failed to register the floppy timer, requests can't be carried out.");
+		return;
+	}
+
+	for (int i = 0; i < fc.drive_count; i++)
+	{
+		block_queue_initialize(&fc.queues[i], fc.sectors * fc.heads);
 	}
 
 	fc.initialized = true;
+	floppy_allocate_buffers();
+}
+
+/**
+ * @brief Drops the cylinders in memory that a write covers. One that is still being filled is marked as stale instead,
+ * as its read is carried out before the write and would otherwise be taken as up to date once it finishes.
+ */
+static void floppy_invalidate_tracks(uint8_t drive_id, uint16_t lba, size_t size)
+{
+	uint16_t per_cylinder = fc.sectors * fc.heads;
+	uint16_t end		  = lba + (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	for (int i = 0; i < FLOPPY_TRACK_COUNT; i++)
+	{
+		struct FloppyTrack *track = &fc.tracks[i];
+		if (!track->data || track->request.drive != drive_id || track->request.lba >= end ||
+			track->request.lba + per_cylinder <= lba)
+		{
+			continue;
+		}
+
+		if (track->request.status == BLOCK_STATUS_PENDING)
+		{
+			track->stale = true;
+		}
+		else
+		{
+			track->request.status = BLOCK_STATUS_FAILED;
+		}
+	}
 }
 
-void *floppy_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size)
+bool floppy_submit(struct BlockRequest *p_request)
 {
 	if (!fc.initialized)
 	{
-		LOG_ERROR("Attempted to read information prior to initializing the floppy disk driver, or that the floppy is "
+		LOG_ERROR("Attempted to submit a request prior to initializing the floppy disk driver, or that the floppy is "
 				  "unsupported.");
-		return NULL;
+		return false;
 	}
 
-	if (fc.drive_count < p_drive)
+	if (p_request->drive >= fc.drive_count || !fc.drives[p_request->drive].exists)
 	{
 		LOG_ERROR("Drive ID does not exist.");
-		return NULL;
+		return false;
 	}
 
-	if (floppy_drive_begin_rw(p_drive, p_lba, p_to, p_size, false))
+	// The queues are also taken from by the interrupt handler
+	uint32_t flags = interrupts_disable_save();
+	if (p_request->write)
 	{
-		return p_to;
+		floppy_invalidate_tracks(p_request->drive, p_request->lba, p_request->size);
 	}
 
-	LOG_ERROR("Failed to read information to disk.");
-	return NULL;
+	block_queue_add(&fc.queues[p_request->drive], p_request);
+	if (!fc.active)
+	{
+		floppy_start_next_request();
+	}
+
+	interrupts_restore(flags);
+	return true;
 }
 
-bool floppy_write(uint8_t p_drive, uint16_t p_lba, void *p_from, size_t p_size)
+bool floppy_get_queue_statistics(uint8_t p_drive, struct BlockQueueStatistics *out_stats)
 {
-	if (!fc.initialized)
+	if (p_drive >= fc.drive_count || !out_stats)
 	{
-		LOG_ERROR("Attempted to write information prior to initializing the floppy disk driver, or that the floppy is "
-				  "unsupported.");
 		return false;
 	}
 
-	if (fc.drive_count < p_drive)
+	*out_stats = fc.queues[p_drive].stats;
+	return true;
+}
+
+void *floppy_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size, bool p_cache)
+{
+	// DMA only reaches the first 16 MiB, so data is read into memory it can reach and copied out from there
+	uint8_t *to = p_to;
+	if (!p_cache || !fc.track_size)
 	{
-		LOG_ERROR("Drive ID does not exist.");
-		return false;
+		if (floppy_transfer_bounced(p_drive, p_lba, to, p_size, false))
+		{
+			return p_to;
+		}
+
+		LOG_ERROR("Failed to read information to disk.");
+		return NULL;
+	}
+
+	// Reads are served from whole cylinders, so reading a file a cluster at a time costs one rotation per track
+	// rather than one per cluster
+	uint16_t per_cylinder = fc.sectors * fc.heads;
+	uint16_t lba		  = p_lba;
+	size_t left			  = p_size;
+	while (left > 0)
+	{
+		uint16_t first			  = lba - lba % per_cylinder;
+		uint32_t offset			  = (lba - first) * SECTOR_SIZE;
+		uint32_t count			  = AMIN(left, fc.track_size - offset);
+		struct FloppyTrack *track = floppy_load_track(p_drive, first);
+
+		// A bad sector anywhere on the cylinder fails reading it whole, so only the sectors asked for are tried before
+		// giving up
+		if (track)
+		{
+			memcpy(to, track->data + offset, count);
+		}
+		else if (!floppy_transfer_bounced(p_drive, lba, to, count, false))
+		{
+			LOG_ERROR("Failed to read information to disk.");
+			return NULL;
+		}
+
+		to += count;
+		left -= count;
+		lba = first + per_cylinder;
+	}
+
+	// A read that carries on from the last one is likely to be followed by another, so the next cylinder is read in
+	// the background while the caller works through this one
+	uint16_t end = p_lba + (p_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	if (p_drive == fc.next_drive && p_lba == fc.next_lba)
+	{
+		uint16_t next = ((end - 1) / per_cylinder + 1) * per_cylinder;
+		if (next / per_cylinder < fc.drives[p_drive].cylinders && !floppy_find_track(p_drive, next))
+		{
+			(void)floppy_fill_track(p_drive, next);
+		}
 	}
 
-	if (floppy_drive_begin_rw(p_drive, p_lba, p_from, p_size, true))
+	fc.next_drive = p_drive;
+	fc.next_lba	  = end;
+	return p_to;
+}
+
+bool floppy_write(uint8_t p_drive, uint16_t p_lba, void *p_from, size_t p_size)
+{
+	if (floppy_transfer_bounced(p_drive, p_lba, p_from, p_size, true))
 	{
 		return true;
 	}
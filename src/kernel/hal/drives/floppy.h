@@ -1,34 +1,58 @@
 #pragma once
 
+#include <aurora/hal/hal.h>
 #include <aurora/kdefs.h>
 
 /**
  * @brief Initializes the floppy disk subsystem. Does not apply mountpoints to drives, as that is governed by the
  * filesystem.
+ * @param p_boot_drive The drive the system was booted from, whose disk geometry is known from its boot sector.
  */
-void floppy_initialize();
+void floppy_initialize(uint8_t p_boot_drive);
 
 /**
  * @brief Reads a number of bytes from the floppy disk into the output buffer. Since protected-mode floppies do not
  * rely on per-sector reading, the amount of bytes available can be a number not equal to that for simplicity in
  * smaller files. However, the offset cannot be specified, so reading smaller files in parts will require correcting
- * the offset used.
+ * the offset used. The read is queued like any other request, and the CPU is halted until it finishes.
  * @param p_drive The drive number to use when reading
  * @param p_lba The Linear Block Address (LBA) to begin reading from
- * @param p_to The output buffer to write data into
+ * @param p_to The virtual address of the output buffer. Data is copied into it, so it doesn't need to be reachable by
+ * DMA.
  * @param p_size The number of bytes to read in
+ * @param p_cache Whether to read whole cylinders into memory, rather than only the sectors asked for.
  * @return The pointer to the output buffer, which should be the same after writing, and `NULL` on failure.
  */
-void *floppy_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size);
+void *floppy_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size, bool p_cache);
+
+/**
+ * @brief Queues a transfer for the floppy disk controller and returns straight away. Each drive has its own queue,
+ * which is ordered by cylinder and merges requests that carry on from each other, and requests are carried out driven
+ * by the controller's interrupts so the CPU is free while the drive seeks and transfers. The request must stay valid
+ * until its status changes.
+ * @param p_request The request to queue. Its status is set to `BLOCK_STATUS_PENDING`.
+ * @return `true` if the request was queued, and `false` if the driver isn't ready or the drive doesn't exist.
+ */
+bool floppy_submit(struct BlockRequest *p_request);
+
+/**
+ * @brief Gets the depth and latency counters of a drive's request queue.
+ * @param p_drive The drive to get the counters of
+ * @param out_stats The structure to copy the counters into.
+ * @return `true` if the counters were written, and `false` if the drive doesn't exist.
+ */
+bool floppy_get_queue_statistics(uint8_t p_drive, struct BlockQueueStatistics *out_stats);
 
 /**
  * @brief Writes a number of bytes from a buffer onto a floppy disk starting from a given sector. It only writes data
  * to disk and does not update dates, nor does it create directory info or write location data to the FAT (if using
  * FAT). As with reading, it also starts from a beginning sector and as such is stuck to 512-byte (or whatever the
- * sector size is) intervals, and data that isn't re-written to this file will be overwritten.
+ * sector size is) intervals, and data that isn't re-written to this file will be overwritten. The write is queued like
+ * any other request, and the CPU is halted until it finishes.
  * @param p_drive The drive ID of which to write to.
  * @param p_lba The starting LBA in which to begin the read
- * @param p_from The buffer in which to read information from
+ * @param p_from The virtual address of the buffer in which to read information from. Data is copied out of it, so it
+ * doesn't need to be reachable by DMA.
  * @param p_size The number of bytes to write into the floppy
  * @return `true` if the command succeeded, and `false` if it failed.
  */
@@ -1,6 +1,7 @@
 #include "drives/floppy.h"
 
 #include <aurora/hal/hal.h>
+#include <aurora/memory.h>
 
 #include <sys/time.h>
 
@@ -12,6 +13,21 @@ extern void kbd_initialize();
 extern void pit_initialize();
 extern uint64_t pit_get_ticks();
 extern uint32_t pit_get_frequency();
+extern bool pit_add_callback(void (*p_callback)());
+
+extern bool block_cache_initialize(uint32_t p_blocks);
+extern bool block_cache_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size);
+extern void block_cache_fill(uint8_t p_drive, uint16_t p_lba, const void *p_from, size_t p_size);
+extern void block_cache_update(uint8_t p_drive, uint16_t p_lba, const void *p_from, size_t p_size);
+extern void *block_cache_pin(uint8_t p_drive, uint16_t p_lba, bool *out_fresh);
+extern void block_cache_unpin(const void *p_block);
+extern void block_cache_discard(const void *p_block);
+extern bool block_cache_get_statistics(struct BlockCacheStatistics *out_stats);
+
+// Number of sectors the block cache holds unless told otherwise (128 KiB)
+#define HAL_CACHE_DEFAULT_BLOCKS 256
+
+#define SECTOR_SIZE 512
 
 void hal_initialize(uint16_t p_driver_no)
 {
@@ -28,12 +44,15 @@ void hal_initialize(uint16_t p_driver_no)
 	if (p_driver_no < 0x80)
 	{
 		// Initialize FDC
-		floppy_initialize();
+		floppy_initialize(p_driver_no);
 	}
 	else
 	{
 		// Initialize hard disk controller
 	}
+
+	// Drives work without the cache, so failing to set it up isn't fatal
+	block_cache_initialize(HAL_CACHE_DEFAULT_BLOCKS);
 }
 
 uint64_t hal_get_ticks()
@@ -47,24 +66,110 @@ uint8_t hal_get_drive_count()
 	return floppy_get_drive_count();
 }
 
-void *hal_read_bytes(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size)
+/**
+ * @brief Reads from a drive without going through the block cache. Drives may still keep what they read around
+ * themselves, unless `p_cache` is cleared.
+ */
+static void *hal_drive_read(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size, bool p_cache)
 {
 	if (p_drive < 0x80)
 	{
-		return floppy_read(p_drive, p_lba, p_to, p_size);
+		return floppy_read(p_drive, p_lba, p_to, p_size, p_cache);
 	}
 
 	return NULL; // HDD reading
 }
 
+void *hal_read_bytes(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size)
+{
+	if (block_cache_read(p_drive, p_lba, p_to, p_size))
+	{
+		return p_to;
+	}
+
+	if (!hal_drive_read(p_drive, p_lba, p_to, p_size, true))
+	{
+		return NULL;
+	}
+
+	block_cache_fill(p_drive, p_lba, p_to, p_size);
+	return p_to;
+}
+
+void *hal_read_bytes_uncached(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size)
+{
+	return hal_drive_read(p_drive, p_lba, p_to, p_size, false);
+}
+
 bool hal_write_bytes(uint8_t p_drive, uint16_t p_lba, void *p_from, size_t p_size)
 {
+	bool written = false;
 	if (p_drive < 0x80)
 	{
-		return floppy_write(p_drive, p_lba, p_from, p_size);
+		written = floppy_write(p_drive, p_lba, p_from, p_size);
 	}
 
-	return false; // HDD writing
+	// Cached copies of the sectors are brought up to date, or dropped if the write failed part of the way through
+	block_cache_update(p_drive, p_lba, written ? p_from : NULL, p_size);
+	return written;
+}
+
+bool hal_submit_request(struct BlockRequest *p_request)
+{
+	if (p_request->drive >= 0x80)
+	{
+		return false; // HDD requests
+	}
+
+	if (!floppy_submit(p_request))
+	{
+		return false;
+	}
+
+	if (p_request->write)
+	{
+		block_cache_update(p_request->drive, p_request->lba, NULL, p_request->size);
+	}
+
+	return true;
+}
+
+bool hal_get_queue_statistics(uint8_t p_drive, struct BlockQueueStatistics *out_stats)
+{
+	if (p_drive < 0x80)
+	{
+		return floppy_get_queue_statistics(p_drive, out_stats);
+	}
+
+	return false; // HDD queues
+}
+
+const void *hal_pin_block(uint8_t p_drive, uint16_t p_lba)
+{
+	bool fresh	= false;
+	void *block = block_cache_pin(p_drive, p_lba, &fresh);
+	if (block && fresh && !hal_drive_read(p_drive, p_lba, block, SECTOR_SIZE, true))
+	{
+		block_cache_discard(block);
+		return NULL;
+	}
+
+	return block;
+}
+
+void hal_unpin_block(const void *p_block)
+{
+	block_cache_unpin(p_block);
+}
+
+bool hal_set_cache_capacity(uint32_t p_blocks)
+{
+	return block_cache_initialize(p_blocks);
+}
+
+bool hal_get_cache_statistics(struct BlockCacheStatistics *out_stats)
+{
+	return block_cache_get_statistics(out_stats);
 }
 
 bool timer_get_time(timer_t *p_timer)
@@ -85,6 +190,11 @@ bool timer_get_time(timer_t *p_timer)
 	return true;
 }
 
+bool timer_add_callback(void (*p_callback)())
+{
+	return pit_add_callback(p_callback);
+}
+
 void timer_sleep(uint64_t p_ms)
 {
 	uint64_t ticks_start  = pit_get_ticks();
@@ -15,9 +15,13 @@
 // Highest possible timer frequency (1193182Hz)
 #define PIT_MAX_FREQUENCY PIT_BASE_FREQUENCY / PIT_BASE_FREQUENCY
 
+// Number of functions that can be called on every tick
+#define PIT_CALLBACK_COUNT 4
+
 static uint64_t tick_count;
 static uint32_t frequency;
 static bool initialized = false;
+static void (*callbacks[PIT_CALLBACK_COUNT])();
 
 bool pit_irq_handler(struct Registers *p_regs)
 {
@@ -26,6 +30,11 @@ bool pit_irq_handler(struct Registers *p_regs)
 		tick_count++;
 	}
 
+	for (int i = 0; i < PIT_CALLBACK_COUNT && callbacks[i]; i++)
+	{
+		callbacks[i]();
+	}
+
 	send_end_of_interrupt(p_regs->interrupt);
 	return true;
 }
@@ -60,3 +69,17 @@ uint32_t pit_get_frequency()
 {
 	return frequency;
 }
+
+bool pit_add_callback(void (*p_callback)())
+{
+	for (int i = 0; i < PIT_CALLBACK_COUNT; i++)
+	{
+		if (!callbacks[i])
+		{
+			callbacks[i] = p_callback;
+			return true;
+		}
+	}
+
+	return false;
+}
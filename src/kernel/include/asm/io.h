@@ -41,6 +41,35 @@ static inline void wrmsr(uint32_t p_msr, uint64_t p_value)
 	__asm__ volatile("wrmsr" : : "c"(p_msr), "A"(p_value));
 }
 
+// Bit of EFLAGS that is set while interrupts are enabled
+#define EFLAGS_INTERRUPT_ENABLE 0x200
+
+static inline uint32_t interrupts_save()
+{
+	uint32_t flags;
+	__asm__ volatile("pushf\n\tpop %0" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+static inline uint32_t interrupts_enable_save()
+{
+	uint32_t flags;
+	__asm__ volatile("pushf\n\tpop %0\n\tsti" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+static inline uint32_t interrupts_disable_save()
+{
+	uint32_t flags;
+	__asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+static inline void interrupts_restore(uint32_t p_flags)
+{
+	__asm__ volatile("push %0\n\tpopf" : : "r"(p_flags) : "memory", "cc");
+}
+
 static inline void panic()
 {
 	__asm__ volatile("cli");
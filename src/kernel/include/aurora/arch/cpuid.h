@@ -30,7 +30,7 @@ enum CPU_Features
 	CPU_FEATURE_PSE_36				 = 1 << 17,
 	CPU_FEATURE_PROCESSOR_SERIAL_NO	 = 1 << 18,
 	CPU_FEATURE_CLFLUSH				 = 1 << 19,
-	CPU_FEATURE_NO_EXECUTE			 = 1 << 20,
+	CPU_FEATURE_NO_EXECUTE			 = 1 << 20, // Only reported in the EDX of the extended leaf
 	CPU_FEATURE_DEBUG_STORE			 = 1 << 21,
 	CPU_FEATURE_ACPI				 = 1 << 22,
 	CPU_FEATURE_MMX					 = 1 << 23,
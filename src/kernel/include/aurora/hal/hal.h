@@ -3,6 +3,59 @@
 
 #include <aurora/kdefs.h>
 
+// How far a block request has got
+enum BlockStatus
+{
+	BLOCK_STATUS_PENDING = 0, // Waiting in the queue or being carried out
+	BLOCK_STATUS_DONE	 = 1, // Finished, and every byte was transferred
+	BLOCK_STATUS_FAILED	 = 2, // Gave up after an error or running out of retries
+};
+
+// A transfer to or from a drive, carried out in the background once submitted with `hal_submit_request()`
+struct BlockRequest
+{
+	uint8_t drive;				 // The drive to transfer to or from
+	bool write;					 // Whether to write to the disk, rather than read from it
+	uint16_t lba;				 // The sector the transfer starts at
+	void *buffer;				 // Physical address of the buffer, which DMA must be able to reach
+	uint16_t size;				 // The number of bytes to transfer
+	volatile uint8_t status;	 // `BlockStatus` of the request, set by the driver
+	uint8_t attempts;			 // Number of times the transfer has been tried, set by the driver
+	// Called from an interrupt handler once the request has finished, if set
+	void (*on_complete)(struct BlockRequest *p_request);
+	uint32_t submitted;			 // Time in milliseconds the request was queued at, set by the queue
+	struct BlockRequest *next;	 // Next request in the queue, set by the queue
+	struct BlockRequest *merged; // Requests for the sectors that follow, carried out as part of this one
+};
+
+/**
+ * @brief Counters kept by the request queue of a drive. Merged requests count as requests of their own.
+ */
+struct BlockQueueStatistics
+{
+	uint32_t depth;			   // Number of requests queued or being carried out
+	uint32_t max_depth;		   // Highest `depth` has been
+	uint32_t submitted;		   // Number of requests queued so far
+	uint32_t merged;		   // Number of requests carried out as part of the one before them
+	uint32_t completed;		   // Number of requests that finished without errors
+	uint32_t failed;		   // Number of requests that failed
+	uint32_t total_latency_ms; // Time from being queued to finishing, summed over every finished request
+	uint32_t max_latency_ms;   // Longest time a request has taken from being queued to finishing
+};
+
+/**
+ * @brief Counters kept by the block cache that sits between filesystems and the drives. Every count is in sectors.
+ */
+struct BlockCacheStatistics
+{
+	uint32_t capacity;	// Number of sectors the cache can hold
+	uint32_t used;		// Number of sectors currently cached
+	uint32_t pinned;	// Number of cached sectors that are pinned
+	uint32_t hits;		// Sectors that were served from memory
+	uint32_t misses;	// Sectors that had to be read from a drive
+	uint32_t evictions; // Sectors dropped to make room for others
+};
+
 /**
  * @brief Initializes the Hardware Abstraction Layer, the part of the kernel that separates the hardware functions from
  * the software implementation. Differs from the CPU architecture in that the hardware available to one PC will be
@@ -19,25 +72,87 @@ uint8_t hal_get_drive_count();
 
 /**
  * @brief Reads N bytes from a drive into a buffer. Implementation depends on the drive in question, which are handled
- * differently according to their needs.
+ * differently according to their needs. Sectors are kept in the block cache once read, and requests that the cache
+ * holds in full never reach the drive.
  * @param p_drive The drive to read from
  * @param p_lba The LBA to begin reading from
- * @param p_to The output buffer to read information into
+ * @param p_to The virtual address of the output buffer, which doesn't need to be physically contiguous
  * @param p_size The number of bytes to read
  * @return The pointer passed in by the user now filled with information, or `NULL` if something failed.
  */
 void *hal_read_bytes(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size);
 
+/**
+ * @brief Reads N bytes from a drive into a buffer straight from the disk. Nothing is taken from or kept in the block
+ * cache or the drive's own buffers, so data that is only read once doesn't push out sectors that are used again.
+ * Writes through `hal_write_bytes()` never add sectors to the cache, so they can be used alongside it.
+ * @param p_drive The drive to read from
+ * @param p_lba The LBA to begin reading from
+ * @param p_to The virtual address of the output buffer, which doesn't need to be physically contiguous
+ * @param p_size The number of bytes to read
+ * @return The pointer passed in by the user now filled with information, or `NULL` if something failed.
+ */
+void *hal_read_bytes_uncached(uint8_t p_drive, uint16_t p_lba, void *p_to, size_t p_size);
+
 /**
  * @brief Writes N bytes from an input buffer onto a drive starting at a given LBA. Implementation depends on the drive
  * in question, however most use-cases of this should follow a similar pattern.
  * @param p_drive The drive to read from
  * @param p_lba The LBA to begin reading from. LBAs refer to whole sectors and read/writes cannot begin from an offset
  * into a sector.
- * @param p_from The buffer to write data from
+ * @param p_from The virtual address of the buffer to write data from, which doesn't need to be physically contiguous
  * @param p_size The number of bytes contained in the buffer
  * @return `true` on success, `false` if an error occured.
  */
 bool hal_write_bytes(uint8_t p_drive, uint16_t p_lba, void *p_from, size_t p_size);
 
+/**
+ * @brief Queues a transfer and returns straight away. Pending requests are carried out in order of cylinder, sweeping
+ * across the disk in one direction, and a request that carries on from a queued one is merged into it. Requests for
+ * the same sectors are always carried out in the order they were submitted. The block cache is bypassed, although
+ * cached copies of sectors that are written to are dropped.
+ * @param p_request The request to queue. It must stay valid until its status changes.
+ * @return `true` if the request was queued, and `false` if the drive isn't ready or doesn't exist.
+ */
+bool hal_submit_request(struct BlockRequest *p_request);
+
+/**
+ * @brief Gets the depth and latency counters of a drive's request queue.
+ * @param p_drive The drive to get the counters of
+ * @param out_stats The structure to copy the counters into.
+ * @return `true` if the counters were written, and `false` if the drive doesn't exist.
+ */
+bool hal_get_queue_statistics(uint8_t p_drive, struct BlockQueueStatistics *out_stats);
+
+/**
+ * @brief Gets a sector through the block cache, reading it from the drive if it isn't cached, and pins it so that it
+ * stays in memory until it is unpinned. Writes to the sector through `hal_write_bytes()` show up in the pinned copy.
+ * @param p_drive The drive the sector is on
+ * @param p_lba The sector to get
+ * @return The contents of the sector, or `NULL` if it couldn't be read or every cached sector is pinned.
+ */
+const void *hal_pin_block(uint8_t p_drive, uint16_t p_lba);
+
+/**
+ * @brief Gives back a sector pinned by `hal_pin_block()`, after which the cache is free to evict it. Each pin needs
+ * its own unpin.
+ * @param p_block The pointer returned by `hal_pin_block()`
+ */
+void hal_unpin_block(const void *p_block);
+
+/**
+ * @brief Changes how many sectors the block cache holds. Everything that was cached is dropped, so it is best done
+ * early on.
+ * @param p_blocks The number of sectors to hold
+ * @return `true` if the cache was resized, and `false` if the size is invalid, a sector is pinned, or memory ran out.
+ */
+bool hal_set_cache_capacity(uint32_t p_blocks);
+
+/**
+ * @brief Gets the hit and miss counters of the block cache, along with how full it is.
+ * @param out_stats The structure to copy the counters into.
+ * @return `true` if the counters were written, and `false` if not.
+ */
+bool hal_get_cache_statistics(struct BlockCacheStatistics *out_stats);
+
 #endif // _AURORA_HAL_H
\ No newline at end of file
@@ -5,8 +5,15 @@
 #define KERNEL_VIRTUAL_ADDRESS		   0xc0100000 // Desired virtual address of the kernel data
 #define PAGE_TABLE_VIRTUAL_ADDRESS	   0xc0000000 // Virtual address of our page tables
 #define PAGE_TABLE_MEMORY_SIZE		   0x00100000 // Size of the page table in bytes
+#define PAGE_TABLE_PHYSICAL_ADDRESS	   0x00010000 // Physical address of our page tables
+#define RECURSIVE_MAP_VIRTUAL_ADDRESS  0xffc00000 // Virtual address that every page table can be reached through
+#define PAE_RECURSIVE_VIRTUAL_ADDRESS  0xff800000 // The same, once PAE paging is enabled
 #define USER_ALLOC_VIRTUAL_ADDRESS	   0x40000000 // Start of the virtual address range
 #define USER_ALLOC_END_VIRTUAL_ADDRESS 0xa0000000 // End of the virtual address range
+#define DIRECT_MAP_VIRTUAL_ADDRESS	   0xe0000000 // Virtual address that physical memory is linearly mapped to
+#define DIRECT_MAP_MAX_SIZE			   0x10000000 // Most physical memory the direct map covers
+
+#define HIGH_MEMORY_PHYSICAL_ADDRESS 0x100000000ULL // First physical address that only PAE paging can reach
 
 #define KIBIBYTES_TO_BYTES 0x400				  // Conversion of KiB to bytes
 #define MIBIBYTES_TO_BYTES 0x100000				  // Conversion of MiB to bytes
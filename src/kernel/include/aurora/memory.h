@@ -5,6 +5,35 @@
 
 #include <boot/bootstructs.h>
 
+// Number of size classes served by the slab allocator, running from 16 bytes up to 2 KiB in powers of 2.
+#define KALLOC_SLAB_CLASS_COUNT 8
+
+/**
+ * @brief Usage counters for one of the slab allocator's size classes.
+ */
+struct SlabStatistics
+{
+	uint32_t object_size; // Size in bytes of every object in the class
+	uint32_t allocations; // Number of allocations served by the class
+	uint32_t frees;		  // Number of objects returned to the class
+	uint32_t hits;		  // Allocations served from a page that already had a free object
+	uint32_t misses;	  // Allocations that needed a new page to be given to the class
+	uint32_t pages;		  // Number of pages currently owned by the class
+};
+
+/**
+ * @brief Free space across the heaps that serve allocations larger than a slab object. The untouched end of each heap
+ * counts as a free block.
+ */
+struct HeapStatistics
+{
+	uint32_t heap_count;   // Number of heaps serving large allocations
+	uint32_t free_blocks;  // Number of separate free blocks
+	uint32_t total_free;   // Number of bytes free across all blocks
+	uint32_t largest_free; // Size in bytes of the largest free block
+	uint8_t fragmentation; // Percentage of free memory outside the largest free block (0 is unfragmented)
+};
+
 /**
  * @brief Initializes the memory subsystem, including allocators, pre-defined pages, and so on.
  * @param p_map Pointer to the memory map of the PC. This mainly concerns unmapped memory (such as the BIOS or APIC
@@ -27,7 +56,37 @@ bool initialize_memory(struct MemoryMap *p_map, uint32_t p_kernel_size);
 void *kalloc(uint32_t p_size);
 
 /**
- * @brief Modifies the amount of data pointed to by ptr to the new value passed in.
+ * @brief Allocates an array of N elements, with every byte cleared to zero. Pages of the array that have never been
+ * touched are left alone, as they are backed with zeroed frames once they are.
+ * @param p_count The number of elements
+ * @param p_size The size of each element in bytes
+ * @return A pointer to the allocated memory if successful, and `NULL` if not or if the size overflows.
+ */
+void *kcalloc(uint32_t p_count, uint32_t p_size);
+
+/**
+ * @brief Allocates N bytes of memory straight from the page allocator rather than a heap. Every whole 4 MiB of the
+ * region is mapped with a single 4 MiB page when the CPU supports them, which saves page tables and TLB entries. Meant
+ * for buffers of several MiB, as smaller sizes are still rounded up to whole pages. Freed with `kfree()`.
+ * @param p_size The number of bytes to allocate.
+ * @return A pointer to the allocated memory, aligned to 4 MiB, if successful, and `NULL` if not.
+ */
+void *kalloc_large(uint32_t p_size);
+
+/**
+ * @brief Allocates N bytes of memory whose pages can be written out to swap while physical memory is short, and are
+ * read back in when next touched. Reading a page back in waits on the disk, so the memory must never be touched with
+ * interrupts disabled, such as by an interrupt handler. Freed with `kfree()`. Growing it with `krealloc()` moves it to
+ * memory from `kalloc_large()`, which is never swapped out.
+ * @param p_size The number of bytes to allocate, rounded up to whole pages.
+ * @return A pointer to the allocated memory, aligned to 4 KiB, if successful, and `NULL` if not.
+ */
+void *kalloc_swappable(uint32_t p_size);
+
+/**
+ * @brief Modifies the amount of data pointed to by ptr to the new value passed in. Allocations of more than a page
+ * that have to move are remapped to their new address rather than copied, so growing a large buffer costs one page
+ * table update per page.
  * @param ptr The pointer to modify
  * @param p_size The number of bytes to reallocate to
  * @return The pointer to the new object, which may have changed.
@@ -40,6 +99,135 @@ void *krealloc(void *ptr, size_t p_size);
  */
 void kfree(void *p_mem);
 
+/**
+ * @brief Does memory housekeeping that can wait, such as clearing page frames ahead of time. Should be called
+ * whenever the CPU would otherwise be idle.
+ */
+void kalloc_idle();
+
+/**
+ * @brief Sets up a range of sectors on a drive as swap, so that pages from `kalloc_swappable()` can be written out to
+ * it once physical memory runs low. Drives that start with a boot sector are refused, so a disk with a filesystem on
+ * it is never overwritten.
+ * @param p_drive The drive to swap to
+ * @param p_lba The first sector of the swap area
+ * @param p_sector_count The number of sectors in the swap area
+ * @return `true` if swap is now enabled, and `false` if not.
+ */
+bool kalloc_enable_swap(uint8_t p_drive, uint16_t p_lba, uint32_t p_sector_count);
+
+/**
+ * @brief Allocates a physically contiguous buffer that ISA DMA can reach, for drivers that hand memory straight to the
+ * DMA controller. The buffer lies below 16 MiB and doesn't cross a 64 KiB boundary. Its virtual address can be found
+ * with `physical_to_virtual()`.
+ * @param p_size The size of the buffer in bytes, at most 64 KiB.
+ * @return The physical address of the buffer, or 0 if there is no free memory low enough.
+ */
+uint32_t kalloc_dma(uint32_t p_size);
+
+/**
+ * @brief Frees a buffer from `kalloc_dma()`.
+ * @param p_address The physical address of the buffer
+ * @param p_size The size the buffer was allocated with
+ */
+void kfree_dma(uint32_t p_address, uint32_t p_size);
+
+struct KmemCache;
+
+/**
+ * @brief Creates a cache of fixed-size objects, for structures that are allocated and freed often. Objects come from
+ * slab pages owned by the cache, so allocating and freeing are constant time and objects never move once allocated.
+ * @param p_name The name of the cache, shown in statistics. Must outlive the cache.
+ * @param p_object_size The size of each object in bytes, up to 2 KiB.
+ * @param p_constructor Function to call on each object as it is handed out, so that objects never carry state over
+ * from their previous use. May be `NULL`.
+ * @return The new cache, or `NULL` if it could not be created.
+ */
+struct KmemCache *kmem_cache_create(const char *p_name, uint32_t p_object_size, void (*p_constructor)(void *));
+
+/**
+ * @brief Allocates an object from a cache.
+ * @param p_cache The cache to allocate from
+ * @return A pointer to the object if successful, and `NULL` if not.
+ */
+void *kmem_cache_alloc(struct KmemCache *p_cache);
+
+/**
+ * @brief Returns an object to the cache it was allocated from. Objects can also be returned with `kfree()`, but this
+ * checks that the object really belongs to the cache.
+ * @param p_cache The cache the object was allocated from
+ * @param p_object The object to free.
+ */
+void kmem_cache_free(struct KmemCache *p_cache, void *p_object);
+
+// Usable size of each chunk of an arena, if none is given to `arena_create()`.
+#define ARENA_DEFAULT_CHUNK_SIZE 0x1000
+
+struct Arena;
+
+/**
+ * @brief Creates an arena for short-lived allocations that are all freed at the same time. Allocating is a pointer
+ * bump, and everything in the arena is freed at once by `arena_reset()` or `arena_destroy()`.
+ * @param p_chunk_size The size of each block of memory the arena takes from `kalloc()`, or 0 to use
+ * `ARENA_DEFAULT_CHUNK_SIZE`. Allocations larger than this get a chunk of their own.
+ * @return The new arena, or `NULL` if it could not be allocated.
+ */
+struct Arena *arena_create(uint32_t p_chunk_size);
+
+/**
+ * @brief Allocates N bytes from an arena, aligned to 8 bytes. The memory can't be freed on its own.
+ * @param p_arena The arena to allocate from
+ * @param p_size The number of bytes to allocate
+ * @return A pointer to the allocated memory if successful, and `NULL` if not.
+ */
+void *arena_alloc(struct Arena *p_arena, uint32_t p_size);
+
+/**
+ * @brief Allocates N bytes from an arena with the given alignment. Buffers that are handed to DMA should be aligned to
+ * their own size, so that they don't cross a page boundary.
+ * @param p_arena The arena to allocate from
+ * @param p_size The number of bytes to allocate
+ * @param p_alignment The alignment of the memory, as a power of 2.
+ * @return A pointer to the allocated memory if successful, and `NULL` if not.
+ */
+void *arena_alloc_aligned(struct Arena *p_arena, uint32_t p_size, uint32_t p_alignment);
+
+/**
+ * @brief Frees everything allocated from an arena in one go. The arena keeps its memory, so it can be refilled without
+ * going back to `kalloc()`.
+ * @param p_arena The arena to reset.
+ */
+void arena_reset(struct Arena *p_arena);
+
+/**
+ * @brief Frees an arena along with all of its memory.
+ * @param p_arena The arena to destroy.
+ */
+void arena_destroy(struct Arena *p_arena);
+
+/**
+ * @brief Obtains the usage counters for one of the slab allocator's size classes, which can be used to work out the
+ * hit rate of the class (`hits / allocations`).
+ * @param p_class The size class to query, between 0 (16 bytes) and `KALLOC_SLAB_CLASS_COUNT - 1` (2 KiB).
+ * @param out_stats The structure to copy the counters into.
+ * @return `true` if the class exists, and `false` if not.
+ */
+bool kalloc_get_slab_statistics(uint8_t p_class, struct SlabStatistics *out_stats);
+
+/**
+ * @brief Works out how much free memory the large-allocation heaps have, and how fragmented it is. Fragmentation is
+ * measured as how much of the free memory lies outside of the largest free block.
+ * @param out_stats The structure to write the results to.
+ * @return `true` if the statistics were written, and `false` if not.
+ */
+bool kalloc_get_heap_statistics(struct HeapStatistics *out_stats);
+
+/**
+ * @brief Logs the usage counters and hit rate of every slab size class and named cache, and the fragmentation of the
+ * heaps, to the console.
+ */
+void kalloc_print_statistics();
+
 /**
  * @brief Maps a range of memory, usually that of memory-mapped peripherals, to a given virtual address. Preferred over
  * calling `paging_map_region()` as it checks in advance if the range is already being used by something else.
@@ -54,7 +242,7 @@ bool kmap_range(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size);
  * @brief Converts a mapped virtual address to a physical one.
  * @param p_address The address to convert
  * @return The physical address, or 0 if the address couldn't be found. Since the BIOS is identity-mapped, please don't
- * use it for that.
+ * use it for that. Memory above 4 GiB, which only PAE paging can map, also gives 0.
  */
 uint32_t virtual_to_physical(uint32_t p_address);
 
@@ -66,7 +254,8 @@ uint32_t virtual_to_physical(uint32_t p_address);
 uint32_t physical_to_virtual(uint32_t p_address);
 
 /**
- * @brief Converts a mapped virtual address to a physical one, using `void *` instead of `uint32_t`.
+ * @brief Converts a mapped virtual address to a physical one, using `void *` instead of `uint32_t`. A page that is
+ * reserved but hasn't been touched yet is backed first, so that the address can be handed to a device.
  * @param p_address The address to convert.
  * @return The physical address, or 0 if the address couldn't be found.
  */
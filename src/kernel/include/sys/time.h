@@ -14,4 +14,12 @@ bool timer_get_time(timer_t *p_timer);
 
 void timer_sleep(uint64_t p_ms);
 
+/**
+ * @brief Registers a function to be called from the timer interrupt on every tick. It runs with interrupts disabled,
+ * so it must be short. Only a few functions can be registered.
+ * @param p_callback The function to call
+ * @return `true` if the function was registered, and `false` if there is no room left for it.
+ */
+bool timer_add_callback(void (*p_callback)());
+
 #endif // _KERNEL_TIMER_H
\ No newline at end of file
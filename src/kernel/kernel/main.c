@@ -60,6 +60,12 @@ void __attribute__((cdecl)) cstart(struct BootInfo *boot)
 	hal_initialize(boot->boot_device);
 	LOG_INFO("CPU features: %s", cpuid_get_features());
 
+	// A blank disk in the second floppy drive is used as swap, such as an empty image given to QEMU with `-fdb`
+	if (hal_get_drive_count() > 1)
+	{
+		kalloc_enable_swap(1, 0, 2880);
+	}
+
 	// Init VFS so we can load some font resources
 	if (!vfs_initialize())
 	{
@@ -85,5 +91,6 @@ end:
 	LOG_DEBUG("Here's a fancy message\n\t\tthat appears on the screen!");
 	for (;;)
 	{
+		kalloc_idle();
 	}
 }
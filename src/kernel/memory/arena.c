@@ -0,0 +1,156 @@
+#include <aurora/memory.h>
+
+#define AUR_MODULE "arena"
+#include <aurora/debug.h>
+
+#include <string.h>
+
+// Alignment used by `arena_alloc()`, enough for any type the kernel uses.
+#define ARENA_DEFAULT_ALIGNMENT 8
+
+// A single block of memory that the arena bumps through. Chunks are kept when the arena is reset, so a reused arena
+// settles on the memory it needs and stops calling `kalloc()` altogether.
+struct ArenaChunk
+{
+	struct ArenaChunk *next; // Next chunk in the arena
+	uint32_t size;			 // Number of usable bytes after the chunk header
+	uint32_t used;			 // Number of bytes handed out from the chunk
+};
+
+struct Arena
+{
+	struct ArenaChunk *first;	// First chunk of the arena
+	struct ArenaChunk *current; // Chunk that allocations are currently bumped from
+	uint32_t chunk_size;		// Usable size of each new chunk, unless an allocation needs a larger one
+};
+
+/**
+ * @brief Gets a pointer to the start of the usable memory in a chunk.
+ * @param p_chunk The chunk to look at
+ * @return The first usable byte of the chunk.
+ */
+static inline uint8_t *_a_chunk_data(struct ArenaChunk *p_chunk)
+{
+	return (uint8_t *)p_chunk + sizeof(struct ArenaChunk);
+}
+
+/**
+ * @brief Tries to bump an allocation out of a chunk.
+ * @param p_chunk The chunk to allocate from
+ * @param p_size The number of bytes to allocate
+ * @param p_alignment The alignment of the allocation, as a power of 2.
+ * @return The allocated memory, or `NULL` if the chunk doesn't have enough space left.
+ */
+static void *_a_chunk_alloc(struct ArenaChunk *p_chunk, uint32_t p_size, uint32_t p_alignment)
+{
+	uint32_t start	= (uint32_t)_a_chunk_data(p_chunk);
+	uint32_t offset = ((start + p_chunk->used + p_alignment - 1) & ~(p_alignment - 1)) - start;
+	if (offset > p_chunk->size || p_size > p_chunk->size - offset)
+	{
+		return NULL;
+	}
+
+	p_chunk->used = offset + p_size;
+	return (void *)(start + offset);
+}
+
+struct Arena *arena_create(uint32_t p_chunk_size)
+{
+	struct Arena *arena = kalloc(sizeof(struct Arena));
+	if (!arena)
+	{
+		return NULL;
+	}
+
+	arena->first	  = NULL;
+	arena->current	  = NULL;
+	arena->chunk_size = p_chunk_size ? p_chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+	return arena;
+}
+
+void *arena_alloc_aligned(struct Arena *p_arena, uint32_t p_size, uint32_t p_alignment)
+{
+	if (!p_arena || !p_size || !p_alignment || (p_alignment & (p_alignment - 1)))
+	{
+		return NULL;
+	}
+
+	// Move through the chunks kept from before the last reset before making any new ones
+	struct ArenaChunk *chunk = p_arena->current;
+	while (chunk)
+	{
+		void *ret = _a_chunk_alloc(chunk, p_size, p_alignment);
+		if (ret)
+		{
+			p_arena->current = chunk;
+			return ret;
+		}
+
+		chunk = chunk->next;
+		if (chunk)
+		{
+			chunk->used = 0;
+		}
+	}
+
+	uint32_t size = AMAX(p_arena->chunk_size, p_size + p_alignment);
+	chunk		  = kalloc(sizeof(struct ArenaChunk) + size);
+	if (!chunk)
+	{
+		LOG_ERROR("Failed to allocate a %u-byte arena chunk.", size);
+		return NULL;
+	}
+
+	chunk->size = size;
+	chunk->used = 0;
+
+	// New chunks go after the current one, ahead of any unused chunks
+	if (p_arena->current)
+	{
+		chunk->next			   = p_arena->current->next;
+		p_arena->current->next = chunk;
+	}
+	else
+	{
+		chunk->next	   = p_arena->first;
+		p_arena->first = chunk;
+	}
+
+	p_arena->current = chunk;
+	return _a_chunk_alloc(chunk, p_size, p_alignment);
+}
+
+void *arena_alloc(struct Arena *p_arena, uint32_t p_size)
+{
+	return arena_alloc_aligned(p_arena, p_size, ARENA_DEFAULT_ALIGNMENT);
+}
+
+void arena_reset(struct Arena *p_arena)
+{
+	if (!p_arena || !p_arena->first)
+	{
+		return;
+	}
+
+	// Later chunks are cleared as the arena reaches them again
+	p_arena->current	   = p_arena->first;
+	p_arena->current->used = 0;
+}
+
+void arena_destroy(struct Arena *p_arena)
+{
+	if (!p_arena)
+	{
+		return;
+	}
+
+	struct ArenaChunk *chunk = p_arena->first;
+	while (chunk)
+	{
+		struct ArenaChunk *next = chunk->next;
+		kfree(chunk);
+		chunk = next;
+	}
+
+	kfree(p_arena);
+}
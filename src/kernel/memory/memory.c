@@ -1,4 +1,6 @@
 #include "paging.h"
+#include "physical.h"
+#include "swap.h"
 
 #include <aurora/memdefs.h>
 #include <aurora/memory.h>
@@ -16,6 +18,22 @@
 #define ALIGN(m_addr, m_bytes) ((m_addr + (m_bytes - 1)) & ~(m_bytes - 1))
 #define ALIGN32(m_addr)		   ALIGN(m_addr, 0x20)
 
+#define PAGE_SIZE 0x1000
+
+// Empty heaps are kept around for reuse until they add up to more than HEAP_RECLAIM_HIGH bytes, at which point they
+// are given back until no more than HEAP_RECLAIM_LOW bytes are left. The gap keeps a workload that keeps emptying and
+// refilling a heap from mapping and unmapping it every time.
+#define HEAP_RECLAIM_HIGH (8 * MIBIBYTES_TO_BYTES)
+#define HEAP_RECLAIM_LOW  (4 * MIBIBYTES_TO_BYTES)
+
+// Smallest slab object is 1 << SLAB_MIN_SHIFT bytes, and each class after it doubles in size.
+#define SLAB_MIN_SHIFT 4
+#define SLAB_MAX_SIZE  (1 << (SLAB_MIN_SHIFT + KALLOC_SLAB_CLASS_COUNT - 1))
+
+// Kept in the second word of every free slab object, mixed with the object's address so that a copy of it elsewhere
+// doesn't match. Objects are at least 8 bytes, so there is always room for it.
+#define SLAB_FREE_POISON 0x5eb1f4ee
+
 enum MemoryFlags
 {
 	BIT_AVAILABLE = 1 << 0,
@@ -24,6 +42,7 @@ enum MemoryFlags
 	BIT_USERSPACE = 0 << 1,
 	BIT_HEADERS	  = 1 << 2,
 	BIT_FREE_MEM  = 0 << 2,
+	BIT_SLAB	  = 1 << 3,
 };
 
 struct MemoryHeader
@@ -56,6 +75,45 @@ struct MemoryConfig
 	uint32_t next_free_physical_address;
 };
 
+// Descriptor for a single page of a slab heap. Descriptors are kept in an array at the start of their heap rather
+// than in the page itself, so that objects can use all 4 KiB of the page.
+struct SlabPage
+{
+	struct SlabPage *next;	 // Next page in the list the page is on (partial pages of a cache, or free pages)
+	struct SlabPage *prev;	 // Previous page in the list the page is on
+	struct KmemCache *cache; // The cache that owns the page, or NULL if the page is not in use
+	void *free_list;		 // First free object in the page. Each free object stores the address of the next.
+	uint32_t virt_address;	 // Virtual address of the page
+	uint16_t in_use;		 // Number of objects handed out from the page
+	uint16_t capacity;		 // Number of objects the page can hold
+};
+
+// A cache of same-sized objects. Each size class of `kalloc()` is a cache, as is everything made with
+// `kmem_cache_create()`.
+struct KmemCache
+{
+	struct SlabPage *partial;	 // Pages of the cache with at least one free object
+	struct SlabStatistics stats; // Usage counters for the cache
+	const char *name;			 // Name of the cache, or NULL for the size classes of `kalloc()`
+	void (*constructor)(void *); // Called on every object as it is handed out, if set
+	struct KmemCache *next;		 // Next named cache
+};
+
+// Each entry of the page index holds the address of the structure that owns a page, with the type of owner kept in
+// the low bits (owners are always aligned to at least 4 bytes).
+enum PageIndexType
+{
+	PAGE_INDEX_NONE	 = 0, // Page isn't owned by the allocator
+	PAGE_INDEX_SLAB	 = 1, // Page belongs to a slab heap, and the entry points to its `SlabPage`
+	PAGE_INDEX_BLOCK = 2, // Page is the first or last page of a heap block, and the entry points to its `MemoryHeader`
+	PAGE_INDEX_LARGE = 3, // First page of a `kalloc_large()` or `kalloc_swappable()` region, holding its page count
+};
+
+#define PAGE_INDEX_TYPE_MASK 0x3
+
+// Large regions have no header, so their size in pages is kept in the index entry above the type bits
+#define PAGE_INDEX_LARGE_SHIFT 2
+
 STATIC_ASSERT(sizeof(struct HeapHeader) % 16 == 0, "HeapHeader must be aligned to a 16-byte boundary.");
 STATIC_ASSERT(sizeof(struct MemoryHeader) == 16, "MemoryHeader must be 16 bytes in size.");
 
@@ -64,13 +122,62 @@ STATIC_ASSERT(sizeof(struct MemoryHeader) == 16, "MemoryHeader must be 16 bytes
 static struct HeapHeader *heap_root = NULL;
 static struct MemoryConfig memcfg	= {0};
 
+// Headers of heaps that have been given back, which are reused before reserving new ones from the root heap
+static struct HeapHeader *a_spare_heaps = NULL;
+
+static void *_a_heap_reserve_memory(size_t p_size);
 static struct HeapHeader *_a_heap_alloc(size_t p_mibibyte_count, size_t p_address);
-static struct MemoryHeader *_a_header_alloc(size_t p_size);
+static bool _a_heap_is_empty(struct HeapHeader *p_heap);
+static void _a_heap_release(struct HeapHeader *p_heap);
+static void _a_heap_reclaim();
+static struct MemoryHeader *_a_header_alloc(struct HeapHeader *p_heap, size_t p_size);
+static void _a_header_release(struct MemoryHeader *p_header);
+static bool _a_block_tag(struct MemoryHeader *p_header);
+static void _a_block_untag_end(struct MemoryHeader *p_header);
+static struct MemoryHeader *_a_block_before(struct HeapHeader *p_heap, struct MemoryHeader *p_header);
+static bool _a_block_split(struct MemoryHeader *p_header, uint32_t p_size);
+static void _a_block_release(struct HeapHeader *p_heap, struct MemoryHeader *p_header);
+static bool _a_block_grow(struct HeapHeader *p_heap, struct MemoryHeader *p_header, uint32_t p_size);
+
+/* PAGE INDEX */
+
+// Two-level index keyed by virtual page number, so that any pointer can be traced back to its allocation without
+// walking a list. Each top-level entry covers 4 MiB, and leaves are reserved from the header heap on first use.
+// Heap blocks are tagged at both ends, so the block before any other can be found from the page just below it.
+static uint32_t *a_page_index[1024];
+
+static bool _a_index_set(uint32_t p_address, uint32_t p_entry);
+static uint32_t _a_index_get(uint32_t p_address);
+static struct MemoryHeader *_a_block_lookup(void *p_mem);
+
+/* SLAB FUNCTIONS */
+
+static struct KmemCache a_slab_caches[KALLOC_SLAB_CLASS_COUNT];
+static struct SlabPage *a_slab_free_pages = NULL;
+
+// Caches used by the allocator itself. Neither depends on `kalloc()`, so they are ready before any heap exists.
+static struct KmemCache a_cache_cache;	// Holds every cache made with `kmem_cache_create()`
+static struct KmemCache a_header_cache; // Holds the `MemoryHeader` of every large block
+static struct KmemCache *a_kmem_caches = NULL;
+
+static uint8_t _a_slab_class(uint32_t p_size);
+static void _a_cache_init(
+	struct KmemCache *p_cache, const char *p_name, uint32_t p_size, void (*p_constructor)(void *));
+static bool _a_slab_is_free(struct SlabPage *p_page, void *p_mem);
+static void _a_slab_free(struct SlabPage *p_page, void *p_mem);
 
 /* MEMORY MANAGEMENT */
 
+// Static array of memory regions
+struct AuMemoryInfo
+{
+	size_t region_count;
+	struct AuMemoryRegion *regions;
+};
+
+static struct AuMemoryInfo *a_mmap_info = NULL;
+
 static void _a_mmap_create(struct MemoryMap *map);
-static bool _a_mmap_is_valid_physical_address(uint32_t p_address);
 
 bool initialize_memory(struct MemoryMap *p_map, uint32_t p_kernel_size)
 {
@@ -83,8 +190,19 @@ bool initialize_memory(struct MemoryMap *p_map, uint32_t p_kernel_size)
 	memcfg.physical_mem_start		  = KERNEL_PHYSICAL_ADDRESS + p_kernel_size;
 	memcfg.next_free_physical_address = memcfg.physical_mem_start;
 
+	// PAE paging is only needed to reach memory above 4 GiB
+	bool high_memory = false;
+	for (int i = 0; i < p_map->region_count; i++)
+	{
+		struct MemoryRegion *mr = &p_map->regions[i];
+		if (mr->type == MEMORY_REGION_USABLE && mr->base_address + mr->length > HIGH_MEMORY_PHYSICAL_ADDRESS)
+		{
+			high_memory = true;
+		}
+	}
+
 	// Setup paging first
-	paging_initialize(&memcfg.physical_mem_start);
+	paging_initialize(&memcfg.physical_mem_start, high_memory);
 
 	// Allocate root heap (1 MiB, for heaps themselves)
 	struct HeapHeader *heap = _a_heap_alloc(0x01, 0x00);
@@ -94,11 +212,39 @@ bool initialize_memory(struct MemoryMap *p_map, uint32_t p_kernel_size)
 		return false;
 	}
 
+	for (int i = 0; i < KALLOC_SLAB_CLASS_COUNT; i++)
+	{
+		_a_cache_init(&a_slab_caches[i], NULL, 1 << (SLAB_MIN_SHIFT + i), NULL);
+	}
+
+	_a_cache_init(&a_cache_cache, "KmemCache", sizeof(struct KmemCache), NULL);
+	_a_cache_init(&a_header_cache, "MemoryHeader", sizeof(struct MemoryHeader), NULL);
+
 	// Create a physical memory map for the system.
 	_a_mmap_create(p_map);
 	memcfg.available_memory -= p_kernel_size;
 	memcfg.reserved_memory += p_kernel_size;
 
+	// Everything claimed so far (kernel, memory hole and root heap) stays out of the frame allocator, and all heaps
+	// from here on are built from the frames it hands out.
+	if (!physical_initialize(a_mmap_info->regions, a_mmap_info->region_count, memcfg.next_free_physical_address))
+	{
+		LOG_ERROR("Failed to initialize the physical frame allocator.");
+		return false;
+	}
+
+	// Give usable memory a fixed virtual address, so that physical addresses can be turned back into virtual ones
+	if (!paging_create_direct_map(physical_get_memory_end()))
+	{
+		return false;
+	}
+
+	// Memory above 4 GiB can't go in the direct map, but can still be handed out a frame at a time
+	if (paging_is_pae_enabled() && !physical_initialize_high(a_mmap_info->regions, a_mmap_info->region_count))
+	{
+		LOG_WARNING("Memory above 4 GiB will not be used.");
+	}
+
 	LOG_INFO("Total memory available: %llu bytes (%llu MiB)",
 			 memcfg.available_memory,
 			 memcfg.available_memory / MIBIBYTES_TO_BYTES);
@@ -110,67 +256,181 @@ bool initialize_memory(struct MemoryMap *p_map, uint32_t p_kernel_size)
 
 void *kalloc(uint32_t p_size)
 {
-	struct HeapHeader *heap = heap_root;
-	while (heap)
+	// Small allocations are served by the slab allocator in constant time
+	if (p_size <= SLAB_MAX_SIZE)
 	{
-		if (heap->available_space > p_size && !(heap->flags & BIT_HEADERS))
-			break;
-		heap = heap->next;
+		return kmem_cache_alloc(&a_slab_caches[_a_slab_class(p_size)]);
 	}
 
-	if (!heap)
+	// Larger allocations are whole pages, so that the page index can map them back to their header
+	p_size = ALIGN(p_size, PAGE_SIZE);
+
+	struct HeapHeader *heap		= heap_root;
+	struct MemoryHeader *header = NULL;
+	for (; heap; heap = heap->next)
 	{
-		heap = _a_heap_alloc(0x04, 0x00);
-		if (!heap)
+		if (heap->flags & (BIT_HEADERS | BIT_SLAB))
+			continue;
+
+		// Reuse a freed block before carving more of the heap out
+		for (header = heap->list; header; header = header->next)
 		{
-			LOG_ERROR("Failed to allocate a new heap.");
-			return NULL;
+			if (header->parent_flags & BIT_AVAILABLE && header->size >= p_size)
+				break;
+		}
+
+		if (!header && heap->available_space >= p_size)
+		{
+			header = _a_header_alloc(heap, p_size);
 		}
+
+		if (header)
+			break;
 	}
 
-	struct MemoryHeader *header = heap->list;
-	while (header->next)
+	// Only take what's needed from a reused block, and leave the rest free for later
+	if (header && header->size > p_size)
 	{
-		if (header->parent_flags & BIT_AVAILABLE && header->size >= p_size)
-			break;
-		header = header->next;
+		_a_block_split(header, p_size);
 	}
 
-	if (!header->next)
+	if (!header)
 	{
-		header->next = _a_header_alloc(p_size);
-		if (!header->next)
+		heap = _a_heap_alloc(AMAX(0x04, ALIGN(p_size, MIBIBYTES_TO_BYTES) / MIBIBYTES_TO_BYTES), 0x00);
+		if (!heap)
+		{
+			LOG_ERROR("Failed to allocate a new heap.");
 			return NULL;
+		}
 
-		header = header->next;
+		header = _a_header_alloc(heap, p_size);
+		if (!header)
+			return NULL;
 	}
 
 	// Clear available bit
 	header->parent_flags &= ~BIT_AVAILABLE;
-	heap->available_space -= ALIGN32(p_size);
 	heap->allocations++;
 	LOG_DEBUG("Allocating %d bytes of memory at address %x", p_size, (void *)header->virt_address);
 	return (void *)header->virt_address;
 }
 
+void *kcalloc(uint32_t p_count, uint32_t p_size)
+{
+	uint32_t size = p_count * p_size;
+	if (p_size && size / p_size != p_count)
+	{
+		return NULL;
+	}
+
+	void *ret = kalloc(size);
+	if (!ret)
+	{
+		return NULL;
+	}
+
+	// Heap pages that haven't been touched yet get a zeroed frame when they are, so only the backed ones are cleared
+	uint32_t address = (uint32_t)ret;
+	uint32_t end	 = address + size;
+	while (address < end)
+	{
+		uint32_t next = AMIN(ALIGN(address + 1, PAGE_SIZE), end);
+		if (is_valid_address((void *)address))
+		{
+			memset((void *)address, 0, next - address);
+		}
+		address = next;
+	}
+
+	return ret;
+}
+
+void *kalloc_large(uint32_t p_size)
+{
+	if (!p_size)
+	{
+		return NULL;
+	}
+
+	p_size	  = ALIGN(p_size, PAGE_SIZE);
+	void *ret = paging_allocate_large_region(p_size);
+	if (!ret)
+	{
+		LOG_ERROR("Unable to allocate %u bytes of large memory.", p_size);
+		return NULL;
+	}
+
+	// Only the first page is tagged, so that `kfree()` can find the size again
+	if (!_a_index_set((uint32_t)ret, ((p_size / PAGE_SIZE) << PAGE_INDEX_LARGE_SHIFT) | PAGE_INDEX_LARGE))
+	{
+		paging_release_region((uint32_t)ret, p_size);
+		return NULL;
+	}
+
+	LOG_DEBUG("Allocating %u bytes of large memory at address %x", p_size, ret);
+	return ret;
+}
+
+void *kalloc_swappable(uint32_t p_size)
+{
+	if (!p_size)
+	{
+		return NULL;
+	}
+
+	p_size	  = ALIGN(p_size, PAGE_SIZE);
+	void *ret = paging_reserve_region(p_size, PAGING_POLICY_SWAPPABLE);
+	if (!ret)
+	{
+		return NULL;
+	}
+
+	// Freed the same way as large regions, which only need their size back
+	if (!_a_index_set((uint32_t)ret, ((p_size / PAGE_SIZE) << PAGE_INDEX_LARGE_SHIFT) | PAGE_INDEX_LARGE))
+	{
+		paging_release_region((uint32_t)ret, p_size);
+		return NULL;
+	}
+
+	LOG_DEBUG("Allocating %u bytes of swappable memory at address %x", p_size, ret);
+	return ret;
+}
+
 void kfree(void *p_mem)
 {
-	struct HeapHeader *header = heap_root;
-	while (header)
+	if (!p_mem)
 	{
-		if (!(header->flags & BIT_HEADERS) && header->virt_address < (uint32_t)p_mem &&
-			header->virt_address + header->size > (uint32_t)p_mem)
-			break;
-		header = header->next;
+		return;
 	}
 
-	// Trawl allocation list
-	struct MemoryHeader *h = header->list;
-	while (h)
+	uint32_t entry = _a_index_get((uint32_t)p_mem);
+	if ((entry & PAGE_INDEX_TYPE_MASK) == PAGE_INDEX_SLAB)
 	{
-		if (h->virt_address == (uint32_t)p_mem)
-			break;
-		h = h->next;
+		_a_slab_free((struct SlabPage *)(entry & ~PAGE_INDEX_TYPE_MASK), p_mem);
+		return;
+	}
+
+	if ((entry & PAGE_INDEX_TYPE_MASK) == PAGE_INDEX_LARGE)
+	{
+		// Only the first page of a region is tagged, so anything else inside it is off a page boundary
+		if ((uint32_t)p_mem % PAGE_SIZE)
+		{
+			LOG_ERROR("Attempted to free address %x, which is inside a large region.", p_mem);
+			return;
+		}
+
+		uint32_t size = (entry >> PAGE_INDEX_LARGE_SHIFT) * PAGE_SIZE;
+		_a_index_set((uint32_t)p_mem, PAGE_INDEX_NONE);
+		paging_release_region((uint32_t)p_mem, size);
+		LOG_DEBUG("Freed %u bytes of large memory from address %x", size, p_mem);
+		return;
+	}
+
+	struct MemoryHeader *h = _a_block_lookup(p_mem);
+	if (!h)
+	{
+		LOG_ERROR("Attempted to free address %x, which was not allocated by kalloc.", p_mem);
+		return;
 	}
 
 	if (h->parent_flags & BIT_AVAILABLE)
@@ -179,23 +439,37 @@ void kfree(void *p_mem)
 		return;
 	}
 
-	// Grow available memory if multiple headers are free
-	h->parent_flags |= BIT_AVAILABLE;
-	struct MemoryHeader *n = h->next;
-	header->allocations--;
-	header->available_space += ALIGN32(h->size);
+	struct HeapHeader *heap = (struct HeapHeader *)(h->parent_flags & 0xfffffff0);
+	heap->allocations--;
 	LOG_DEBUG("Freed %d bytes from address %x", h->size, p_mem);
-	// NOTE: Current implementation only works forwards, backwards sorting may be
-	// needed.
-	while (n)
+	_a_block_release(heap, h);
+
+	if (_a_heap_is_empty(heap))
 	{
-		if (!(n->parent_flags & BIT_AVAILABLE))
-			break;
-		h->size += n->size;
-		n = n->next;
+		_a_heap_reclaim();
 	}
 }
 
+void kalloc_idle()
+{
+	physical_refill_zeroed_pages();
+}
+
+bool kalloc_enable_swap(uint8_t p_drive, uint16_t p_lba, uint32_t p_sector_count)
+{
+	return swap_initialize(p_drive, p_lba, p_sector_count);
+}
+
+uint32_t kalloc_dma(uint32_t p_size)
+{
+	return physical_alloc_dma_pages(ALIGN(p_size, PAGE_SIZE) / PAGE_SIZE);
+}
+
+void kfree_dma(uint32_t p_address, uint32_t p_size)
+{
+	physical_free_pages(p_address, ALIGN(p_size, PAGE_SIZE) / PAGE_SIZE);
+}
+
 void *krealloc(void *ptr, size_t p_size)
 {
 	if (!ptr)
@@ -203,67 +477,205 @@ void *krealloc(void *ptr, size_t p_size)
 		return kalloc(p_size);
 	}
 
-	struct HeapHeader *header = heap_root;
-	while (header)
+	uint32_t entry = _a_index_get((uint32_t)ptr);
+	if ((entry & PAGE_INDEX_TYPE_MASK) == PAGE_INDEX_SLAB)
 	{
-		if (!(header->flags & BIT_HEADERS) && header->virt_address < (uint32_t)ptr &&
-			header->virt_address + header->size > (uint32_t)ptr)
-			break;
-		header = header->next;
+		struct SlabPage *page = (struct SlabPage *)(entry & ~PAGE_INDEX_TYPE_MASK);
+		if (!page->cache || _a_slab_is_free(page, ptr))
+		{
+			LOG_ERROR("Attempted to reallocate address %x, which was not allocated by kalloc.", ptr);
+			return NULL;
+		}
+
+		// Objects already fit anything up to the size of their class, so only move when that changes
+		uint32_t object_size = page->cache->stats.object_size;
+		if (p_size <= object_size && (object_size == (1 << SLAB_MIN_SHIFT) || p_size > (object_size >> 1)))
+		{
+			return ptr;
+		}
+
+		void *ret = kalloc(p_size);
+		if (!ret)
+		{
+			return NULL;
+		}
+
+		memcpy(ret, ptr, AMIN(object_size, p_size));
+		_a_slab_free(page, ptr);
+		return ret;
 	}
 
-	// Trawl allocation list
-	struct MemoryHeader *h = header->list;
-	while (h)
+	if ((entry & PAGE_INDEX_TYPE_MASK) == PAGE_INDEX_LARGE)
 	{
-		if (h->virt_address == (uint32_t)ptr)
-			break;
-		h = h->next;
+		if ((uint32_t)ptr % PAGE_SIZE)
+		{
+			LOG_ERROR("Attempted to reallocate address %x, which is inside a large region.", ptr);
+			return NULL;
+		}
+
+		// Large regions stay large, and only move once they outgrow their pages
+		uint32_t size = (entry >> PAGE_INDEX_LARGE_SHIFT) * PAGE_SIZE;
+		if (p_size <= size)
+		{
+			return ptr;
+		}
+
+		// Nothing has to move if the addresses after the region are free to grow into
+		uint32_t new_size = ALIGN(p_size, PAGE_SIZE);
+		if (paging_extend_region((uint32_t)ptr + size, new_size - size))
+		{
+			_a_index_set((uint32_t)ptr, ((new_size / PAGE_SIZE) << PAGE_INDEX_LARGE_SHIFT) | PAGE_INDEX_LARGE);
+			return ptr;
+		}
+
+		void *ret = kalloc_large(p_size);
+		if (!ret)
+		{
+			return NULL;
+		}
+
+		if (!paging_exchange_region((uint32_t)ptr, (uint32_t)ret, size))
+		{
+			memcpy(ret, ptr, size);
+		}
+		kfree(ptr);
+		return ret;
 	}
 
-	// NOTE: Since realloc() on a freed bit of memory is UB, we'll give the info a
-	// pass for the kernel, but should be warned about in any other context.
+	struct MemoryHeader *h = _a_block_lookup(ptr);
+	if (!h || h->parent_flags & BIT_AVAILABLE)
+	{
+		LOG_ERROR("Attempted to reallocate address %x, which was not allocated by kalloc.", ptr);
+		return NULL;
+	}
 
 	LOG_DEBUG("Reallocated pointer %x from %u bytes to %u bytes", h->virt_address, h->size, p_size);
 
-	// Different block size, do something
-	if (ALIGN32(h->size) != ALIGN32(p_size))
+	// Small sizes belong to the slab allocator, so only resize in place while the block stays large
+	if (p_size > SLAB_MAX_SIZE)
 	{
-		// Memory allocations are always linear, so checking this way should always
-		// be fine
-		if (h->virt_address + p_size > h->next->virt_address)
+		struct HeapHeader *heap = (struct HeapHeader *)(h->parent_flags & 0xfffffff0);
+		uint32_t new_size		= ALIGN(p_size, PAGE_SIZE);
+
+		// Give the pages past the new end back to the heap
+		if (new_size < h->size && _a_block_split(h, new_size))
 		{
-			h->parent_flags |= BIT_AVAILABLE;
-			header->allocations--;
-			// Allocate, copy and free memory
-			void *ret = kalloc(p_size);
-			memcpy(ret, (void *)h->virt_address, h->size);
-			kfree((void *)h->virt_address);
-			return ret;
+			_a_block_release(heap, h->next);
 		}
-		else
+
+		if (new_size <= h->size || _a_block_grow(heap, h, new_size))
 		{
-			// Subtract new size from available memory
-			if (ALIGN32(h->size) > ALIGN32(p_size))
-			{
-				header->available_space += (ALIGN32(h->size) - ALIGN32(p_size));
-			}
-			else
-			{
-				header->available_space -= (ALIGN32(p_size) - ALIGN32(h->size));
-			}
+			return ptr;
 		}
 	}
 
-	// Assign new size
-	h->size = p_size;
-	return ptr;
+	// Allocate, copy and free memory
+	void *ret = kalloc(p_size);
+	if (!ret)
+	{
+		return NULL;
+	}
+
+	// Blocks of whole pages move by trading page table entries with the new block rather than copying, so the cost
+	// doesn't depend on how much is in them. The old block takes the new one's pages back to its heap when freed.
+	if (p_size <= SLAB_MAX_SIZE || !paging_exchange_region((uint32_t)ptr, (uint32_t)ret, h->size))
+	{
+		memcpy(ret, ptr, AMIN(h->size, p_size));
+	}
+	kfree(ptr);
+	return ret;
+}
+
+bool kalloc_get_slab_statistics(uint8_t p_class, struct SlabStatistics *out_stats)
+{
+	if (p_class >= KALLOC_SLAB_CLASS_COUNT || !out_stats)
+	{
+		return false;
+	}
+
+	memcpy(out_stats, &a_slab_caches[p_class].stats, sizeof(struct SlabStatistics));
+	return true;
+}
+
+bool kalloc_get_heap_statistics(struct HeapStatistics *out_stats)
+{
+	if (!out_stats)
+	{
+		return false;
+	}
+
+	memset(out_stats, 0, sizeof(struct HeapStatistics));
+	for (struct HeapHeader *heap = heap_root; heap; heap = heap->next)
+	{
+		if (heap->flags & (BIT_HEADERS | BIT_SLAB))
+			continue;
+
+		out_stats->heap_count++;
+		for (struct MemoryHeader *h = heap->list; h; h = h->next)
+		{
+			if (!(h->parent_flags & BIT_AVAILABLE))
+				continue;
+
+			out_stats->free_blocks++;
+			out_stats->total_free += h->size;
+			out_stats->largest_free = AMAX(out_stats->largest_free, h->size);
+		}
+
+		if (heap->available_space)
+		{
+			out_stats->free_blocks++;
+			out_stats->total_free += heap->available_space;
+			out_stats->largest_free = AMAX(out_stats->largest_free, heap->available_space);
+		}
+	}
+
+	if (out_stats->total_free)
+	{
+		// Work in pages so that large heaps don't overflow the multiplication
+		uint32_t largest_pages	 = out_stats->largest_free / PAGE_SIZE;
+		out_stats->fragmentation = 100 - (largest_pages * 100) / (out_stats->total_free / PAGE_SIZE);
+	}
+	return true;
+}
+
+void kalloc_print_statistics()
+{
+	for (int i = 0; i < KALLOC_SLAB_CLASS_COUNT; i++)
+	{
+		struct SlabStatistics *stats = &a_slab_caches[i].stats;
+		uint32_t hit_rate			 = stats->allocations ? (stats->hits * 100) / stats->allocations : 0;
+		LOG_INFO("Slab %u bytes: %u allocs, %u frees, %u pages, %u%% hit rate",
+				 stats->object_size,
+				 stats->allocations,
+				 stats->frees,
+				 stats->pages,
+				 hit_rate);
+	}
+
+	for (struct KmemCache *cache = a_kmem_caches; cache; cache = cache->next)
+	{
+		struct SlabStatistics *stats = &cache->stats;
+		LOG_INFO("Cache %s (%u bytes): %u in use, %u pages",
+				 cache->name,
+				 stats->object_size,
+				 stats->allocations - stats->frees,
+				 stats->pages);
+	}
+
+	struct HeapStatistics heap_stats;
+	kalloc_get_heap_statistics(&heap_stats);
+	LOG_INFO("Heaps: %u, %u KiB free in %u blocks, largest block %u KiB, %u%% fragmented",
+			 heap_stats.heap_count,
+			 heap_stats.total_free / 1024,
+			 heap_stats.free_blocks,
+			 heap_stats.largest_free / 1024,
+			 heap_stats.fragmentation);
 }
 
 bool kmap_range(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
 {
 	// TODO: Add more here
-	return paging_map_region(p_physical, p_virtual, p_size);
+	return paging_map_large_region(p_physical, p_virtual, p_size);
 }
 
 bool is_4kib_aligned(void *p_address)
@@ -273,52 +685,34 @@ bool is_4kib_aligned(void *p_address)
 
 void *pvirtual_to_physical(void *p_virtual)
 {
+	// Devices don't fault on pages that haven't been touched, so make sure there is a frame to hand them
+	paging_commit_region((uint32_t)p_virtual, 1);
 	return (void *)virtual_to_physical((uint32_t)p_virtual);
 }
 
 /* MEMORY MAP */
 
-struct AuMemoryRegion
-{
-	uint64_t base_address;	 // The starting physical address of the region
-	uint64_t length_blocked; // The length of the region, assuming it is aligned
-							 // to a power of 2 greater than 1.
-};
-
-// Static array of memory regions
-struct AuMemoryInfo
-{
-	size_t region_count;
-	struct AuMemoryRegion *regions;
-};
-
-static struct AuMemoryInfo *a_mmap_info	  = NULL;
-static struct MemoryHeader *a_mmap_header = NULL;
-
 #define AUR_MMAP_NEW_BLOCK(m_name, m_base, m_size, m_usable)                             \
 	struct AuMemoryRegion *a##m_name = &a_mmap_info->regions[a_mmap_info->region_count]; \
 	a##m_name->base_address			 = m_base;                                           \
 	a##m_name->length_blocked		 = (m_size) | (m_usable);                            \
-	a_mmap_info->region_count++;                                                         \
-	a_mmap_header->size += sizeof(struct AuMemoryRegion)
+	a_mmap_info->region_count++
 
 #define AUR_MMAP_DEFAULT() AUR_MMAP_NEW_BLOCK(, mr.base_address, mr.length, mr.type)
 
 static void _a_mmap_create(struct MemoryMap *map)
 {
-	// We manage our blocklist here by raw-allocating with no checks to if the
-	// memory is valid whatsoever. Still need a header though, so we get one here.
-	a_mmap_header		= _a_header_alloc(0x20);
-	a_mmap_header->size = 0; // Zero size to fix allocation issues
-	a_mmap_header->parent_flags &= ~BIT_AVAILABLE;
-	((struct HeapHeader *)(a_mmap_header->parent_flags & 0xfffffff0))->allocations++;
-
-	// Allocate a memory region
+	// We manage our blocklist here by reserving a whole page up-front, which holds far more regions than the BIOS
+	// will ever report. It comes from the root heap since the frame allocator depends on it for its own setup.
+	a_mmap_info = _a_heap_reserve_memory(PAGE_SIZE);
+	if (!a_mmap_info)
+	{
+		LOG_FATAL("Failed to allocate the physical memory map.");
+		return;
+	}
 
-	a_mmap_info			 = (struct AuMemoryInfo *)((void *)a_mmap_header->virt_address);
-	a_mmap_info->regions = (struct AuMemoryRegion *)((void *)a_mmap_info + sizeof(struct AuMemoryInfo));
-	// TODO: Notify heap of allocation changes
-	a_mmap_header->size = sizeof(struct AuMemoryInfo);
+	a_mmap_info->region_count = 0;
+	a_mmap_info->regions	  = (struct AuMemoryRegion *)((void *)a_mmap_info + sizeof(struct AuMemoryInfo));
 
 	bool did_swap = false;
 	for (int i = 0; i < map->region_count - 1; i++)
@@ -342,12 +736,14 @@ static void _a_mmap_create(struct MemoryMap *map)
 	for (int i = 0; i < map->region_count; i++)
 	{
 		struct MemoryRegion mr = map->regions[i];
-		// Map regions if needed
-		if ((mr.type == MEMORY_REGION_ACPI_NVS ||
+		// Map regions if needed. Regions past 4 GiB can't be identity-mapped, and would be truncated to memory below.
+		bool mappable = mr.base_address + mr.length <= HIGH_MEMORY_PHYSICAL_ADDRESS;
+		if (mappable &&
+			(mr.type == MEMORY_REGION_ACPI_NVS ||
 			 (mr.type == MEMORY_REGION_RESERVED && !is_valid_address((void *)((uint32_t)mr.base_address)))) &&
 			!paging_map_region(mr.base_address, mr.base_address, mr.length))
 		{
-			LOG_ERROR("Failed to map region %x (size %x)", mr.base_address, mr.length);
+			LOG_ERROR("Failed to map region %llx (size %llx)", mr.base_address, mr.length);
 			continue;
 		}
 
@@ -413,10 +809,6 @@ static void _a_mmap_create(struct MemoryMap *map)
 		AUR_MMAP_DEFAULT();
 	}
 
-	// Assign the properly aligned space.
-	((struct HeapHeader *)(a_mmap_header->parent_flags & 0xfffffff0))->available_space -=
-		ALIGN(a_mmap_header->size, 0x20);
-
 	for (int i = 0; i < a_mmap_info->region_count; i++)
 	{
 		memcfg.available_memory +=
@@ -429,55 +821,6 @@ static void _a_mmap_create(struct MemoryMap *map)
 #undef AUR_MMAP_DEFAULT
 #undef AUR_MMAP_NEW_BLOCK
 
-/**
- * @brief Checks to see if a given physical address lives within valid memory.
- * @param p_address The address to check
- * @return `true` if yes, `false` if not.
- */
-static bool _a_mmap_is_valid_physical_address(uint32_t p_address)
-{
-	// Just assume that all address space pre-allocating is valid
-	if (!a_mmap_info)
-		return true;
-
-	for (int i = 0; i < a_mmap_info->region_count; i++)
-	{
-		if ((a_mmap_info->regions[i].base_address + (a_mmap_info->regions[i].length_blocked & ~1)) > p_address &&
-			(a_mmap_info->regions[i].length_blocked & 1))
-		{
-			return true;
-		}
-	}
-
-	return false;
-}
-
-/**
- * @brief Gets the first available memory from the next available region, if it
- * exists.
- * @param p_from
- * @return
- */
-static uint32_t _a_mmap_find_next_physical_address(uint32_t p_from)
-{
-	int region = 0;
-	for (int i = 0; i < a_mmap_info->region_count; i++)
-	{
-		if ((a_mmap_info->regions[i].base_address + (a_mmap_info->regions[i].length_blocked & ~1)) > p_from)
-		{
-			region = i;
-			continue;
-		}
-
-		if (region && (a_mmap_info->regions[i].length_blocked & 1))
-		{
-			return (uint32_t)a_mmap_info->regions[i].base_address;
-		}
-	}
-
-	return 0;
-}
-
 /* HEAPS/HEADERS */
 
 /**
@@ -492,7 +835,7 @@ static void *_a_heap_reserve_memory(size_t p_size)
 	struct HeapHeader *header = heap_root;
 	while (header)
 	{
-		if (heap_root->flags & BIT_HEADERS && heap_root->available_space > p_size)
+		if (header->flags & BIT_HEADERS && header->available_space >= ALIGN32(p_size))
 			break;
 		header = header->next;
 	}
@@ -533,6 +876,9 @@ static struct HeapHeader *_a_heap_alloc(size_t p_mibibyte_count, size_t p_addres
 		heap_root->allocations	   = 1;
 		heap_root->flags		   = BIT_KERNEL | BIT_AVAILABLE | BIT_HEADERS;
 		heap_root->virt_address	   = (uint32_t)heap_root;
+
+		// Following heaps must not overlap the root heap in physical memory
+		memcfg.next_free_physical_address = memcfg.physical_mem_start + p_mibibyte_count;
 		return heap_root;
 	}
 
@@ -542,31 +888,34 @@ static struct HeapHeader *_a_heap_alloc(size_t p_mibibyte_count, size_t p_addres
 		mem = mem->next;
 	}
 
-	if (!p_address)
+	// Take the header of a heap that was given back if there is one, and only reserve a new one otherwise
+	struct HeapHeader *ptr = a_spare_heaps;
+	if (ptr)
 	{
-		p_address = memcfg.next_free_physical_address;
+		a_spare_heaps = ptr->next;
 	}
-
-	if (!_a_mmap_is_valid_physical_address(p_address))
+	else
 	{
-		p_address = _a_mmap_find_next_physical_address(p_address);
-		if (!p_address)
+		ptr = (struct HeapHeader *)_a_heap_reserve_memory(sizeof(struct HeapHeader));
+		if (!ptr)
 		{
-			LOG_ERROR("Ran out of physical memory.");
+			LOG_ERROR("Failed to reserve a header for the new heap.");
 			return NULL;
 		}
 	}
 
-	void *nhp = paging_allocate_region(p_address, p_mibibyte_count);
+	// With no address given, the heap only costs virtual memory until it is touched, and is then backed by frames from
+	// the physical allocator a page at a time
+	void *nhp = p_address ? paging_allocate_region(p_address, p_mibibyte_count)
+						  : paging_reserve_region(p_mibibyte_count, PAGING_POLICY_ZERO_FILL);
 	if (!nhp)
 	{
 		LOG_ERROR("Failed to allocate new heap in memory.");
+		ptr->next	  = a_spare_heaps;
+		a_spare_heaps = ptr;
 		return NULL;
 	}
 
-	// Change free phys address TODO: Check if the new address is valid.
-	memcfg.next_free_physical_address += p_mibibyte_count;
-
 	struct HeapHeader h = {0};
 	h.prev				= mem;
 	h.next				= NULL;
@@ -577,8 +926,6 @@ static struct HeapHeader *_a_heap_alloc(size_t p_mibibyte_count, size_t p_addres
 	h.flags				= BIT_KERNEL | BIT_AVAILABLE | BIT_FREE_MEM; // NOTE: Need to say when it's a header
 	h.virt_address		= (uint32_t)nhp;
 
-	struct HeapHeader *ptr = (struct HeapHeader *)_a_heap_reserve_memory(sizeof(struct HeapHeader));
-
 	if (!memcpy(ptr, &h, sizeof(struct HeapHeader)))
 	{
 		LOG_ERROR("Failed to copy the heap to memory.");
@@ -589,54 +936,723 @@ static struct HeapHeader *_a_heap_alloc(size_t p_mibibyte_count, size_t p_addres
 	return ptr;
 }
 
-static struct MemoryHeader *_a_header_alloc(size_t p_size)
+/**
+ * @brief Checks if a heap of large blocks has nothing allocated from it. Freed blocks at the end of a heap go back
+ * into its untouched space, so an empty heap is one with no blocks left at all.
+ * @param p_heap The heap to check
+ * @return `true` if the heap is an empty heap of large blocks, and `false` if not.
+ */
+static bool _a_heap_is_empty(struct HeapHeader *p_heap)
+{
+	return !(p_heap->flags & (BIT_HEADERS | BIT_SLAB)) && !p_heap->list && !p_heap->allocations;
+}
+
+/**
+ * @brief Gives an empty heap back to the system. Its frames go back to the physical allocator, its virtual range is
+ * unmapped, and its header is kept for the next heap to use.
+ * @param p_heap The heap to release. Must be empty, and not the root heap.
+ */
+static void _a_heap_release(struct HeapHeader *p_heap)
+{
+	// The root heap is always first, so every other heap has one before it
+	p_heap->prev->next = p_heap->next;
+	if (p_heap->next)
+	{
+		p_heap->next->prev = p_heap->prev;
+	}
+
+	paging_release_region(p_heap->virt_address, p_heap->size);
+	LOG_DEBUG("Released empty heap at %x (%u KiB)", p_heap->virt_address, p_heap->size / 1024);
+
+	p_heap->next  = a_spare_heaps;
+	p_heap->prev  = NULL;
+	a_spare_heaps = p_heap;
+}
+
+/**
+ * @brief Gives empty heaps back to the system once there is more than `HEAP_RECLAIM_HIGH` bytes of them, until no more
+ * than `HEAP_RECLAIM_LOW` bytes are left. Heaps are released from the end of the list, so the ones that `kalloc()`
+ * reaches first are the ones that stay.
+ */
+static void _a_heap_reclaim()
+{
+	uint32_t empty_size	   = 0;
+	struct HeapHeader *last = heap_root;
+	for (struct HeapHeader *heap = heap_root; heap; heap = heap->next)
+	{
+		if (_a_heap_is_empty(heap))
+		{
+			empty_size += heap->size;
+		}
+		last = heap;
+	}
+
+	if (empty_size <= HEAP_RECLAIM_HIGH)
+	{
+		return;
+	}
+
+	struct HeapHeader *heap = last;
+	while (heap != heap_root && empty_size > HEAP_RECLAIM_LOW)
+	{
+		struct HeapHeader *prev = heap->prev;
+		if (_a_heap_is_empty(heap))
+		{
+			empty_size -= heap->size;
+			_a_heap_release(heap);
+		}
+		heap = prev;
+	}
+}
+
+/**
+ * @brief Carves a new block out of the unused end of a heap, and appends its header to the heap's list.
+ * @param p_heap The heap to carve the block from. Must have at least `p_size` bytes of available space.
+ * @param p_size The size of the block in bytes, as a multiple of 4 KiB.
+ * @return The header for the new block, which is marked as available, or `NULL` if no header could be reserved.
+ */
+static struct MemoryHeader *_a_header_alloc(struct HeapHeader *p_heap, size_t p_size)
+{
+	struct MemoryHeader *mem = kmem_cache_alloc(&a_header_cache);
+	if (!mem)
+	{
+		LOG_ERROR("Failed to reserve root memory header.");
+		return NULL;
+	}
+
+	mem->next		  = NULL;
+	mem->size		  = p_size;
+	mem->virt_address = p_heap->virt_address + p_heap->size - p_heap->available_space;
+	mem->parent_flags = ((uint32_t)p_heap & 0xfffffff0) | BIT_AVAILABLE | BIT_KERNEL;
+
+	if (!_a_block_tag(mem))
+	{
+		_a_index_set(mem->virt_address, PAGE_INDEX_NONE);
+		_a_header_release(mem);
+		return NULL;
+	}
+
+	// Create first memory header, if non-existent. Otherwise the last block sits right below the new one.
+	struct MemoryHeader *end = _a_block_before(p_heap, mem);
+	if (!end)
+	{
+		p_heap->list = mem;
+	}
+	else
+	{
+		end->next = mem;
+	}
+
+	p_heap->available_space -= p_size;
+	return mem;
+}
+
+/**
+ * @brief Returns a header that is no longer part of any heap's list, so that it can be reused by the next block.
+ * @param p_header The header to release.
+ */
+static void _a_header_release(struct MemoryHeader *p_header)
+{
+	kmem_cache_free(&a_header_cache, p_header);
+}
+
+/**
+ * @brief Points the page index entries for the first and last pages of a block at its header.
+ * @param p_header The header of the block to tag.
+ * @return `true` if both ends were tagged, and `false` if a leaf for the index could not be reserved.
+ */
+static bool _a_block_tag(struct MemoryHeader *p_header)
+{
+	uint32_t entry = (uint32_t)p_header | PAGE_INDEX_BLOCK;
+	return _a_index_set(p_header->virt_address, entry) &&
+		   _a_index_set(p_header->virt_address + p_header->size - PAGE_SIZE, entry);
+}
+
+/**
+ * @brief Clears the tag on the last page of a block that is about to change size, so that only the first and last
+ * pages of a block are ever tagged. Single-page blocks keep their tag, as it is also the tag of their first page.
+ * @param p_header The header of the block.
+ */
+static void _a_block_untag_end(struct MemoryHeader *p_header)
+{
+	if (p_header->size > PAGE_SIZE)
+	{
+		_a_index_set(p_header->virt_address + p_header->size - PAGE_SIZE, PAGE_INDEX_NONE);
+	}
+}
+
+/**
+ * @brief Finds the block that ends right where the given one begins, using the tag on its last page.
+ * @param p_heap The heap both blocks belong to
+ * @param p_header The block to look before
+ * @return The header of the previous block, or `NULL` if the block is the first in its heap.
+ */
+static struct MemoryHeader *_a_block_before(struct HeapHeader *p_heap, struct MemoryHeader *p_header)
+{
+	if (p_header->virt_address == p_heap->virt_address)
+	{
+		return NULL;
+	}
+
+	uint32_t entry = _a_index_get(p_header->virt_address - PAGE_SIZE);
+	if ((entry & PAGE_INDEX_TYPE_MASK) != PAGE_INDEX_BLOCK)
+	{
+		return NULL;
+	}
+
+	// Only trust the tag if its block really does end where this one begins
+	struct MemoryHeader *prev = (struct MemoryHeader *)(entry & ~PAGE_INDEX_TYPE_MASK);
+	return (prev->virt_address + prev->size == p_header->virt_address) ? prev : NULL;
+}
+
+/**
+ * @brief Marks a block as free and merges it with any free neighbours. A free block at the end of its heap is returned
+ * to the heap's untouched space instead.
+ * @param p_heap The heap the block belongs to
+ * @param p_header The block to release. May be freed by this function, so it must not be used afterwards.
+ */
+static void _a_block_release(struct HeapHeader *p_heap, struct MemoryHeader *p_header)
+{
+	struct MemoryHeader *h = p_header;
+	h->parent_flags |= BIT_AVAILABLE;
+
+	// Neighbouring blocks are never both free, so merging with the one on each side is always enough
+	struct MemoryHeader *n = h->next;
+	if (n && (n->parent_flags & BIT_AVAILABLE))
+	{
+		_a_block_untag_end(h);
+		h->size += n->size;
+		h->next = n->next;
+		_a_index_set(n->virt_address, PAGE_INDEX_NONE);
+		_a_header_release(n);
+	}
+
+	struct MemoryHeader *p = _a_block_before(p_heap, h);
+	if (p && (p->parent_flags & BIT_AVAILABLE))
+	{
+		_a_block_untag_end(p);
+		p->size += h->size;
+		p->next = h->next;
+		_a_index_set(h->virt_address, PAGE_INDEX_NONE);
+		_a_header_release(h);
+		h = p;
+		p = _a_block_before(p_heap, h);
+	}
+
+	// The last block of a heap goes back into the untouched end, so it can be carved to any size again
+	if (!h->next)
+	{
+		if (p)
+		{
+			p->next = NULL;
+		}
+		else
+		{
+			p_heap->list = NULL;
+		}
+
+		p_heap->available_space += h->size;
+		_a_index_set(h->virt_address, PAGE_INDEX_NONE);
+		_a_index_set(h->virt_address + h->size - PAGE_SIZE, PAGE_INDEX_NONE);
+		_a_header_release(h);
+		return;
+	}
+
+	// Leaves for both ends of the block already exist, so this can't fail
+	_a_block_tag(h);
+}
+
+/**
+ * @brief Grows a block in place, either by absorbing the free block after it or, for the last block of a heap, by
+ * taking space from the untouched end of the heap. If that end runs out, the heap is extended by mapping new pages
+ * right after it in virtual memory.
+ * @param p_heap The heap the block belongs to
+ * @param p_header The block to grow
+ * @param p_size The new size of the block, as a multiple of 4 KiB larger than the current size.
+ * @return `true` if the block now has at least `p_size` bytes, and `false` if it could not grow without moving.
+ */
+static bool _a_block_grow(struct HeapHeader *p_heap, struct MemoryHeader *p_header, uint32_t p_size)
+{
+	uint32_t needed		   = p_size - p_header->size;
+	struct MemoryHeader *n = p_header->next;
+
+	if (n)
+	{
+		if (!(n->parent_flags & BIT_AVAILABLE) || n->size < needed)
+		{
+			return false;
+		}
+
+		// Only absorb what's needed, unless the rest can't be split off
+		if (n->size > needed)
+		{
+			_a_block_split(n, needed);
+		}
+
+		n = p_header->next;
+		_a_block_untag_end(p_header);
+		p_header->size += n->size;
+		p_header->next = n->next;
+		_a_index_set(n->virt_address, PAGE_INDEX_NONE);
+		_a_header_release(n);
+		_a_block_tag(p_header);
+		return true;
+	}
+
+	if (p_heap->available_space < needed)
+	{
+		uint32_t extension = needed - p_heap->available_space;
+		if (!paging_extend_region(p_heap->virt_address + p_heap->size, extension))
+		{
+			return false;
+		}
+
+		p_heap->size += extension;
+		p_heap->available_space += extension;
+	}
+
+	// The new end of the block may need a new index leaf, so tag it before taking the space
+	uint32_t entry = (uint32_t)p_header | PAGE_INDEX_BLOCK;
+	if (!_a_index_set(p_header->virt_address + p_size - PAGE_SIZE, entry))
+	{
+		return false;
+	}
+
+	_a_block_untag_end(p_header);
+	p_header->size = p_size;
+	p_heap->available_space -= needed;
+	return true;
+}
+
+/**
+ * @brief Splits a free block in two, keeping the first N bytes in the given header and placing the rest in a new free
+ * block directly after it.
+ * @param p_header The block to split
+ * @param p_size The number of bytes to keep, as a multiple of 4 KiB smaller than the block.
+ * @return `true` if the block was split, and `false` if it was left whole because no header could be reserved.
+ */
+static bool _a_block_split(struct MemoryHeader *p_header, uint32_t p_size)
 {
+	struct MemoryHeader *rest = kmem_cache_alloc(&a_header_cache);
+	if (!rest)
+	{
+		return false;
+	}
+
+	rest->next		   = p_header->next;
+	rest->virt_address = p_header->virt_address + p_size;
+	rest->size		   = p_header->size - p_size;
+	rest->parent_flags = (p_header->parent_flags & 0xfffffff0) | BIT_AVAILABLE | BIT_KERNEL;
+
+	// Tags at the new boundary may need a new leaf, so set them before anything else changes
+	if (!_a_index_set(rest->virt_address - PAGE_SIZE, (uint32_t)p_header | PAGE_INDEX_BLOCK) ||
+		!_a_index_set(rest->virt_address, (uint32_t)rest | PAGE_INDEX_BLOCK))
+	{
+		if (p_size > PAGE_SIZE)
+		{
+			_a_index_set(rest->virt_address - PAGE_SIZE, PAGE_INDEX_NONE);
+		}
+		_a_header_release(rest);
+		return false;
+	}
+
+	// The last page of the block already has a leaf
+	_a_index_set(rest->virt_address + rest->size - PAGE_SIZE, (uint32_t)rest | PAGE_INDEX_BLOCK);
+	p_header->size = p_size;
+	p_header->next = rest;
+	return true;
+}
+
+/* PAGE INDEX */
+
+/**
+ * @brief Sets the page index entry for the page containing the given address, reserving a leaf for its 4 MiB region
+ * if one doesn't exist yet.
+ * @param p_address Any address within the page
+ * @param p_entry The owner of the page ORed with its `PageIndexType`, or `PAGE_INDEX_NONE` to clear the entry.
+ * @return `true` if the entry was set, `false` if no leaf could be reserved.
+ */
+static bool _a_index_set(uint32_t p_address, uint32_t p_entry)
+{
+	uint32_t *leaf = a_page_index[p_address >> 22];
+	if (!leaf)
+	{
+		if (p_entry == PAGE_INDEX_NONE)
+		{
+			return true;
+		}
+
+		leaf = _a_heap_reserve_memory(PAGE_SIZE);
+		if (!leaf)
+		{
+			LOG_ERROR("Failed to reserve a page index leaf for address %x.", p_address);
+			return false;
+		}
+
+		memset(leaf, 0, PAGE_SIZE);
+		a_page_index[p_address >> 22] = leaf;
+	}
+
+	leaf[(p_address >> 12) & 0x3ff] = p_entry;
+	return true;
+}
+
+/**
+ * @brief Gets the page index entry for the page containing the given address.
+ * @param p_address Any address within the page
+ * @return The entry, or `PAGE_INDEX_NONE` if the page isn't owned by the allocator.
+ */
+static uint32_t _a_index_get(uint32_t p_address)
+{
+	uint32_t *leaf = a_page_index[p_address >> 22];
+	return leaf ? leaf[(p_address >> 12) & 0x3ff] : PAGE_INDEX_NONE;
+}
+
+/**
+ * @brief Finds the header of the heap block that begins at the given address.
+ * @param p_mem The address returned by `kalloc()`
+ * @return The header of the block, or `NULL` if no block begins at the address.
+ */
+static struct MemoryHeader *_a_block_lookup(void *p_mem)
+{
+	uint32_t entry = _a_index_get((uint32_t)p_mem);
+	if ((entry & PAGE_INDEX_TYPE_MASK) != PAGE_INDEX_BLOCK)
+	{
+		return NULL;
+	}
+
+	struct MemoryHeader *header = (struct MemoryHeader *)(entry & ~PAGE_INDEX_TYPE_MASK);
+	return header->virt_address == (uint32_t)p_mem ? header : NULL;
+}
+
+/* SLAB ALLOCATOR */
+
+/**
+ * @brief Finds the size class that serves allocations of the given size.
+ * @param p_size The number of bytes requested. Must be no greater than `SLAB_MAX_SIZE`.
+ * @return The index of the size class in `a_slab_caches`.
+ */
+static uint8_t _a_slab_class(uint32_t p_size)
+{
+	if (p_size <= (1 << SLAB_MIN_SHIFT))
+	{
+		return 0;
+	}
+
+	// Round up to the next power of 2, then offset by the smallest class
+	return 32 - __builtin_clz(p_size - 1) - SLAB_MIN_SHIFT;
+}
+
+/**
+ * @brief Finds the descriptor of the page a given address lives in.
+ * @param p_heap The slab heap the address lives in
+ * @param p_address The address to look up
+ * @return The descriptor of the page.
+ */
+static struct SlabPage *_a_slab_descriptor(struct HeapHeader *p_heap, uint32_t p_address)
+{
+	return &((struct SlabPage *)p_heap->virt_address)[(p_address - p_heap->virt_address) / PAGE_SIZE];
+}
+
+/**
+ * @brief Allocates a new heap for the slab allocator to carve pages from. The descriptors for each page of the heap
+ * are kept at the start of the heap itself.
+ * @return The new heap, or `NULL` if it could not be allocated.
+ */
+static struct HeapHeader *_a_slab_heap_alloc()
+{
+	struct HeapHeader *heap = _a_heap_alloc(0x04, 0x00);
+	if (!heap)
+	{
+		return NULL;
+	}
+
+	uint32_t descriptor_size = ALIGN((heap->size / PAGE_SIZE) * sizeof(struct SlabPage), PAGE_SIZE);
+	memset((void *)heap->virt_address, 0, descriptor_size);
+	heap->flags |= BIT_SLAB;
+	heap->available_space -= descriptor_size;
+	return heap;
+}
+
+/**
+ * @brief Obtains an unused page for a cache to use, either by reusing a page that a cache has released or by
+ * carving a new one from a slab heap.
+ * @return The descriptor of the page, or `NULL` if no memory is left.
+ */
+static struct SlabPage *_a_slab_page_alloc()
+{
+	if (a_slab_free_pages)
+	{
+		struct SlabPage *page = a_slab_free_pages;
+		a_slab_free_pages	  = page->next;
+		return page;
+	}
+
 	struct HeapHeader *heap = heap_root;
 	while (heap)
 	{
-		if (!(heap->flags & BIT_HEADERS) && heap->available_space > p_size)
+		if ((heap->flags & BIT_SLAB) && heap->available_space >= PAGE_SIZE)
 			break;
 		heap = heap->next;
 	}
 
-	// Allocate heap if needed
 	if (!heap)
 	{
-		heap = _a_heap_alloc(0x04, 0);
+		heap = _a_slab_heap_alloc();
 		if (!heap)
 		{
-			LOG_ERROR("Failed to allocate heap.");
+			LOG_ERROR("Failed to allocate a new slab heap.");
 			return NULL;
 		}
 	}
 
-	struct MemoryHeader *mem = _a_heap_reserve_memory(sizeof(struct MemoryHeader));
-	if (!mem)
+	uint32_t address = heap->virt_address + heap->size - heap->available_space;
+	heap->available_space -= PAGE_SIZE;
+	heap->allocations++;
+
+	struct SlabPage *page = _a_slab_descriptor(heap, address);
+	page->virt_address	  = address;
+	if (!_a_index_set(address, (uint32_t)page | PAGE_INDEX_SLAB))
 	{
-		LOG_ERROR("Failed to reserve root memory header.");
+		heap->available_space += PAGE_SIZE;
+		heap->allocations--;
 		return NULL;
 	}
 
-	mem->next		  = NULL;
-	mem->size		  = p_size;
-	mem->virt_address = heap->virt_address + heap->size - heap->available_space;
-	mem->parent_flags = ((uint32_t)heap & 0xfffffff0) | BIT_AVAILABLE | BIT_KERNEL;
+	return page;
+}
 
-	// Create first memory header, if non-existent
-	if (!heap->list)
+/**
+ * @brief Hands a page over to a cache, threading every object in it onto the page's free list and placing the page at
+ * the front of the cache's partial list.
+ * @param p_cache The cache to give the page to
+ * @param p_page The page to set up
+ */
+static void _a_slab_page_init(struct KmemCache *p_cache, struct SlabPage *p_page)
+{
+	uint32_t object_size = p_cache->stats.object_size;
+
+	p_page->cache	  = p_cache;
+	p_page->in_use	  = 0;
+	p_page->capacity  = PAGE_SIZE / object_size;
+	p_page->free_list = NULL;
+
+	// Thread backwards so that objects are handed out in address order
+	for (int i = p_page->capacity - 1; i >= 0; i--)
 	{
-		heap->list = mem;
+		void **object	  = (void **)(p_page->virt_address + i * object_size);
+		object[0]		  = p_page->free_list;
+		object[1]		  = (void *)(SLAB_FREE_POISON ^ (uint32_t)object);
+		p_page->free_list = object;
+	}
+
+	p_page->prev = NULL;
+	p_page->next = p_cache->partial;
+	if (p_cache->partial)
+	{
+		p_cache->partial->prev = p_page;
+	}
+	p_cache->partial = p_page;
+	p_cache->stats.pages++;
+}
+
+/**
+ * @brief Removes a page from its cache's partial list.
+ * @param p_cache The cache the page belongs to
+ * @param p_page The page to remove
+ */
+static void _a_slab_unlink(struct KmemCache *p_cache, struct SlabPage *p_page)
+{
+	if (p_page->prev)
+	{
+		p_page->prev->next = p_page->next;
 	}
 	else
 	{
-		struct MemoryHeader *end = heap->list;
-		while (end->next)
+		p_cache->partial = p_page->next;
+	}
+
+	if (p_page->next)
+	{
+		p_page->next->prev = p_page->prev;
+	}
+
+	p_page->next = NULL;
+	p_page->prev = NULL;
+}
+
+/**
+ * @brief Sets up a cache that hasn't been used yet.
+ * @param p_cache The cache to set up
+ * @param p_name The name of the cache, which is added to the list of named caches if not `NULL`.
+ * @param p_size The size of each object, which is rounded up to 8 bytes.
+ * @param p_constructor Function to call on each object as it is handed out. May be `NULL`.
+ */
+static void _a_cache_init(
+	struct KmemCache *p_cache, const char *p_name, uint32_t p_size, void (*p_constructor)(void *))
+{
+	memset(p_cache, 0, sizeof(struct KmemCache));
+	p_cache->stats.object_size = ALIGN(p_size, 8);
+	p_cache->name			   = p_name;
+	p_cache->constructor	   = p_constructor;
+
+	if (p_name)
+	{
+		p_cache->next = a_kmem_caches;
+		a_kmem_caches = p_cache;
+	}
+}
+
+struct KmemCache *kmem_cache_create(const char *p_name, uint32_t p_object_size, void (*p_constructor)(void *))
+{
+	if (!p_name || !p_object_size || p_object_size > SLAB_MAX_SIZE)
+	{
+		LOG_ERROR("Unable to create a cache of %u-byte objects.", p_object_size);
+		return NULL;
+	}
+
+	struct KmemCache *cache = kmem_cache_alloc(&a_cache_cache);
+	if (!cache)
+	{
+		return NULL;
+	}
+
+	_a_cache_init(cache, p_name, p_object_size, p_constructor);
+	LOG_DEBUG("Created cache %s for %u-byte objects", p_name, cache->stats.object_size);
+	return cache;
+}
+
+void *kmem_cache_alloc(struct KmemCache *p_cache)
+{
+	if (!p_cache)
+	{
+		return NULL;
+	}
+
+	struct KmemCache *cache = p_cache;
+	struct SlabPage *page	= cache->partial;
+
+	if (page)
+	{
+		cache->stats.hits++;
+	}
+	else
+	{
+		page = _a_slab_page_alloc();
+		if (!page)
 		{
-			end = end->next;
+			return NULL;
 		}
 
-		end->next = mem;
+		_a_slab_page_init(cache, page);
+		cache->stats.misses++;
 	}
 
-	return mem;
+	void **ret		= page->free_list;
+	page->free_list = ret[0];
+	ret[1]			= NULL;
+	page->in_use++;
+	cache->stats.allocations++;
+
+	// Full pages leave the partial list until an object is returned to them
+	if (page->in_use == page->capacity)
+	{
+		_a_slab_unlink(cache, page);
+	}
+
+	if (cache->constructor)
+	{
+		cache->constructor(ret);
+	}
+	return ret;
+}
+
+void kmem_cache_free(struct KmemCache *p_cache, void *p_object)
+{
+	if (!p_object)
+	{
+		return;
+	}
+
+	uint32_t entry		  = _a_index_get((uint32_t)p_object);
+	struct SlabPage *page = (struct SlabPage *)(entry & ~PAGE_INDEX_TYPE_MASK);
+	if ((entry & PAGE_INDEX_TYPE_MASK) != PAGE_INDEX_SLAB || page->cache != p_cache)
+	{
+		LOG_ERROR("Attempted to free address %x, which does not belong to the given cache.", p_object);
+		return;
+	}
+
+	_a_slab_free(page, p_object);
+}
+
+/**
+ * @brief Checks whether an object is already on its page's free list.
+ * @param p_page The page the object is in
+ * @param p_mem The object to check
+ * @return `true` if the object is free, and `false` if it is handed out.
+ */
+static bool _a_slab_is_free(struct SlabPage *p_page, void *p_mem)
+{
+	// A handed out object only holds the poison if it wrote it itself, so the free list is only walked when it does
+	if (((void **)p_mem)[1] != (void *)(SLAB_FREE_POISON ^ (uint32_t)p_mem))
+	{
+		return false;
+	}
+
+	for (void **object = p_page->free_list; object; object = object[0])
+	{
+		if (object == p_mem)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void _a_slab_free(struct SlabPage *p_page, void *p_mem)
+{
+	if (!p_page->cache || ((uint32_t)p_mem - p_page->virt_address) % p_page->cache->stats.object_size != 0)
+	{
+		LOG_ERROR("Attempted to free address %x, which is not a slab object.", p_mem);
+		return;
+	}
+
+	if (_a_slab_is_free(p_page, p_mem))
+	{
+		LOG_ERROR("Double free attempted.");
+		return;
+	}
+
+	struct KmemCache *cache = p_page->cache;
+	void **object			= p_mem;
+	object[0]				= p_page->free_list;
+	object[1]				= (void *)(SLAB_FREE_POISON ^ (uint32_t)p_mem);
+	p_page->free_list		= p_mem;
+
+	// Page was full, so it has to go back on the partial list
+	if (p_page->in_use == p_page->capacity)
+	{
+		p_page->prev = NULL;
+		p_page->next = cache->partial;
+		if (cache->partial)
+		{
+			cache->partial->prev = p_page;
+		}
+		cache->partial = p_page;
+	}
+
+	p_page->in_use--;
+	cache->stats.frees++;
+
+	// Give empty pages back for other caches to use, but keep the last one so that a cache allocating and freeing
+	// a single object doesn't swap pages every time.
+	if (p_page->in_use == 0 && (p_page->prev || p_page->next))
+	{
+		_a_slab_unlink(cache, p_page);
+		p_page->cache	  = NULL;
+		p_page->next	  = a_slab_free_pages;
+		a_slab_free_pages = p_page;
+		cache->stats.pages--;
+	}
 }
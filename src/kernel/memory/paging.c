@@ -1,58 +1,137 @@
 #include "paging.h"
+#include "physical.h"
+#include "swap.h"
+#include "vmem.h"
 
+#include <aurora/arch/cpuid.h>
+#include <aurora/arch/interrupts.h>
 #include <aurora/memdefs.h>
 #include <aurora/memory.h> // Maybe not a perfect include?
 
+#include <asm/io.h>
+
 #include <string.h>
 
 #define AUR_MODULE "paging"
 #include <aurora/debug.h>
 
-#define PAGE_TABLE_COUNT (PAGE_TABLE_MEMORY_SIZE / 4096)
+// The boot code maps the page table pool from its physical address up to the kernel
+#define PAGE_TABLE_POOL_SIZE (KERNEL_PHYSICAL_ADDRESS - PAGE_TABLE_PHYSICAL_ADDRESS)
+#define PAGE_TABLE_COUNT	 (PAGE_TABLE_POOL_SIZE / 4096)
+
+// A directory entry covers 4 MiB with 32-bit paging, and 2 MiB with PAE paging. Large pages are the same size.
+#define LEGACY_LARGE_PAGE_SHIFT 22
+#define PAE_LARGE_PAGE_SHIFT	21
+
+// With PAE, the last four entries of the last page directory point back at the four directories. Every table then
+// shows up from `PAE_RECURSIVE_VIRTUAL_ADDRESS`, and the directories themselves in the last 16 KiB of memory.
+#define PAE_RECURSIVE_INDEX			  2044
+#define PAE_DIRECTORY_VIRTUAL_ADDRESS (PAE_RECURSIVE_VIRTUAL_ADDRESS + PAE_RECURSIVE_INDEX * 4096)
+
+// Bits of an entry that hold a physical address. 32-bit entries only ever use the lower half.
+#define ENTRY_ADDRESS_MASK 0x000ffffffffff000ULL
+
+// Bit of a PAE entry that stops code from running in the memory it maps
+#define PAE_NO_EXECUTE (1ULL << 63)
+
+// Number of pages outside the direct map that can be mapped at once through `paging_map_high_page()`
+#define HIGH_WINDOW_PAGES 32
+
+// With 32-bit paging, the recursive entry makes the current directory show up as the last page of memory
+#define LEGACY_DIRECTORY_VIRTUAL_ADDRESS (RECURSIVE_MAP_VIRTUAL_ADDRESS + 1023 * 4096)
+
+// Number of address spaces that can exist at once, including the one the kernel boots with
+#define ADDRESS_SPACE_COUNT 32
+
+// Past this many pages, unmapping a region reloads CR3 once instead of invalidating each page. Only global pages
+// survive the reload, and those are never unmapped.
+#define TLB_FLUSH_THRESHOLD 32
+
+// Number of mappings outside the direct map that can be traced back from their physical address
+#define REVERSE_INDEX_SIZE 64
+
+// Number of reserved regions that the page fault handler can back on demand. Every heap, large allocation and
+// swappable region takes one.
+#define LAZY_REGION_COUNT 512
+
+// Bits of the error code pushed by a page fault
+#define PAGE_FAULT_PRESENT 0x1 // The page was present, so the access broke its protection
+#define PAGE_FAULT_WRITE   0x2 // The access was a write
+#define PAGE_FAULT_USER	   0x4 // The access came from user mode
 
 #define MIN_VIRTUAL_ADDRESS_LOCATION
 
-struct __attribute__((aligned(4096))) PageTable
+// A range of physical memory that was mapped to a known virtual address outside of the direct map
+struct ReverseMapping
 {
-	uint32_t entry[1024];
+	uint32_t physical; // Physical address the mapping starts at
+	uint32_t virtual;  // Virtual address the mapping starts at
+	uint32_t size;	   // Number of bytes mapped
 };
 
-struct PageTableConfig
+// A range of kernel memory that is only given frames as its pages are touched
+struct LazyRegion
 {
-	uint8_t page_info[PAGE_TABLE_COUNT];
-	struct PageTable *next_free;
-	uint32_t available_space;
-	uint16_t available_tables;
-	uint32_t kernel_vmem_start; // The point where kernel virtual memory can be allocated from
-	uint32_t user_vmem_start;	// The point where userspace virtual memory can be allocated from
+	uint32_t start; // Virtual address the region starts at
+	uint32_t size;	// Number of bytes in the region
+	uint8_t policy; // `PagingPolicy` for pages of the region that don't have a frame yet
+	bool large;		// Whether whole blocks of the region are backed by large pages
 };
 
-// Only use the first 3 bits so far for information, may use the rest at some point.
-enum PageInfoBits
+struct PageTableConfig
 {
-	BIT_AVAILABLE		 = 0,
-	BIT_USED			 = 1 << 0,
-	BIT_PARTIALLY_FILLED = 1 << 1,
-	BIT_KERNEL			 = 0 << 2,
-	BIT_USERSPACE		 = 1 << 2,
+	uint16_t pool_count;				  // Number of tables in `pool_free`
+	uint16_t pool_free[PAGE_TABLE_COUNT]; // Stack of free tables in the pool, as indices into it
+	bool large_pages;					  // Whether large pages are supported and have been enabled
+	bool global_pages;					  // Whether global pages are supported and have been enabled
+	bool pae;							  // Whether PAE paging is in use, with 64-bit entries
+	uint8_t large_page_shift;			  // Number of address bits covered by a directory entry
+	uint32_t large_page_size;			  // Number of bytes covered by a directory entry, and so by a large page
+	uint32_t recursive_address;			  // Virtual address every page table can be reached through
+	uint64_t data_flags;				  // Flags for every mapping made at runtime, which is the NX bit if enabled
+	uint32_t high_window;				  // First address of the window for memory the direct map misses
+	uint32_t high_window_used;			  // Bit mask of the pages in `high_window` that are in use
+	uint32_t direct_map_size;			  // Number of bytes of physical memory in the direct map
+	uint8_t reverse_count;				  // Number of mappings in `reverse_index`
+	// Mappings made outside of the direct map
+	struct ReverseMapping reverse_index[REVERSE_INDEX_SIZE];
+	uint16_t lazy_count;	 // Number of regions in `lazy_regions`
+	uint32_t swappable_size; // Number of bytes across every swappable region in `lazy_regions`
+	// Regions that are backed by the page fault handler, sorted by address
+	struct LazyRegion lazy_regions[LAZY_REGION_COUNT];
+	uint32_t current_space; // Physical address of the directory in CR3
+	uint8_t space_count;	// Number of directories in `spaces`
+	// Physical address of every directory, once there is more than one
+	uint32_t spaces[ADDRESS_SPACE_COUNT];
+	uint32_t clock_hand;  // Next page of a swappable region for the page replacement clock to look at
+	bool handling_fault;  // Whether the page fault handler is running
+	uint32_t fault_flags; // EFLAGS of the code that caused the fault being handled
 };
 
-// (PAGE_TABLE_VIRTUAL_ADDRESS + PAGE_TABLE_MEMORY_SIZE - PAGE_TABLE_CONFIG_SIZE)
-
-// HACK: We use this to reserve memory in the kernel for the page table config as it is otherwise unmapped memory. Move
-// this at some point.
-static uint8_t __ptc_reserved[sizeof(struct PageTableConfig)] = {0};
-
-const int x = sizeof(struct PageTableConfig);
-
-struct PageTableConfig *config	   = (struct PageTableConfig *)&__ptc_reserved;
-struct PageTable *allocated_tables = (void *)PAGE_TABLE_VIRTUAL_ADDRESS;
-int used_table_count			   = 0;
+static struct PageTableConfig ptcfg = {0};
 
 extern uint32_t page_directory[1024];
 extern uint8_t __end; // Address at the end of the kernel
 
 void __attribute__((cdecl)) __tlb_flush(void *p_address);
+void __attribute__((cdecl)) __enable_pse();
+void __attribute__((cdecl)) __enable_pge();
+void __attribute__((cdecl)) __reload_cr3();
+uint32_t __attribute__((cdecl)) __read_cr2();
+void __attribute__((cdecl)) __enable_nx();
+void __attribute__((cdecl)) __enable_pae(uint32_t p_pdpt);
+void __attribute__((cdecl)) __enable_write_protect();
+void __attribute__((cdecl)) __load_cr3(uint32_t p_directory);
+
+bool _map_region(uint64_t p_physical, uint32_t p_virtual, uint32_t p_size);
+bool _map_large_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size, uint32_t p_flags);
+bool _map_large_page(uint64_t p_physical, uint32_t p_virtual, uint32_t p_flags);
+bool _map_new_frames(uint32_t p_virtual, uint32_t p_size);
+void _unmap_region(uint32_t p_virtual, uint32_t p_size);
+bool _page_fault_handler(struct Registers *p_regs);
+bool _copy_on_write(uint32_t p_virtual);
+void _release_table_frame(uint32_t p_frame);
+static uint32_t _alloc_frame();
 
 // Utility function (rounds up)
 uint32_t ceil(uint32_t x, uint32_t y)
@@ -60,81 +139,217 @@ uint32_t ceil(uint32_t x, uint32_t y)
 	return x % y == 0 ? x / y : (x / y) + 1;
 }
 
-struct PageTable *_alloc_new_table()
+/**
+ * @brief Gets the page table behind a page directory entry. The last entry of the directory points back at the
+ * directory itself, so every table shows up at the top of memory no matter where its frame is.
+ * @param p_index The index of the page directory entry. With PAE, entries are counted across all four directories.
+ * @return A pointer to the page table. Only valid while the entry is present and not a large page.
+ */
+static inline uint32_t *_table_at(uint16_t p_index)
+{
+	return (uint32_t *)(ptcfg.recursive_address + ((uint32_t)p_index << 12));
+}
+
+/**
+ * @brief Gets the page directory entry that covers an address.
+ * @param p_virtual The virtual address
+ * @return The index of the entry. With PAE, entries are counted across all four directories.
+ */
+static inline uint16_t _dir_index(uint32_t p_virtual)
+{
+	return p_virtual >> ptcfg.large_page_shift;
+}
+
+/**
+ * @brief Gets the order of the block of frames that fills a large page.
+ * @return The order to pass to `physical_alloc_order()`.
+ */
+static inline uint8_t _large_page_order()
+{
+	return ptcfg.large_page_shift - 12;
+}
+
+/**
+ * @brief Gets where a page directory entry is stored.
+ * @param p_index The index of the entry
+ * @return A pointer to the entry, which is 64 bits wide with PAE.
+ */
+static inline uint32_t *_dir_slot(uint16_t p_index)
 {
-	if (config->available_tables == 0)
+	if (ptcfg.pae)
 	{
-		return NULL;
+		return (uint32_t *)(PAE_DIRECTORY_VIRTUAL_ADDRESS + p_index * 8);
 	}
 
-	// Check bits in page table config for our needed table
-	uint16_t idx = -1;
-	for (int i = 0; i < PAGE_TABLE_COUNT; i++)
+	return (uint32_t *)LEGACY_DIRECTORY_VIRTUAL_ADDRESS + p_index;
+}
+
+/**
+ * @brief Checks whether a page directory entry covers user memory, which is private to each address space.
+ * @param p_index The index of the entry
+ * @return `true` if the entry is in the user range, and `false` if it belongs to the kernel.
+ */
+static inline bool _is_user_index(uint16_t p_index)
+{
+	return p_index >= _dir_index(USER_ALLOC_VIRTUAL_ADDRESS) && p_index < _dir_index(USER_ALLOC_END_VIRTUAL_ADDRESS);
+}
+
+/**
+ * @brief Gets where the page table entry for an address is stored. Tables are mapped in order through the recursive
+ * entry, so the entries for every page of memory form a single array.
+ * @param p_virtual The virtual address. The directory entry that covers it must point to a table.
+ * @return A pointer to the entry, which is 64 bits wide with PAE.
+ */
+static inline uint32_t *_entry_slot(uint32_t p_virtual)
+{
+	uint32_t entry_size = ptcfg.pae ? 8 : 4;
+	return (uint32_t *)(ptcfg.recursive_address + (p_virtual >> 12) * entry_size);
+}
+
+/**
+ * @brief Reads a page directory or page table entry.
+ * @param p_slot Where the entry is stored
+ * @return The entry, widened to 64 bits for 32-bit paging.
+ */
+static inline uint64_t _entry_get(uint32_t *p_slot)
+{
+	return ptcfg.pae ? *(uint64_t *)p_slot : *p_slot;
+}
+
+/**
+ * @brief Writes a page directory or page table entry. A 64-bit entry takes two writes, so the half with the present
+ * bit is cleared first and written last, and the CPU never sees half of an entry.
+ * @param p_slot Where the entry is stored
+ * @param p_entry The new entry
+ */
+static inline void _entry_set(uint32_t *p_slot, uint64_t p_entry)
+{
+	volatile uint32_t *half = p_slot;
+	if (ptcfg.pae)
+	{
+		half[0] = 0;
+		half[1] = (uint32_t)(p_entry >> 32);
+	}
+	half[0] = (uint32_t)p_entry;
+}
+
+/**
+ * @brief Writes a page directory entry. Kernel memory looks the same from every address space, so kernel entries are
+ * copied into every other directory as well.
+ * @param p_index The index of the entry
+ * @param p_entry The new entry
+ */
+static void _dir_set(uint16_t p_index, uint64_t p_entry)
+{
+	_entry_set(_dir_slot(p_index), p_entry);
+	if (_is_user_index(p_index))
+	{
+		return;
+	}
+
+	// Only 32-bit paging has more than one address space, so other directories always have 32-bit entries
+	for (int i = 0; i < ptcfg.space_count; i++)
 	{
-		if (!(config->page_info[i] & BIT_USED))
+		if (ptcfg.spaces[i] != ptcfg.current_space)
 		{
-			idx = i;
-			break;
+			((uint32_t *)physical_to_virtual(ptcfg.spaces[i]))[p_index] = (uint32_t)p_entry;
 		}
 	}
+}
 
-	// Failed to find a valid table (potential overload?)
-	if (idx == (uint16_t)-1)
+/**
+ * @brief Takes a frame from the boot-time table pool.
+ * @return The physical address of the frame, or 0 if the pool is empty.
+ */
+static uint32_t _pool_take()
+{
+	if (!ptcfg.pool_count)
 	{
-		return NULL;
+		return 0;
 	}
 
-	// Assign next table
-	struct PageTable *ret = config->next_free;
-	config->available_tables--;
-	config->available_space -= 4096;
-	// Set active
-	config->page_info[idx] = BIT_USED | BIT_KERNEL;
+	return PAGE_TABLE_PHYSICAL_ADDRESS + ptcfg.pool_free[--ptcfg.pool_count] * 4096;
+}
 
-	for (int i = idx; i < PAGE_TABLE_COUNT; i++)
+/**
+ * @brief Gives a page directory entry a new, empty page table. Tables come from the boot-time pool while it lasts, and
+ * from the physical allocator afterwards.
+ * @param p_index The index of the page directory entry, which must not be present.
+ * @return `true` if the table was added, and `false` if there is no memory left for one.
+ */
+bool _alloc_table(uint16_t p_index)
+{
+	// Frames from the zeroed pool are already empty tables
+	bool zeroed	   = false;
+	uint32_t frame = _pool_take();
+	if (!frame)
 	{
-		if (!(config->page_info[i] & 1))
-		{
-			config->next_free = &allocated_tables[i];
-			used_table_count++;
-			break;
-		}
+		frame  = physical_alloc_zeroed_page();
+		zeroed = frame != 0;
 	}
 
-	return ret;
+	if (!frame)
+	{
+		frame = _alloc_frame();
+	}
+
+	if (!frame)
+	{
+		return false;
+	}
+
+	// The boot code gave every entry the read/write bit, and PAE directories start out empty
+	_dir_set(p_index, frame | PAGE_FLAG_READ_WRITE | 1);
+	__tlb_flush(_table_at(p_index));
+	if (!zeroed)
+	{
+		memset(_table_at(p_index), 0, 4096);
+	}
+	return true;
 }
 
-void _pt_free(struct PageTable *p_table)
+/**
+ * @brief Removes the page table behind a page directory entry, and gives its frame back to wherever it came from.
+ * @param p_index The index of the page directory entry
+ */
+void _free_table(uint16_t p_index)
 {
-	uint16_t idx = -1;
-	for (int i = 0; i < PAGE_TABLE_COUNT; i++)
+	uint64_t pde = _entry_get(_dir_slot(p_index));
+	_dir_set(p_index, pde & PAGE_FLAG_READ_WRITE);
+	__tlb_flush(_table_at(p_index));
+	_release_table_frame(pde & ENTRY_ADDRESS_MASK);
+}
+
+/**
+ * @brief Gives the frame of a page table that is no longer in use back to wherever it came from.
+ * @param p_frame The physical address of the table
+ */
+void _release_table_frame(uint32_t p_frame)
+{
+	if (p_frame - PAGE_TABLE_PHYSICAL_ADDRESS < PAGE_TABLE_POOL_SIZE)
 	{
-		if (&allocated_tables[i] == p_table)
-		{
-			idx = i;
-			break;
-		}
+		ptcfg.pool_free[ptcfg.pool_count++] = (p_frame - PAGE_TABLE_PHYSICAL_ADDRESS) / 4096;
+		return;
 	}
 
-	if (idx == (uint16_t)-1)
+	// The tables the boot code set up are part of the kernel image
+	uint32_t kernel_end = (uint32_t)&__end - KERNEL_VIRTUAL_ADDRESS + KERNEL_PHYSICAL_ADDRESS;
+	if (p_frame >= KERNEL_PHYSICAL_ADDRESS && p_frame < kernel_end)
 	{
 		return;
 	}
 
-	memset(p_table, 0, sizeof(struct PageTable));
-	config->page_info[idx] ^= BIT_USED | BIT_KERNEL;
-	config->available_space += 4096;
-	config->available_tables++;
-	used_table_count--;
+	physical_free_pages(p_frame, 1);
 }
 
 // 1024 PT entries --> 4096 KiB = 4 MiB = 0x400000 in hex per PT
 // 1024 PD entries --> 4096 * 1024 = 4194304 KiB = 4096 MiB = 4 GiB
+// With PAE, 512 PT entries --> 2 MiB per PT, and 4 PDs of 512 entries --> 4 GiB
 
 /**
  * @brief Finds the number of directories to use for the given virtual address and size. Virtual addresses that are not
- * aligned to a 4 MiB boundary may straddle a border, which doesn't get picked up by the `ceil()` function. In order to
- * find the appropriate number of directories, we need to check if the remaining address space until the next 4 MiB
+ * aligned to a directory boundary may straddle a border, which doesn't get picked up by the `ceil()` function. In
+ * order to find the appropriate number of directories, we need to check if the remaining address space until the next
  * boundary is greater than the size, and if so, we subtract the difference and ceiling-divide size to get the
  * directory count.
  * @param p_virtual The base virtual address to place the memory at
@@ -143,7 +358,8 @@ void _pt_free(struct PageTable *p_table)
  */
 int _get_directory_count(uint32_t p_virtual, uint32_t p_size)
 {
-	uint32_t remainder_in_virt = (p_virtual & 0xffc00000) + 0x400000 - p_virtual;
+	uint32_t block			   = ptcfg.large_page_size;
+	uint32_t remainder_in_virt = (p_virtual & ~(block - 1)) + block - p_virtual;
 	// Isn't straddling a border
 	if (p_size <= remainder_in_virt)
 	{
@@ -151,89 +367,183 @@ int _get_directory_count(uint32_t p_virtual, uint32_t p_size)
 	}
 
 	p_size -= remainder_in_virt;
-	return ceil(p_size, 0x400000) + 1;
+	return ceil(p_size, block) + 1;
 }
 
-uint32_t find_next_free_region(uint32_t p_size)
+/**
+ * @brief Switches from 32-bit paging to PAE paging. Every mapping made so far is copied into new tables from the
+ * boot-time pool, which is identity-mapped and so can be filled in before the switch.
+ * @return `true` if PAE paging is now in use, and `false` if the pool is too small, in which case nothing changes.
+ */
+static bool _pae_enable()
 {
-	uint32_t ret = config->kernel_vmem_start;
-	int i = 0, j = 0;
-	struct PageTable *pt = NULL;
-	for (i = (ret & 0xffc00000) >> 22; i < 1024; i++)
+	// Every 32-bit directory entry turns into two PAE ones. The last legacy entry is the recursive one, and the one
+	// before it sits where the PAE tables will show up.
+	const int legacy_count = PAE_RECURSIVE_INDEX / 2;
+	if (page_directory[legacy_count] & 1)
 	{
-		pt = (struct PageTable *)(page_directory[i] & 0xfffff000);
-		if (!pt)
-		{
-			ret = i << 22;
-			break;
-		}
+		LOG_WARNING("Memory at %x is in the way of the PAE page tables.", legacy_count << 22);
+		return false;
+	}
 
-		bool found = false;
-		for (j = 0; j < 1024; j++)
+	// A frame for the pointer table and each directory, and two for every table that gets split in half
+	int needed = 5;
+	for (int i = 0; i < legacy_count; i++)
+	{
+		if ((page_directory[i] & 1) && !(page_directory[i] & PAGE_FLAG_SIZE_4MIB))
 		{
-			if (pt->entry[j] == 0)
-			{
-				ret	  = (i << 22) | (j << 12);
-				found = true;
-				break;
-			}
+			needed += 2;
 		}
+	}
 
-		if (found)
-			break;
+	if (ptcfg.pool_count < needed)
+	{
+		LOG_WARNING("Not enough page tables left to switch to PAE paging.");
+		return false;
 	}
 
-	// Validate if the needed value of page directories can use the whole address space. It doesn't matter if separate
-	// blocks are non-contingous, but per-allocation blocks MUST be in order for the system to work. Returning NULL
-	// here allows the code to catch that an allocation failed for this specific reason.
-	int count = _get_directory_count(ret, p_size);
-	if (pt)
+	uint64_t *pdpt = (uint64_t *)_pool_take();
+	uint64_t *directories[4];
+	memset(pdpt, 0, 4096);
+	for (int i = 0; i < 4; i++)
 	{
-		for (int k = j; k < 1024; k++)
-		{
-			if (pt->entry[k] != 0)
-			{
-				LOG_WARNING("Memory region mappign to region %x was blocked by other allocation %x.",
-							ret,
-							pt->entry[k]);
-				return 0;
-			}
-		}
+		directories[i] = (uint64_t *)_pool_take();
+		memset(directories[i], 0, 4096);
+		pdpt[i] = (uint32_t)directories[i] | 1;
 	}
 
-	if (count > 1)
+	for (int i = 0; i < legacy_count * 2; i++)
 	{
-		for (int k = i + 1; k < i + count; k++)
+		uint32_t pde	= page_directory[i / 2];
+		uint32_t offset = (i % 2) * 512;
+		if (!(pde & 1))
 		{
-			if (!(page_directory[k] & 0xfffff000))
-				continue;
+			continue;
+		}
 
-			pt = (struct PageTable *)(page_directory[k] & 0xfffff000);
-			for (int l = 0; l < 1024; l++)
-			{
-				if (pt->entry[l] != 0)
-				{
-					LOG_WARNING("Memory region mapping to region %x was blocked by other allocation %x.",
-								ret,
-								pt->entry[l]);
-					return 0;
-				}
-			}
+		// A 4 MiB page becomes two 2 MiB pages with the same flags
+		if (pde & PAGE_FLAG_SIZE_4MIB)
+		{
+			directories[i / 512][i % 512] = pde + offset * 4096;
+			continue;
+		}
+
+		uint64_t *table = (uint64_t *)_pool_take();
+		for (int j = 0; j < 512; j++)
+		{
+			table[j] = _table_at(i / 2)[offset + j];
 		}
+		directories[i / 512][i % 512] = (uint32_t)table | (pde & 0xfff);
 	}
 
-	return ret;
+	for (int i = 0; i < 4; i++)
+	{
+		directories[3][PAE_RECURSIVE_INDEX % 512 + i] = (uint32_t)directories[i] | PAGE_FLAG_READ_WRITE | 1;
+	}
+
+	// The NX bit is only valid once it has been turned on, so it can be used from here on
+	if (cpuid_supports_feature(CPU_FEATURE_NO_EXECUTE, 2))
+	{
+		__enable_nx();
+		ptcfg.data_flags = PAE_NO_EXECUTE;
+	}
+
+	__enable_pae((uint32_t)pdpt);
+	ptcfg.current_space		= (uint32_t)pdpt;
+	ptcfg.pae				= true;
+	ptcfg.large_page_shift	= PAE_LARGE_PAGE_SHIFT;
+	ptcfg.large_page_size	= 1 << PAE_LARGE_PAGE_SHIFT;
+	ptcfg.recursive_address = PAE_RECURSIVE_VIRTUAL_ADDRESS;
+
+	// Directory entries always point to 2 MiB pages when they aren't tables
+	ptcfg.large_pages = true;
+	LOG_INFO("Switched to PAE paging%s.", ptcfg.data_flags ? " with the NX bit" : "");
+	return true;
 }
 
-void paging_initialize(uint32_t *p_phys_mem_start)
+void paging_initialize(uint32_t *p_phys_mem_start, bool p_use_pae)
 {
-	config->available_space	 = PAGE_TABLE_MEMORY_SIZE;
-	config->available_tables = PAGE_TABLE_COUNT;
-	config->next_free		 = allocated_tables;
+	ptcfg.large_page_shift	= LEGACY_LARGE_PAGE_SHIFT;
+	ptcfg.large_page_size	= 1 << LEGACY_LARGE_PAGE_SHIFT;
+	ptcfg.recursive_address = RECURSIVE_MAP_VIRTUAL_ADDRESS;
+	ptcfg.current_space		= (uint32_t)page_directory;
+
+	// Read-only pages have to stop the kernel too, or it could write straight through a copy-on-write page
+	__enable_write_protect();
+
+	// Point the last directory entry back at the directory, so that page tables can be reached wherever they are. The
+	// directory is linked into the identity-mapped start of the kernel, so its address is already physical.
+	page_directory[1023] = (uint32_t)page_directory | PAGE_FLAG_READ_WRITE | 1;
+	__tlb_flush((void *)RECURSIVE_MAP_VIRTUAL_ADDRESS);
+
+	// Hand out the lowest tables of the boot-time pool first
+	for (int i = 0; i < PAGE_TABLE_COUNT; i++)
+	{
+		ptcfg.pool_free[i] = PAGE_TABLE_COUNT - 1 - i;
+	}
+	ptcfg.pool_count = PAGE_TABLE_COUNT;
+
+	// 4 MiB pages let large mappings skip page tables entirely, and take up a single TLB entry
+	if (cpuid_supports_feature(CPU_FEATURE_PAGE_SIZE_EXT, 1))
+	{
+		__enable_pse();
+		ptcfg.large_pages = true;
+	}
+
+	// NOTE: This is the first memory address available after the end of the kernel, which the linker aligns to 4 KiB.
+	uint32_t kernel_end	 = (uint32_t)&__end;
+	uint32_t kernel_base = KERNEL_VIRTUAL_ADDRESS & 0xffc00000;
+	uint16_t kernel_pde	 = KERNEL_VIRTUAL_ADDRESS >> 22;
+
+	// Swap the kernel's page table for a single 4 MiB page. Memory past the end of the kernel is covered by the page
+	// too, so allocations can only start at the next 4 MiB boundary.
+	if (ptcfg.large_pages && kernel_end - kernel_base <= ptcfg.large_page_size)
+	{
+		uint32_t physical		   = KERNEL_PHYSICAL_ADDRESS & 0xffc00000;
+		page_directory[kernel_pde] = physical | PAGE_FLAG_SIZE_4MIB | PAGE_FLAG_READ_WRITE | 1;
+		__reload_cr3();
+		kernel_end = kernel_base + ptcfg.large_page_size;
+	}
+
+	// Global pages stay in the TLB when CR3 is reloaded. They are only used for mappings that last forever (the kernel
+	// and the direct map), so that a reload can't leave stale entries behind.
+	if (cpuid_supports_feature(CPU_FEATURE_PAGE_GLOB_ENABLE, 1))
+	{
+		if (page_directory[kernel_pde] & PAGE_FLAG_SIZE_4MIB)
+		{
+			page_directory[kernel_pde] |= PAGE_FLAG_GLOBAL;
+		}
+
+		__enable_pge();
+		ptcfg.global_pages = true;
+	}
+
+	// PAE is only worth its bigger tables when there is memory above 4 GiB for it to reach
+	if (p_use_pae && cpuid_supports_feature(CPU_FEATURE_PHYS_ADDR_EXT, 1))
+	{
+		_pae_enable();
+	}
+
+	vmem_initialize(kernel_end);
+
+	if (ptcfg.pae)
+	{
+		// The PAE tables take up the 4 MiB below the usual recursive mapping too
+		vmem_claim(PAE_RECURSIVE_VIRTUAL_ADDRESS, RECURSIVE_MAP_VIRTUAL_ADDRESS - PAE_RECURSIVE_VIRTUAL_ADDRESS);
+	}
 
-	// NOTE: This is the first (non-aligned) memory address available after the end of the kernel.
-	config->kernel_vmem_start = (uint32_t)&__end;
-	config->user_vmem_start	  = USER_ALLOC_VIRTUAL_ADDRESS;
+	// Aligned to its own size, so the window never spans two tables
+	uint32_t window_size = HIGH_WINDOW_PAGES * 4096;
+	ptcfg.high_window	 = vmem_reserve(VMEM_SPACE_KERNEL, window_size, window_size);
+
+	// Reserved regions are backed as they are touched, so page faults are no longer always fatal
+	register_interrupt_handler(INT_PAGE_FLT, _page_fault_handler);
+
+	// The 4 MiB page already covers the hole
+	if (kernel_end != (uint32_t)&__end)
+	{
+		return;
+	}
 
 	uint32_t additional_mem_size = KERNEL_VIRTUAL_ADDRESS - 0xc00f0000;
 	if (!paging_map_region(*p_phys_mem_start, 0xc00f0000, additional_mem_size))
@@ -244,202 +554,1466 @@ void paging_initialize(uint32_t *p_phys_mem_start)
 	*p_phys_mem_start += additional_mem_size;
 }
 
-bool paging_map_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
+/**
+ * @brief Records a mapping of known physical memory, so that `physical_to_virtual()` can find it again. Mappings that
+ * continue on from the last one are merged with it.
+ * @param p_physical The physical address the mapping starts at
+ * @param p_virtual The virtual address the mapping starts at
+ * @param p_size The number of bytes mapped
+ */
+void _reverse_index_add(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
 {
-	// Already mapped, no need to remap
-	if (is_valid_range(p_virtual, p_virtual + p_size))
+	// Memory in the direct map can already be found from its address
+	if (p_physical + p_size <= ptcfg.direct_map_size)
 	{
-		return true;
+		return;
 	}
 
-	int directory_count = _get_directory_count(p_virtual, p_size);
-	uint16_t page_index = (p_virtual & 0xffc00000) >> 22;
-
-	for (int i = 0; i < directory_count; i++)
+	if (ptcfg.reverse_count > 0)
 	{
-		struct PageTable *table = NULL;
-
-		// Page index is unused, allocate a page index
-		if (!(page_directory[page_index + i] & 1))
-		{
-			if (used_table_count >= PAGE_TABLE_COUNT)
-			{
-				LOG_ERROR("Number of tables used now exceeds the valid page table count. The mapped memory may not be "
-						  "entirely usable.s");
-				return false;
-			}
-
-			// Need a new table, get one
-			table = _alloc_new_table();
-		}
-		else
+		struct ReverseMapping *last = &ptcfg.reverse_index[ptcfg.reverse_count - 1];
+		if (last->physical + last->size == p_physical && last->virtual + last->size == p_virtual)
 		{
-			// Flush TLB to update after availability changes
-			__tlb_flush((void *)p_virtual);
-			table = (struct PageTable *)(page_directory[page_index + i] & 0xfffff000);
+			last->size += p_size;
+			return;
 		}
+	}
 
-		if (!table)
-		{
-			LOG_ERROR(
-				"No available page tables for mapping memory. The mapped memory range may not be entirely usable."
-			);
-			return false;
-		}
+	if (ptcfg.reverse_count == REVERSE_INDEX_SIZE)
+	{
+		LOG_WARNING("Reverse index is full, mapping of %x to %x can't be found from its physical address.",
+					p_physical,
+					p_virtual);
+		return;
+	}
 
-		uint16_t table_start = 0;
-		uint16_t table_end	 = 1024;
-		if (i == 0)
+	struct ReverseMapping *mapping = &ptcfg.reverse_index[ptcfg.reverse_count++];
+	mapping->physical			   = p_physical;
+	mapping->virtual			   = p_virtual;
+	mapping->size				   = p_size;
+}
+
+/**
+ * @brief Forgets every recorded mapping that starts within a region that is being unmapped.
+ * @param p_virtual The virtual address of the region
+ * @param p_size The size of the region in bytes
+ */
+void _reverse_index_remove(uint32_t p_virtual, uint32_t p_size)
+{
+	for (int i = ptcfg.reverse_count - 1; i >= 0; i--)
+	{
+		if (ptcfg.reverse_index[i].virtual - p_virtual < p_size)
 		{
-			table_start = ((uint32_t)p_virtual & 0x003ff000) >> 12;
+			ptcfg.reverse_index[i] = ptcfg.reverse_index[--ptcfg.reverse_count];
 		}
+	}
+}
 
-		if (i == directory_count - 1)
+/**
+ * @brief Finds where a region starting at an address sits in the sorted table of reserved regions.
+ * @param p_virtual The address to look for
+ * @return The index of the first region that starts at or after the address.
+ */
+static uint16_t _lazy_region_search(uint32_t p_virtual)
+{
+	uint16_t low  = 0;
+	uint16_t high = ptcfg.lazy_count;
+	while (low < high)
+	{
+		uint16_t middle = (low + high) / 2;
+		if (ptcfg.lazy_regions[middle].start < p_virtual)
 		{
-			// End of table must be 1 less than the full size as here we map 4096 bytes INCLUDING byte 0.
-			table_end = ceil((((uint32_t)p_virtual + p_size - 1) % 0x400000), 4096);
-			table_end = (table_end > 1024) ? 1024 : table_end;
+			low = middle + 1;
 		}
-
-		for (int j = table_start; j < table_end; j++, p_physical += 4096)
+		else
 		{
-			if (table->entry[j] != 0)
-			{
-				LOG_ERROR("Table entry found within memory region range. The mapped memory range may not be entirely "
-						  "usable.");
-				return false;
-			}
-
-			uint32_t ptr	= (p_physical & 0xfffff000) | 3;
-			table->entry[j] = ptr;
+			high = middle;
 		}
-
-		uint32_t pt_phys = virtual_to_physical((uint32_t)table);
-		uint32_t pde	 = ((uint32_t)pt_phys & 0xfffff000) | 3;
-
-		// Set PDE here to avoid invalid entries
-		page_directory[page_index + i] = pde;
 	}
 
-	return true;
+	return low;
 }
 
-void *paging_allocate_region(uint32_t p_address, uint32_t p_size)
+/**
+ * @brief Records a reserved region, so that the page fault handler can back its pages once they are touched.
+ * @param p_virtual The virtual address the region starts at
+ * @param p_size The number of bytes in the region
+ * @param p_policy What to do when a page of the region is touched
+ * @param p_large Whether whole blocks of the region should be backed by large pages
+ * @return `true` if the region was recorded, and `false` if there is no room left for it.
+ */
+bool _lazy_region_add(uint32_t p_virtual, uint32_t p_size, PagingPolicy p_policy, bool p_large)
 {
-	uint32_t virtual = physical_to_virtual(p_address);
-	if (virtual && is_valid_range(virtual, virtual + p_size))
+	if (ptcfg.lazy_count == LAZY_REGION_COUNT)
 	{
-		LOG_WARNING("Requested region %x is already mapped to virtual memory.", p_address);
-		return (void *)virtual;
+		LOG_WARNING("Lazy region table is full, region at %x can't be backed on demand.", p_virtual);
+		return false;
 	}
 
-	// Look out for the next valid address
-	virtual = find_next_free_region(p_size);
-	if (!virtual)
+	// Regions never overlap, so keeping them in order of their start keeps them in order of their end too
+	uint16_t index = _lazy_region_search(p_virtual);
+	for (uint16_t i = ptcfg.lazy_count++; i > index; i--)
 	{
-		return NULL;
+		ptcfg.lazy_regions[i] = ptcfg.lazy_regions[i - 1];
 	}
 
-	if (!paging_map_region(p_address, virtual, p_size))
+	struct LazyRegion *region = &ptcfg.lazy_regions[index];
+	region->start			  = p_virtual;
+	region->size			  = p_size;
+	region->policy			  = p_policy;
+	region->large			  = p_large;
+	if (p_policy == PAGING_POLICY_SWAPPABLE)
+	{
+		ptcfg.swappable_size += p_size;
+	}
+	return true;
+}
+
+/**
+ * @brief Finds the reserved region that a virtual address falls in.
+ * @param p_virtual The virtual address to look for
+ * @return The region, or `NULL` if the address isn't part of one.
+ */
+struct LazyRegion *_lazy_region_find(uint32_t p_virtual)
+{
+	// Only the last region starting at or before the address can hold it
+	uint16_t index = _lazy_region_search(p_virtual + 1);
+	if (!index)
 	{
 		return NULL;
 	}
 
-	return (void *)virtual;
+	struct LazyRegion *region = &ptcfg.lazy_regions[index - 1];
+	return (p_virtual - region->start < region->size) ? region : NULL;
 }
 
-void paging_free_region(uint32_t p_virtual, uint32_t p_size)
+/**
+ * @brief Takes a range of addresses out of every reserved region it overlaps. Regions are trimmed to whatever is left
+ * on either side of the range, and dropped once nothing is.
+ * @param p_virtual The virtual address of the range
+ * @param p_size The size of the range in bytes
+ */
+void _lazy_region_remove(uint32_t p_virtual, uint32_t p_size)
 {
-	int directory_count = _get_directory_count(p_virtual, p_size);
+	uint32_t end = p_virtual + p_size;
 
-	for (int i = 0; i < directory_count; i++)
+	// The regions the range overlaps sit next to each other in the table, starting with the one holding its start
+	uint16_t i = _lazy_region_search(p_virtual);
+	if (i && p_virtual - ptcfg.lazy_regions[i - 1].start < ptcfg.lazy_regions[i - 1].size)
 	{
-		uint16_t page_index		= (p_virtual & 0xffc00000) >> 22;
-		struct PageTable *table = (struct PageTable *)(page_directory[page_index + i] & 0xfffff000);
-		page_directory[page_index + i] &= 2; // Clear all bits except bit 1 (r/w bit)
+		i--;
+	}
 
-		uint16_t table_start = 0;
-		uint16_t table_end	 = 1024;
+	while (i < ptcfg.lazy_count && ptcfg.lazy_regions[i].start < end)
+	{
+		struct LazyRegion *region = &ptcfg.lazy_regions[i];
+		uint32_t region_end		  = region->start + region->size;
+		uint32_t head			  = (p_virtual > region->start) ? p_virtual - region->start : 0;
+		uint32_t tail			  = (region_end > end) ? region_end - end : 0;
+		bool swappable = region->policy == PAGING_POLICY_SWAPPABLE;
+		if (swappable)
+		{
+			ptcfg.swappable_size -= region->size - head - tail;
+		}
+
+		if (head && tail)
+		{
+			// The range was inside this one region, so nothing after it is affected. The tail is counted again once
+			// it is a region of its own.
+			region->size = head;
+			if (swappable)
+			{
+				ptcfg.swappable_size -= tail;
+			}
+			if (!_lazy_region_add(end, tail, region->policy, region->large))
+			{
+				LOG_ERROR("Region at %x lost the rest of its addresses from %x.", region->start, end);
+			}
+			return;
+		}
+		else if (head)
+		{
+			region->size = head;
+		}
+		else if (tail)
+		{
+			region->start = end;
+			region->size  = tail;
+		}
+		else
+		{
+			ptcfg.lazy_count--;
+			for (uint16_t j = i; j < ptcfg.lazy_count; j++)
+			{
+				ptcfg.lazy_regions[j] = ptcfg.lazy_regions[j + 1];
+			}
+			continue;
+		}
+
+		i++;
+	}
+}
+
+/**
+ * @brief Gets the swap slot that holds a page which was swapped out.
+ * @param p_virtual The address of the page
+ * @return The slot, or 0 if the page isn't in swap.
+ */
+static uint32_t _swap_slot_at(uint32_t p_virtual)
+{
+	uint64_t pde = _entry_get(_dir_slot(_dir_index(p_virtual)));
+	if (!(pde & 1) || (pde & PAGE_FLAG_SIZE_4MIB))
+	{
+		return 0;
+	}
+
+	uint64_t entry = _entry_get(_entry_slot(p_virtual));
+	return (!(entry & 1) && (entry & PAGE_FLAG_SWAPPED)) ? (uint32_t)(entry >> 12) : 0;
+}
+
+/**
+ * @brief Finds the next swappable region after another one, going back to the start of the table after the last.
+ * @param p_region The region to start after, or `NULL` to start from the first.
+ * @return The next swappable region, which may be `p_region` itself, or `NULL` if there are none.
+ */
+static struct LazyRegion *_swap_next_region(struct LazyRegion *p_region)
+{
+	int start = p_region ? p_region - ptcfg.lazy_regions + 1 : 0;
+	for (int i = 0; i < ptcfg.lazy_count; i++)
+	{
+		struct LazyRegion *region = &ptcfg.lazy_regions[(start + i) % ptcfg.lazy_count];
+		if (region->policy == PAGING_POLICY_SWAPPABLE)
+		{
+			return region;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Writes a page of a swappable region out to swap and frees its frame. Pages are picked by the CLOCK algorithm:
+ * the hand sweeps over every swappable page in turn, and a page that has been accessed since the hand last passed it
+ * has its accessed bit cleared and is given a second chance, so only pages that have gone cold are evicted.
+ * @return `true` if a frame was freed, and `false` if swap is off or full, or there is nothing left to evict.
+ */
+static bool _swap_out_page()
+{
+	if (!swap_get_free_slots())
+	{
+		return false;
+	}
+
+	uint32_t page_count = ptcfg.swappable_size / 4096;
+
+	// The first sweep clears every accessed bit it passes, so the second is sure to find a page if there is one
+	for (uint32_t i = 0; i < 2 * page_count; i++)
+	{
+		struct LazyRegion *region = _lazy_region_find(ptcfg.clock_hand);
+		if (!region || region->policy != PAGING_POLICY_SWAPPABLE)
+		{
+			region			 = _swap_next_region(NULL);
+			ptcfg.clock_hand = region->start;
+		}
+
+		uint32_t page = ptcfg.clock_hand;
+		ptcfg.clock_hand += 4096;
+		if (ptcfg.clock_hand - region->start >= region->size)
+		{
+			ptcfg.clock_hand = _swap_next_region(region)->start;
+		}
+
+		uint64_t pde = _entry_get(_dir_slot(_dir_index(page)));
+		if (!(pde & 1) || (pde & PAGE_FLAG_SIZE_4MIB))
+		{
+			continue;
+		}
+
+		uint32_t *slot = _entry_slot(page);
+		uint64_t entry = _entry_get(slot);
+		if (!(entry & 1) || (entry & PAGE_FLAG_COPY_ON_WRITE))
+		{
+			continue;
+		}
+
+		if (entry & PAGE_FLAG_ACCESSED)
+		{
+			_entry_set(slot, entry & ~(uint64_t)PAGE_FLAG_ACCESSED);
+			__tlb_flush((void *)page);
+			continue;
+		}
+
+		uint32_t swap_slot = swap_write_page((void *)page);
+		if (!swap_slot)
+		{
+			return false;
+		}
+
+		_entry_set(slot, ((uint64_t)swap_slot << 12) | PAGE_FLAG_SWAPPED);
+		__tlb_flush((void *)page);
+		physical_free_pages(entry & ENTRY_ADDRESS_MASK, 1);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Checks whether pages can be moved to or from swap right now. Transfers wait for the drive's interrupt, which
+ * never arrives while interrupts are off, and can't arrive inside the handler of another interrupt before it ends.
+ * Page faults are handled with interrupts off, so for those it is the code that faulted that counts.
+ * @return `true` if swap can be used, and `false` if not.
+ */
+static bool _swap_is_usable()
+{
+	uint32_t flags = ptcfg.handling_fault ? ptcfg.fault_flags : interrupts_save();
+	return flags & EFLAGS_INTERRUPT_ENABLE;
+}
+
+/**
+ * @brief Allocates a single frame. Once physical memory runs out, cold pages are swapped out to make room for it.
+ * @return The physical address of the frame, or 0 if there is no memory left and nothing can be swapped out.
+ */
+static uint32_t _alloc_frame()
+{
+	uint32_t frame = physical_alloc_pages(1);
+	while (!frame && _swap_is_usable() && _swap_out_page())
+	{
+		frame = physical_alloc_pages(1);
+	}
+
+	return frame;
+}
+
+/**
+ * @brief Backs the page of a zero-filled or swappable region that holds an address with a new frame, which is read
+ * back in from swap if the page was swapped out. Whole blocks of large regions get a single large page instead, so
+ * that they still only take up one TLB entry.
+ * @param p_region The region the address belongs to
+ * @param p_virtual The address to back
+ * @return `true` if the address is now backed, and `false` if there is no memory left to back it with or the page
+ * couldn't be read back in.
+ */
+bool _lazy_region_back(struct LazyRegion *p_region, uint32_t p_virtual)
+{
+	uint32_t size  = ptcfg.large_page_size;
+	uint32_t block = p_virtual & ~(size - 1);
+	if (p_region->large && ptcfg.large_pages && block >= p_region->start &&
+		block - p_region->start + size <= p_region->size && !(_entry_get(_dir_slot(_dir_index(block))) & 1))
+	{
+		uint32_t frame = physical_alloc_order(_large_page_order());
+		if (frame && _map_large_page(frame, block, 0))
+		{
+			memset((void *)block, 0, size);
+			return true;
+		}
+
+		if (frame)
+		{
+			physical_free_order(frame, _large_page_order());
+		}
+	}
+
+	uint32_t page = p_virtual & 0xfffff000;
+	if (_swap_slot_at(page) && !_swap_is_usable())
+	{
+		LOG_ERROR("Page %x is in swap, and can't be read back in with interrupts disabled.", page);
+		return false;
+	}
+
+	uint32_t frame = physical_alloc_zeroed_page();
+	bool zeroed	   = frame != 0;
+	if (!frame)
+	{
+		frame = _alloc_frame();
+	}
+
+	if (!frame)
+	{
+		return false;
+	}
+
+	// A page that was swapped out keeps its slot in the entry until it is read back in
+	uint32_t slot = _swap_slot_at(page);
+	if (slot)
+	{
+		_entry_set(_entry_slot(page), 0);
+	}
+
+	if (!_map_region(frame, page, 4096))
+	{
+		physical_free_pages(frame, 1);
+		if (slot)
+		{
+			_entry_set(_entry_slot(page), ((uint64_t)slot << 12) | PAGE_FLAG_SWAPPED);
+		}
+		return false;
+	}
+
+	// The entry wasn't present before, so there is nothing in the TLB to invalidate
+	if (slot)
+	{
+		if (!swap_read_page(slot, (void *)page))
+		{
+			return false;
+		}
+		swap_free_slot(slot);
+	}
+	else if (!zeroed)
+	{
+		memset((void *)page, 0, 4096);
+	}
+	return true;
+}
+
+/**
+ * @brief Gives a page that is shared copy-on-write a frame of its own, after something has written to it. The last
+ * address space to write to a frame gets to keep it.
+ * @param p_virtual The address that was written to
+ * @return `true` if the page is now writable and the write can be retried, and `false` if it isn't copy-on-write.
+ */
+bool _copy_on_write(uint32_t p_virtual)
+{
+	uint64_t pde = _entry_get(_dir_slot(_dir_index(p_virtual)));
+	if (!(pde & 1) || (pde & PAGE_FLAG_SIZE_4MIB))
+	{
+		return false;
+	}
+
+	uint32_t *slot = _entry_slot(p_virtual);
+	uint64_t entry = _entry_get(slot);
+	if (!(entry & 1) || !(entry & PAGE_FLAG_COPY_ON_WRITE))
+	{
+		return false;
+	}
+
+	uint32_t page  = p_virtual & 0xfffff000;
+	uint32_t frame = entry & ENTRY_ADDRESS_MASK;
+	uint64_t flags = (entry & ~ENTRY_ADDRESS_MASK & ~(uint64_t)PAGE_FLAG_COPY_ON_WRITE) | PAGE_FLAG_READ_WRITE;
+
+	// Only frames the allocator owns are ever shared this way, so anything else was never meant to be written
+	if (!physical_owns_page(frame))
+	{
+		LOG_ERROR("Page %x is marked copy-on-write, but its frame %x isn't owned by the allocator.", page, frame);
+		return false;
+	}
+
+	if (physical_get_page_shares(frame))
+	{
+		uint32_t copy = _alloc_frame();
+		if (!copy)
+		{
+			LOG_FATAL("Ran out of physical memory copying page %x.", page);
+			return false;
+		}
+
+		// Frames past the end of the direct map are copied into through the window instead
+		void *dest	= (void *)physical_to_virtual(copy);
+		bool window = !dest;
+		if (window)
+		{
+			dest = paging_map_high_page(copy);
+		}
+
+		if (!dest)
+		{
+			LOG_ERROR("Unable to map frame %x to copy page %x into.", copy, page);
+			physical_free_pages(copy, 1);
+			return false;
+		}
+
+		memcpy(dest, (void *)page, 4096);
+		if (window)
+		{
+			paging_unmap_high_page(dest);
+		}
+
+		physical_release_page(frame);
+		frame = copy;
+	}
+
+	_entry_set(slot, frame | flags);
+	__tlb_flush((void *)page);
+	return true;
+}
+
+/**
+ * @brief Backs or copies the page that a fault was raised on, for `_page_fault_handler()`.
+ * @param p_regs The registers at the time of the fault
+ * @return `true` if the access can be retried, and `false` if not.
+ */
+static bool _page_fault_resolve(struct Registers *p_regs)
+{
+	uint32_t address = __read_cr2();
+
+	// Writes to pages shared with another address space are fine from either mode, and just need a copy of the page
+	if ((p_regs->error & PAGE_FAULT_PRESENT) && (p_regs->error & PAGE_FAULT_WRITE) && _copy_on_write(address))
+	{
+		return true;
+	}
+
+	struct LazyRegion *region = _lazy_region_find(address);
+
+	// Only the kernel touching a page that isn't there yet can be fixed
+	if (!region || (p_regs->error & (PAGE_FAULT_PRESENT | PAGE_FAULT_USER)))
+	{
+		LOG_ERROR("Page fault on address %x at instruction %x.", address, p_regs->eip);
+		return false;
+	}
+
+	if (region->policy == PAGING_POLICY_GUARD)
+	{
+		LOG_ERROR("Guard page at %x of region %x was touched at instruction %x.", address, region->start, p_regs->eip);
+		return false;
+	}
+
+	if (region->policy == PAGING_POLICY_PANIC)
+	{
+		LOG_FATAL("Reserved region at %x was touched at %x.", region->start, address);
+		return false;
+	}
+
+	if (!_lazy_region_back(region, address))
+	{
+		LOG_FATAL("Ran out of physical memory backing address %x.", address);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Handles page faults on reserved regions of kernel memory. Zero-filled regions are backed a page at a time as
+ * they are touched, swapped out pages are read back in, and anything else is left for the default handler to report.
+ * @param p_regs The registers at the time of the fault
+ * @return `true` if the page was backed and the access can be retried, and `false` if not.
+ */
+bool _page_fault_handler(struct Registers *p_regs)
+{
+	// Frames are taken on behalf of the code that faulted, which decides whether swap can be used to find them
+	bool handling_fault	 = ptcfg.handling_fault;
+	uint32_t fault_flags = ptcfg.fault_flags;
+	ptcfg.handling_fault = true;
+	ptcfg.fault_flags	 = p_regs->eflags;
+
+	bool ret			 = _page_fault_resolve(p_regs);
+	ptcfg.handling_fault = handling_fault;
+	ptcfg.fault_flags	 = fault_flags;
+	return ret;
+}
+
+bool paging_map_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
+{
+	// The caller has picked the address, so make sure it is never handed out for anything else
+	vmem_claim(p_virtual, p_size);
+
+	if (!_map_region(p_physical, p_virtual, p_size))
+	{
+		return false;
+	}
+
+	_reverse_index_add(p_physical, p_virtual, p_size);
+	return true;
+}
+
+/**
+ * @brief Maps a range of physical memory to a virtual address with 4 KiB pages, without recording it in the reverse
+ * index. Used directly for frames from the physical allocator, which are found through the direct map instead.
+ * @param p_physical The physical starting memory address
+ * @param p_virtual The desired virtual starting memory address
+ * @param p_size The number of bytes to map
+ * @return `true` if the range was mapped, and `false` if not.
+ */
+bool _map_region(uint64_t p_physical, uint32_t p_virtual, uint32_t p_size)
+{
+	// Already mapped, no need to remap
+	if (is_valid_range(p_virtual, p_virtual + p_size))
+	{
+		return true;
+	}
+
+	uint32_t block		= ptcfg.large_page_size;
+	uint16_t entries	= block >> 12;
+	int directory_count = _get_directory_count(p_virtual, p_size);
+	uint16_t page_index = _dir_index(p_virtual);
+
+	for (int i = 0; i < directory_count; i++)
+	{
+		uint64_t pde = _entry_get(_dir_slot(page_index + i));
+
+		// Page index is unused, allocate a page index
+		if (!(pde & 1))
+		{
+			if (!_alloc_table(page_index + i))
+			{
+				LOG_ERROR("No memory left for page tables. The mapped memory range may not be entirely usable.");
+				return false;
+			}
+		}
+		else if (pde & PAGE_FLAG_SIZE_4MIB)
+		{
+			LOG_ERROR("Memory region at %x is already mapped by a large page.",
+					  (page_index + i) << ptcfg.large_page_shift);
+			return false;
+		}
+
+		uint32_t table_base = (uint32_t)(page_index + i) << ptcfg.large_page_shift;
+
+		uint16_t table_start = 0;
+		uint16_t table_end	 = entries;
+		if (i == 0)
+		{
+			table_start = (p_virtual & (block - 1)) >> 12;
+		}
+
+		if (i == directory_count - 1)
+		{
+			// End of table must be 1 less than the full size as here we map 4096 bytes INCLUDING byte 0.
+			table_end = ceil(((p_virtual + p_size - 1) % block), 4096);
+			table_end = (table_end > entries) ? entries : table_end;
+		}
+
+		for (int j = table_start; j < table_end; j++, p_physical += 4096)
+		{
+			uint32_t *entry = _entry_slot(table_base | (j << 12));
+			if (_entry_get(entry) != 0)
+			{
+				LOG_ERROR("Table entry found within memory region range. The mapped memory range may not be entirely "
+						  "usable.");
+				return false;
+			}
+
+			_entry_set(entry, (p_physical & ENTRY_ADDRESS_MASK) | ptcfg.data_flags | 3);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Maps N bytes of newly allocated page frames to the given virtual address. Frames are taken in blocks of up to
+ * 4 MiB, so the region is only physically contiguous within each block.
+ * @param p_virtual The virtual address to map the frames to. Nothing may be mapped in the range yet.
+ * @param p_size The number of bytes to allocate
+ * @return `true` if the whole range was mapped, and `false` if not, in which case nothing is left mapped.
+ */
+bool _map_new_frames(uint32_t p_virtual, uint32_t p_size)
+{
+	uint32_t page_count = ceil(p_size, 4096);
+	uint32_t mapped		= 0;
+	while (mapped < page_count)
+	{
+		uint32_t count	= AMIN(page_count - mapped, 1024);
+		uint32_t frames = physical_alloc_pages(count);
+
+		// Once memory is short, make do with single frames, which swapping pages out can make room for
+		if (!frames)
+		{
+			count  = 1;
+			frames = _alloc_frame();
+		}
+
+		if (!frames)
+		{
+			LOG_ERROR("Ran out of physical memory.");
+			break;
+		}
+
+		if (!_map_region(frames, p_virtual + mapped * 4096, count * 4096))
+		{
+			physical_free_pages(frames, count);
+			break;
+		}
+		mapped += count;
+	}
+
+	if (mapped == page_count)
+	{
+		return true;
+	}
+
+	// Undo the blocks that did get mapped
+	for (uint32_t i = 0; i < mapped; i++)
+	{
+		physical_free_pages(virtual_to_physical(p_virtual + i * 4096), 1);
+	}
+	if (mapped)
+	{
+		_unmap_region(p_virtual, mapped * 4096);
+	}
+	return false;
+}
+
+void *paging_allocate_region(uint32_t p_address, uint32_t p_size)
+{
+	// No physical address given, so take the frames from the physical allocator
+	if (!p_address)
+	{
+		uint32_t virtual = vmem_reserve(VMEM_SPACE_KERNEL, p_size, 0);
+		if (!virtual)
+		{
+			LOG_ERROR("Unable to find %u bytes of free virtual memory.", p_size);
+			return NULL;
+		}
+
+		if (!_map_new_frames(virtual, p_size))
+		{
+			vmem_release(virtual, p_size);
+			return NULL;
+		}
+		return (void *)virtual;
+	}
+
+	uint32_t virtual = physical_to_virtual(p_address);
+	if (virtual && is_valid_range(virtual, virtual + p_size))
+	{
+		LOG_WARNING("Requested region %x is already mapped to virtual memory.", p_address);
+		return (void *)virtual;
+	}
+
+	// Look out for the next valid address
+	virtual = vmem_reserve(VMEM_SPACE_KERNEL, p_size, 0);
+	if (!virtual)
+	{
+		LOG_ERROR("Unable to find %u bytes of free virtual memory.", p_size);
+		return NULL;
+	}
+
+	if (!paging_map_region(p_address, virtual, p_size))
+	{
+		vmem_release(virtual, p_size);
+		return NULL;
+	}
+
+	return (void *)virtual;
+}
+
+/**
+ * @brief Reserves a range of kernel virtual memory that the page fault handler backs as it is touched. Zero-filled
+ * and swappable regions that can't be recorded are backed straight away instead, and are never swapped out.
+ * @param p_size The number of bytes to reserve
+ * @param p_alignment The alignment of the range as a power of 2, or 0 for 4 KiB.
+ * @param p_policy What to do when a page of the region is touched
+ * @param p_large Whether whole blocks of the region should be backed by large pages
+ * @return The virtual address of the region, or `NULL` if it could not be reserved.
+ */
+void *_reserve_lazy_region(uint32_t p_size, uint32_t p_alignment, PagingPolicy p_policy, bool p_large)
+{
+	uint32_t virtual = vmem_reserve(VMEM_SPACE_KERNEL, p_size, p_alignment);
+	if (!virtual)
+	{
+		LOG_ERROR("Unable to find %u bytes of free virtual memory.", p_size);
+		return NULL;
+	}
+
+	if (_lazy_region_add(virtual, ceil(p_size, 4096) * 4096, p_policy, p_large))
+	{
+		return (void *)virtual;
+	}
+
+	bool zero_fill = p_policy == PAGING_POLICY_ZERO_FILL || p_policy == PAGING_POLICY_SWAPPABLE;
+	if (zero_fill && _map_new_frames(virtual, p_size))
+	{
+		memset((void *)virtual, 0, p_size);
+		return (void *)virtual;
+	}
+
+	vmem_release(virtual, p_size);
+	return NULL;
+}
+
+void *paging_reserve_region(uint32_t p_size, PagingPolicy p_policy)
+{
+	return _reserve_lazy_region(p_size, 0, p_policy, false);
+}
+
+bool paging_commit_region(uint32_t p_virtual, uint32_t p_size)
+{
+	for (uint32_t page = p_virtual & 0xfffff000; page < p_virtual + p_size; page += 4096)
+	{
+		if (virtual_to_physical(page))
+		{
+			continue;
+		}
+
+		struct LazyRegion *region = _lazy_region_find(page);
+		if (!region || region->policy != PAGING_POLICY_ZERO_FILL || !_lazy_region_back(region, page))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool paging_extend_region(uint32_t p_virtual, uint32_t p_size)
+{
+	if (p_virtual + p_size < p_virtual)
+	{
+		return false;
+	}
+
+	// Only addresses that nothing else has reserved can be grown into
+	if (!vmem_reserve_at(p_virtual, p_size))
+	{
+		return false;
+	}
+
+	// A region that is backed on demand grows the same way
+	struct LazyRegion *region = _lazy_region_find(p_virtual - 1);
+	if (region && region->start + region->size == p_virtual)
+	{
+		region->size += ceil(p_size, 4096) * 4096;
+		if (region->policy == PAGING_POLICY_SWAPPABLE)
+		{
+			ptcfg.swappable_size += ceil(p_size, 4096) * 4096;
+		}
+		return true;
+	}
+
+	if (!_map_new_frames(p_virtual, p_size))
+	{
+		vmem_release(p_virtual, p_size);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Checks whether a range lies entirely inside one reserved region, so that any of its pages can be left without
+ * a frame and be backed again once touched.
+ * @param p_virtual The virtual address of the range
+ * @param p_size The size of the range in bytes
+ * @return `true` if the range is part of a single reserved region, and `false` if not.
+ */
+static bool _lazy_region_covers(uint32_t p_virtual, uint32_t p_size)
+{
+	struct LazyRegion *region = _lazy_region_find(p_virtual);
+	return region && p_virtual - region->start + p_size <= region->size;
+}
+
+/**
+ * @brief Walks two ranges side by side to trade their mappings. The first walk only checks that every pair of entries
+ * can be traded, and adds the page tables the second walk will need, so that the second walk can't fail partway.
+ * @param p_first The virtual address of the first range
+ * @param p_second The virtual address of the second range
+ * @param p_size The size of both ranges in bytes
+ * @param p_apply Whether to trade the entries, rather than check that they can be.
+ * @return `true` if every entry can be or was traded, and `false` if not.
+ */
+static bool _exchange_walk(uint32_t p_first, uint32_t p_second, uint32_t p_size, bool p_apply)
+{
+	// A page left without a frame is only backed again if the page fault handler knows about it
+	bool first_lazy	 = _lazy_region_covers(p_first, p_size);
+	bool second_lazy = _lazy_region_covers(p_second, p_size);
+	bool flush		 = ceil(p_size, 4096) <= TLB_FLUSH_THRESHOLD;
+	uint32_t block	 = ptcfg.large_page_size;
+
+	uint32_t offset = 0;
+	while (offset < p_size)
+	{
+		uint32_t first		= p_first + offset;
+		uint32_t second		= p_second + offset;
+		uint64_t first_pde	= _entry_get(_dir_slot(_dir_index(first)));
+		uint64_t second_pde = _entry_get(_dir_slot(_dir_index(second)));
+		bool first_large	= (first_pde & 1) && (first_pde & PAGE_FLAG_SIZE_4MIB);
+		bool second_large	= (second_pde & 1) && (second_pde & PAGE_FLAG_SIZE_4MIB);
+
+		// Large pages can only trade places as a whole, with another large page or a block with nothing mapped in it
+		if (first_large || second_large)
+		{
+			bool aligned = !(first & (block - 1)) && !(second & (block - 1)) && p_size - offset >= block;
+			if (!aligned || (!first_large && (first_pde & 1)) || (!second_large && (second_pde & 1)) ||
+				(!first_large && !second_lazy) || (!second_large && !first_lazy))
+			{
+				return false;
+			}
+
+			if (p_apply)
+			{
+				_dir_set(_dir_index(first), second_pde);
+				_dir_set(_dir_index(second), first_pde);
+				if (flush)
+				{
+					__tlb_flush((void *)first);
+					__tlb_flush((void *)second);
+				}
+			}
+			offset += block;
+			continue;
+		}
+
+		uint64_t first_entry  = (first_pde & 1) ? _entry_get(_entry_slot(first)) : 0;
+		uint64_t second_entry = (second_pde & 1) ? _entry_get(_entry_slot(second)) : 0;
+		offset += 4096;
+		if (first_entry == second_entry)
+		{
+			continue;
+		}
+
+		if (!p_apply)
+		{
+			if ((!(first_entry & 1) && !second_lazy) || (!(second_entry & 1) && !first_lazy))
+			{
+				return false;
+			}
+
+			if ((!(first_pde & 1) && !_alloc_table(_dir_index(first))) ||
+				(!(second_pde & 1) && !_alloc_table(_dir_index(second))))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		_entry_set(_entry_slot(first), second_entry);
+		_entry_set(_entry_slot(second), first_entry);
+		if (flush)
+		{
+			__tlb_flush((void *)first);
+			__tlb_flush((void *)second);
+		}
+	}
+
+	if (p_apply && !flush)
+	{
+		__reload_cr3();
+	}
+	return true;
+}
+
+bool paging_exchange_region(uint32_t p_first, uint32_t p_second, uint32_t p_size)
+{
+	if (((p_first | p_second | p_size) & 0xfff) || !p_size)
+	{
+		return false;
+	}
+
+	// Overlapping ranges would trade some entries twice
+	if (p_first < p_second + p_size && p_second < p_first + p_size)
+	{
+		return false;
+	}
+
+	if (!_exchange_walk(p_first, p_second, p_size, false))
+	{
+		return false;
+	}
+
+	_exchange_walk(p_first, p_second, p_size, true);
+	return true;
+}
+
+void paging_free_region(uint32_t p_virtual, uint32_t p_size)
+{
+	_reverse_index_remove(p_virtual, p_size);
+	_lazy_region_remove(p_virtual, p_size);
+	_unmap_region(p_virtual, p_size);
+	vmem_release(p_virtual, p_size);
+}
+
+/**
+ * @brief Unmaps a region of memory without giving its addresses back to the virtual address allocator.
+ * @param p_virtual The virtual address of the region
+ * @param p_size The size of the region in bytes
+ */
+void _unmap_region(uint32_t p_virtual, uint32_t p_size)
+{
+	uint32_t block		= ptcfg.large_page_size;
+	uint16_t entries	= block >> 12;
+	int directory_count = _get_directory_count(p_virtual, p_size);
+	uint16_t page_index = _dir_index(p_virtual);
+
+	// Invalidating a large region page by page costs more than refilling the TLB after a single reload
+	bool reload = ceil(p_size, 4096) > TLB_FLUSH_THRESHOLD;
+
+	for (int i = 0; i < directory_count; i++)
+	{
+		uint32_t *pde = _dir_slot(page_index + i);
+
+		// Nothing is mapped in this part of the range
+		if (!(_entry_get(pde) & 1))
+		{
+			continue;
+		}
+
+		uint16_t table_start = 0;
+		uint16_t table_end	 = entries;
 		if (i == 0)
 		{
-			table_start = (p_virtual & 0x003ff000) >> 12;
+			table_start = (p_virtual & (block - 1)) >> 12;
 		}
 		if (i == directory_count - 1)
 		{
-			table_end = ceil(((p_virtual + p_size - 1) % 0x400000), 4096);
-			table_end = (table_end > 1024) ? 1024 : table_end;
+			table_end = ceil(((p_virtual + p_size - 1) % block), 4096);
+			table_end = (table_end > entries) ? entries : table_end;
 		}
 
-		// Can free entire page table
-		bool free_pt = (table_start == 0 && table_end == 1024);
+		uint32_t table_base = (uint32_t)(page_index + i) << ptcfg.large_page_shift;
+
+		// Large pages have no table, and can only be unmapped as a whole
+		if (_entry_get(pde) & PAGE_FLAG_SIZE_4MIB)
+		{
+			if (table_start != 0 || table_end != entries)
+			{
+				LOG_WARNING("Unable to unmap part of the large page at %x.", table_base);
+				continue;
+			}
+
+			_dir_set(page_index + i, _entry_get(pde) & 2);
+			if (!reload)
+			{
+				__tlb_flush((void *)table_base);
+			}
+			continue;
+		}
 
 		for (int j = table_start; j < table_end; j++)
 		{
-			table->entry[j] = 0;
+			uint32_t *entry = _entry_slot(table_base | (j << 12));
+			if (_entry_get(entry) == 0)
+				continue;
+
+			// Pages that are out in swap only have a slot to give back
+			if (!(_entry_get(entry) & 1) && (_entry_get(entry) & PAGE_FLAG_SWAPPED))
+			{
+				swap_free_slot(_entry_get(entry) >> 12);
+			}
+
+			_entry_set(entry, 0);
+			if (!reload)
+			{
+				__tlb_flush((void *)(table_base | (j << 12)));
+			}
 		}
 
-		// Check if lower regions are empty as well
-		bool lower_empty = false;
-		if (table_start > 0)
+		// Other regions may still live in the same table, so it can only go once every entry is clear. A table is a
+		// single page with either entry size.
+		uint32_t *table = _table_at(page_index + i);
+		bool empty		= true;
+		for (int j = 0; j < 1024; j++)
 		{
-			for (int i = 0; i < table_start; i++)
+			if (table[j] != 0)
 			{
-				if (table->entry[i] != 0)
-				{
-					lower_empty = false;
-					break;
-				}
+				empty = false;
+				break;
+			}
+		}
+
+		if (empty)
+		{
+			_free_table(page_index + i);
+		}
+	}
+
+	if (reload)
+	{
+		__reload_cr3();
+	}
+}
+
+/**
+ * @brief Maps a single large page (4 MiB, or 2 MiB with PAE) straight into the page directory. The entry wasn't
+ * present before, so there is nothing in the TLB to invalidate.
+ * @param p_physical The physical address of the page, aligned to the large page size.
+ * @param p_virtual The virtual address of the page, aligned to the large page size.
+ * @param p_flags Extra `PagingFlags` for the entry, such as `PAGE_FLAG_GLOBAL`.
+ * @return `true` if the page was mapped, and `false` if something is already mapped in its place.
+ */
+bool _map_large_page(uint64_t p_physical, uint32_t p_virtual, uint32_t p_flags)
+{
+	uint16_t index = _dir_index(p_virtual);
+	if (_entry_get(_dir_slot(index)) & 1)
+	{
+		return false;
+	}
+
+	uint64_t address = p_physical & ENTRY_ADDRESS_MASK & ~(uint64_t)(ptcfg.large_page_size - 1);
+	_dir_set(index, address | ptcfg.data_flags | p_flags | PAGE_FLAG_SIZE_4MIB | PAGE_FLAG_READ_WRITE | 1);
+	return true;
+}
+
+bool paging_map_large_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
+{
+	return _map_large_region(p_physical, p_virtual, p_size, 0);
+}
+
+/**
+ * @brief Maps a range of physical memory like `paging_map_large_region()`, with extra flags for its large pages.
+ * @param p_physical The physical starting memory address
+ * @param p_virtual The desired virtual starting memory address
+ * @param p_size The number of bytes to map
+ * @param p_flags Extra `PagingFlags` for every large page in the range
+ * @return `true` if the whole range was mapped, and `false` if not.
+ */
+bool _map_large_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size, uint32_t p_flags)
+{
+	vmem_claim(p_virtual, p_size);
+
+	uint32_t block	= ptcfg.large_page_size;
+	uint32_t offset = 0;
+	while (offset < p_size)
+	{
+		uint32_t physical  = p_physical + offset;
+		uint32_t virtual   = p_virtual + offset;
+		uint32_t remaining = p_size - offset;
+
+		if (ptcfg.large_pages && !(physical & (block - 1)) && !(virtual & (block - 1)) && remaining >= block &&
+			_map_large_page(physical, virtual, p_flags))
+		{
+			offset += block;
+			continue;
+		}
+
+		// Map up to the next large page boundary with a page table instead
+		uint32_t chunk = AMIN(remaining, block - (virtual & (block - 1)));
+		if (!_map_region(physical, virtual, chunk))
+		{
+			return false;
+		}
+		offset += chunk;
+	}
+
+	_reverse_index_add(p_physical, p_virtual, p_size);
+	return true;
+}
+
+bool paging_create_direct_map(uint32_t p_size)
+{
+	// Without large pages every block of the map costs a page table, which is taken from the physical allocator once
+	// the boot-time pool runs dry
+	uint32_t size = AMIN(ceil(p_size, ptcfg.large_page_size) * ptcfg.large_page_size, DIRECT_MAP_MAX_SIZE);
+
+	// Low memory is usable for DMA and BIOS structures too, so the map always starts at physical address 0. The map is
+	// never taken down, so it can stay in the TLB across address space switches.
+	uint32_t flags = ptcfg.global_pages ? PAGE_FLAG_GLOBAL : 0;
+	if (!_map_large_region(0, DIRECT_MAP_VIRTUAL_ADDRESS, size, flags))
+	{
+		LOG_ERROR("Failed to map physical memory to the direct map.");
+		return false;
+	}
+
+	// The map itself doesn't need to be in the reverse index
+	_reverse_index_remove(DIRECT_MAP_VIRTUAL_ADDRESS, size);
+	ptcfg.direct_map_size = size;
+	LOG_INFO("Mapped the first %u MiB of physical memory to %x.",
+			 size / MIBIBYTES_TO_BYTES,
+			 DIRECT_MAP_VIRTUAL_ADDRESS);
+	return true;
+}
+
+void *paging_allocate_large_region(uint32_t p_size)
+{
+	// Frames are only taken as the region is touched, a whole large page at a time where possible
+	return _reserve_lazy_region(p_size, ptcfg.large_page_size, PAGING_POLICY_ZERO_FILL, true);
+}
+
+void paging_release_region(uint32_t p_virtual, uint32_t p_size)
+{
+	// Frames were mapped in physically contiguous blocks, so free them a run at a time rather than page by page
+	uint32_t run_start = 0;
+	uint32_t run_count = 0;
+	uint32_t offset	   = 0;
+	while (offset < p_size)
+	{
+		uint32_t virtual = p_virtual + offset;
+		uint64_t pde	 = _entry_get(_dir_slot(_dir_index(virtual)));
+		if ((pde & 1) && (pde & PAGE_FLAG_SIZE_4MIB))
+		{
+			physical_free_order(pde & ENTRY_ADDRESS_MASK & ~(ptcfg.large_page_size - 1), _large_page_order());
+			offset += ptcfg.large_page_size - (virtual & (ptcfg.large_page_size - 1));
+			continue;
+		}
+
+		uint32_t frame = virtual_to_physical(virtual);
+		offset += 4096;
+
+		// Frames shared with another address space only lose this mapping, and frames the allocator doesn't own, such
+		// as device memory, are left alone
+		if (frame && (physical_get_page_shares(frame) || !physical_owns_page(frame)))
+		{
+			physical_release_page(frame);
+			continue;
+		}
+
+		if (run_count && frame == run_start + run_count * 4096)
+		{
+			run_count++;
+			continue;
+		}
+
+		physical_free_pages(run_start, run_count);
+		run_start = frame;
+		run_count = frame ? 1 : 0;
+	}
+	physical_free_pages(run_start, run_count);
+
+	paging_free_region(p_virtual, p_size);
+}
+
+/**
+ * @brief Allocates a cleared frame for a directory or table outside of the current address space. Those can't be
+ * reached through the recursive mapping, so the frame has to be in the direct map.
+ * @param out_frame The physical address of the frame
+ * @return A pointer to the frame, or `NULL` if there is no memory left for one.
+ */
+static uint32_t *_alloc_detached_page(uint32_t *out_frame)
+{
+	uint32_t frame = physical_alloc_zeroed_page();
+	bool zeroed	   = frame != 0;
+	if (!frame)
+	{
+		frame = physical_alloc_pages(1);
+	}
+
+	uint32_t *page = frame ? (uint32_t *)physical_to_virtual(frame) : NULL;
+	if (!page)
+	{
+		physical_free_pages(frame, frame ? 1 : 0);
+		return NULL;
+	}
+
+	if (!zeroed)
+	{
+		memset(page, 0, 4096);
+	}
+	*out_frame = frame;
+	return page;
+}
+
+/**
+ * @brief Drops every page of user memory and every user page table of an address space. Frames that are still shared
+ * with another address space are kept for it.
+ * @param p_directory The directory of the address space, which must not be the current one.
+ */
+static void _release_space(uint32_t *p_directory)
+{
+	for (int i = 0; i < 1023; i++)
+	{
+		uint32_t pde = p_directory[i];
+		if (!_is_user_index(i) || !(pde & 1) || (pde & PAGE_FLAG_SIZE_4MIB))
+		{
+			continue;
+		}
+
+		uint32_t *table = (uint32_t *)physical_to_virtual(pde & 0xfffff000);
+		for (int j = 0; j < 1024; j++)
+		{
+			if (table[j] & 1)
+			{
+				physical_release_page(table[j] & 0xfffff000);
 			}
+		}
+		_release_table_frame(pde & 0xfffff000);
+	}
+}
+
+uint32_t paging_clone_address_space()
+{
+	if (ptcfg.pae)
+	{
+		LOG_ERROR("Address spaces can't be cloned with PAE paging.");
+		return 0;
+	}
+
+	// The directory the kernel booted with becomes the first address space
+	if (!ptcfg.space_count)
+	{
+		ptcfg.spaces[ptcfg.space_count++] = ptcfg.current_space;
+	}
+
+	if (ptcfg.space_count == ADDRESS_SPACE_COUNT)
+	{
+		LOG_ERROR("No room left for another address space.");
+		return 0;
+	}
 
-			lower_empty = true;
+	uint32_t directory_frame = 0;
+	uint32_t *directory		 = _alloc_detached_page(&directory_frame);
+	if (!directory)
+	{
+		LOG_ERROR("No memory left for a new page directory.");
+		return 0;
+	}
+
+	for (int i = 0; i < 1023; i++)
+	{
+		// Kernel tables are shared by every address space
+		uint32_t pde = *_dir_slot(i);
+		if (!_is_user_index(i) || !(pde & 1))
+		{
+			directory[i] = pde;
+			continue;
+		}
+
+		if (pde & PAGE_FLAG_SIZE_4MIB)
+		{
+			LOG_WARNING("Large page at %x in user memory can't be shared, and is left out.", i << 22);
+			continue;
+		}
+
+		uint32_t table_frame = 0;
+		uint32_t *table		 = _alloc_detached_page(&table_frame);
+		if (!table)
+		{
+			LOG_ERROR("No memory left for page tables of a new address space.");
+			_release_space(directory);
+			physical_free_pages(directory_frame, 1);
+			return 0;
 		}
 
-		// Check if upper regions are empty as well
-		bool upper_empty = false;
-		if (table_end < 1024)
+		// Both sides map the same frames read-only, and whichever writes first gets a copy. Frames the allocator
+		// doesn't manage, such as device memory, are shared as they are.
+		uint32_t *parent = _table_at(i);
+		for (int j = 0; j < 1024; j++)
 		{
-			for (int i = table_end; i < 1024; i++)
+			uint32_t entry = parent[j];
+			if ((entry & 1) && physical_share_page(entry & 0xfffff000) && (entry & PAGE_FLAG_READ_WRITE))
 			{
-				if (table->entry[i] != 0)
-				{
-					upper_empty = false;
-					break;
-				}
+				entry	  = (entry & ~PAGE_FLAG_READ_WRITE) | PAGE_FLAG_COPY_ON_WRITE;
+				parent[j] = entry;
 			}
+			table[j] = entry;
+		}
+		directory[i] = table_frame | (pde & 0xfff);
+	}
+
+	directory[1023]					  = directory_frame | PAGE_FLAG_READ_WRITE | 1;
+	ptcfg.spaces[ptcfg.space_count++] = directory_frame;
+
+	// Pages of the current address space may have just lost their write access, and user pages are never global
+	__reload_cr3();
+	return directory_frame;
+}
+
+void paging_switch_address_space(uint32_t p_directory)
+{
+	if (p_directory == ptcfg.current_space)
+	{
+		return;
+	}
+
+	for (int i = 0; i < ptcfg.space_count; i++)
+	{
+		if (ptcfg.spaces[i] == p_directory)
+		{
+			__load_cr3(p_directory);
+			ptcfg.current_space = p_directory;
+			return;
+		}
+	}
+
+	LOG_ERROR("Attempted to switch to unknown address space %x.", p_directory);
+}
 
-			upper_empty = true;
+void paging_destroy_address_space(uint32_t p_directory)
+{
+	// The boot directory is part of the kernel image, and is never freed
+	for (int i = 0; i < ptcfg.space_count; i++)
+	{
+		if (ptcfg.spaces[i] != p_directory || p_directory == ptcfg.current_space ||
+			p_directory == (uint32_t)page_directory)
+		{
+			continue;
 		}
 
-		// If both lower and upper are empty, free the table.
-		if (lower_empty && upper_empty)
+		_release_space((uint32_t *)physical_to_virtual(p_directory));
+		physical_free_pages(p_directory, 1);
+		ptcfg.spaces[i] = ptcfg.spaces[--ptcfg.space_count];
+		return;
+	}
+
+	LOG_ERROR("Unable to destroy address space %x.", p_directory);
+}
+
+bool paging_is_pae_enabled()
+{
+	return ptcfg.pae;
+}
+
+void *paging_map_high_page(uint64_t p_physical)
+{
+	if (!ptcfg.pae && p_physical >> 32)
+	{
+		LOG_ERROR("Memory at %llx can only be reached with PAE paging.", p_physical);
+		return NULL;
+	}
+
+	if (!ptcfg.high_window)
+	{
+		LOG_ERROR("No window to map memory at %llx into.", p_physical);
+		return NULL;
+	}
+
+	for (int i = 0; i < HIGH_WINDOW_PAGES; i++)
+	{
+		if (ptcfg.high_window_used & (1 << i))
 		{
-			free_pt = true;
+			continue;
 		}
 
-		if (free_pt)
+		uint32_t virtual = ptcfg.high_window + i * 4096;
+		uint16_t index	 = _dir_index(virtual);
+		if (!(_entry_get(_dir_slot(index)) & 1) && !_alloc_table(index))
 		{
-			_pt_free(table);
+			LOG_ERROR("No memory left for page tables.");
+			return NULL;
 		}
+
+		// Pages are flushed as they are unmapped, so there is nothing left in the TLB for this address
+		uint64_t entry = (p_physical & ENTRY_ADDRESS_MASK) | ptcfg.data_flags | PAGE_FLAG_READ_WRITE | 1;
+		_entry_set(_entry_slot(virtual), entry);
+		ptcfg.high_window_used |= 1 << i;
+		return (void *)(virtual + (uint32_t)(p_physical & 0xfff));
+	}
+
+	LOG_WARNING("High memory window is full, unable to map %llx.", p_physical);
+	return NULL;
+}
+
+void paging_unmap_high_page(void *p_virtual)
+{
+	uint32_t page = ((uint32_t)p_virtual - ptcfg.high_window) >> 12;
+	if (!ptcfg.high_window || page >= HIGH_WINDOW_PAGES || !(ptcfg.high_window_used & (1 << page)))
+	{
+		LOG_WARNING("Address %x is not mapped in the high memory window.", (uint32_t)p_virtual);
+		return;
 	}
+
+	uint32_t virtual = ptcfg.high_window + page * 4096;
+	_entry_set(_entry_slot(virtual), 0);
+	__tlb_flush((void *)virtual);
+	ptcfg.high_window_used &= ~(1 << page);
 }
 
 uint32_t virtual_to_physical(uint32_t p_virtual)
 {
-	uint16_t dir		 = (p_virtual & 0xffc00000) >> 22;
-	struct PageTable *pt = (struct PageTable *)(page_directory[dir] & 0xfffff000);
-	if (!pt || !(page_directory[dir] & 1))
+	uint64_t pde = _entry_get(_dir_slot(_dir_index(p_virtual)));
+	if (!(pde & 1))
 	{
 		return 0;
 	}
 
-	uint16_t idx = (p_virtual & 0x003ff000) >> 12;
-	uint32_t ret = pt->entry[idx] & 0xfffff000;
-	if (!ret || !(pt->entry[idx] & 1))
+	// Large pages map the address straight from the directory
+	uint64_t ret = 0;
+	if (pde & PAGE_FLAG_SIZE_4MIB)
 	{
-		return 0;
+		uint32_t mask = ptcfg.large_page_size - 1;
+		ret			  = (pde & ENTRY_ADDRESS_MASK & ~(uint64_t)mask) + (p_virtual & mask);
+	}
+	else
+	{
+		uint64_t entry = _entry_get(_entry_slot(p_virtual));
+		if (!(entry & ENTRY_ADDRESS_MASK) || !(entry & 1))
+		{
+			return 0;
+		}
+
+		ret = (entry & ENTRY_ADDRESS_MASK) + (p_virtual & 0x00000fff);
 	}
 
-	return ret + (p_virtual & 0x00000fff);
+	// Memory above 4 GiB can't be described by a 32-bit address
+	return (ret < HIGH_MEMORY_PHYSICAL_ADDRESS) ? ret : 0;
 }
 
 uint32_t physical_to_virtual(uint32_t p_address)
@@ -458,35 +2032,19 @@ uint32_t physical_to_virtual(uint32_t p_address)
 		return p_address | KERNEL_VIRTUAL_ADDRESS;
 	}
 
-	// Page offset bits
-	uint32_t offset = p_address & 0x00000fff;
-	// AND the result so we align to the page memory
-	p_address &= 0xfffff000;
+	// Most physical memory sits in the direct map, so its address is a fixed offset away
+	if (p_address < ptcfg.direct_map_size)
+	{
+		return DIRECT_MAP_VIRTUAL_ADDRESS + p_address;
+	}
 
-	// Check allocated pages first (most uses of page lookups come from here)
-	for (int i = 0; i < PAGE_TABLE_COUNT; i++)
+	// Anything else (device memory, or RAM past the end of the map) can only be found if it was mapped explicitly
+	for (int i = 0; i < ptcfg.reverse_count; i++)
 	{
-		// Found an allocated table
-		if (config->page_info[i] & 1)
+		struct ReverseMapping *mapping = &ptcfg.reverse_index[i];
+		if (p_address - mapping->physical < mapping->size)
 		{
-			struct PageTable *pt = &allocated_tables[i];
-
-			if (!pt)
-			{
-				return 0;
-			}
-
-			for (int j = 0; j < 1024; j++)
-			{
-				if (pt->entry[j] == 0)
-					continue;
-
-				// Found page
-				if (p_address == pt->entry[j])
-				{
-					return (i << 22) | (j << 12) | offset;
-				}
-			}
+			return mapping->virtual + (p_address - mapping->physical);
 		}
 	}
 
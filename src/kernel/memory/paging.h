@@ -5,26 +5,47 @@
 
 typedef enum
 {
-	PAGE_FLAG_GLOBAL	 = 1 << 8,
-	PAGE_FLAG_SIZE_4MIB	 = 1 << 7,
-	PAGE_FLAG_SIZE_4KIB	 = 0,
-	PAGE_FLAG_USER		 = 1 << 2,
-	PAGE_FLAG_SUPERVISOR = 0,
-	PAGE_FLAG_READ_WRITE = 1 << 1,
-	PAGE_FLAG_READ_ONLY	 = 0,
+	PAGE_FLAG_SWAPPED		= 1 << 10, // Ignored by the CPU, and marks an absent page whose contents are in swap
+	PAGE_FLAG_COPY_ON_WRITE = 1 << 9,  // Ignored by the CPU, and marks a read-only page that gets copied when written
+	PAGE_FLAG_GLOBAL		= 1 << 8,
+	PAGE_FLAG_SIZE_4MIB		= 1 << 7,
+	PAGE_FLAG_SIZE_4KIB		= 0,
+	PAGE_FLAG_ACCESSED		= 1 << 5,  // Set by the CPU whenever the page is read or written
+	PAGE_FLAG_USER			= 1 << 2,
+	PAGE_FLAG_SUPERVISOR	= 0,
+	PAGE_FLAG_READ_WRITE	= 1 << 1,
+	PAGE_FLAG_READ_ONLY		= 0,
 } PagingFlags;
 
+// What the page fault handler does when a page of a reserved region is touched before it has a frame
+typedef enum
+{
+	PAGING_POLICY_ZERO_FILL = 0, // Back the page with a new frame that has been cleared to zero
+	PAGING_POLICY_GUARD		= 1, // Report the access as an overrun into a guard page, and panic
+	PAGING_POLICY_PANIC		= 2, // Panic straight away, as nothing should ever touch the region
+	PAGING_POLICY_SWAPPABLE = 3, // Back the page like `PAGING_POLICY_ZERO_FILL`, and swap it out when memory is short
+} PagingPolicy;
+
 /**
  * @brief Initializes paging so that we know where out virtual memory should begin for allocation functions, and to
  * plug a 64KiB hole in memory that is left unmapped.
  * @param p_phys_mem_start The position at which to being allocating physical memory. The hole in question requires
  * 64KiB, so we need to add that into our calculations first and here is the best position for that.
+ * @param p_use_pae Whether to switch to PAE paging, so that memory above 4 GiB can be reached. Ignored if the CPU
+ * doesn't support it.
  */
-void paging_initialize(uint32_t *p_phys_mem_start);
+void paging_initialize(uint32_t *p_phys_mem_start, bool p_use_pae);
+
+/**
+ * @brief Checks whether PAE paging is in use.
+ * @return `true` if PAE paging was enabled by `paging_initialize()`, and `false` if not.
+ */
+bool paging_is_pae_enabled();
 
 /**
  * @brief Maps a range of physical memory to that of a specified virtual memory. Use this function only when the output
- * address is known (i.e. framebuffers) and never any other time, see `paging_allocate_region`.
+ * address is known (i.e. framebuffers) and never any other time, see `paging_allocate_region`. The range is taken
+ * out of the virtual address allocator, so nothing else will be placed on top of it.
  * @param p_physical The physical starting memory address
  * @param p_virtual The desired virtual starting memory address
  * @param p_size The number of bytes to directly map. Higher numbers (ideally multiples of 4096) should be used.
@@ -35,15 +56,125 @@ bool paging_map_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
 /**
  * @brief Allocates N 4KiB blocks of virtual memory to the given memory range. Should be used in most cases of memory
  * allocation where the user knows what physical memory is available but not what virtual memory is.
- * @param p_address The starting physical address
+ * @param p_address The starting physical address, or 0 to have the frames taken from the physical allocator
  * @param p_size The number of bytes to map. Multiples of 4096 should be used.
- * @return The allocated virtual memory address if successful. NULL on failure. NOTE: Failing on NULL should be
- * regarded as a potential kernel panic situation, as there is no more virtual memory available to allocate, and the
- * moron maintainer who limited the allocated pages to 255 because of space requirements should be notified of this and
- * have their stupid-ass code updated to take care of this issue.
+ * @return The allocated virtual memory address if successful. NULL on failure, which means that either virtual or
+ * physical memory has run out.
  */
 void *paging_allocate_region(uint32_t p_address, uint32_t p_size);
 
+/**
+ * @brief Reserves a range of kernel virtual memory without mapping anything to it. Pages are only given frames once
+ * they are touched, by the page fault handler, according to the policy of the region.
+ * @param p_size The number of bytes to reserve. Multiples of 4096 should be used.
+ * @param p_policy What to do when a page of the region is touched
+ * @return The virtual address of the region, or `NULL` if no virtual memory is left.
+ */
+void *paging_reserve_region(uint32_t p_size, PagingPolicy p_policy);
+
+/**
+ * @brief Backs every page of a range that hasn't been touched yet, as if it had been. Needed before handing the range
+ * to a device, since the page fault handler never sees accesses that don't come from the CPU.
+ * @param p_virtual The virtual address of the range
+ * @param p_size The size of the range in bytes
+ * @return `true` if every page of the range is now backed, and `false` if not.
+ */
+bool paging_commit_region(uint32_t p_virtual, uint32_t p_size);
+
+/**
+ * @brief Maps newly allocated page frames at a fixed virtual address, which is used to grow an existing region in
+ * place. Fails if any page in the range is already mapped. Regions from `paging_reserve_region()` grow without being
+ * backed, like the rest of the region.
+ * @param p_virtual The virtual address to start mapping at, normally the end of the region being grown.
+ * @param p_size The number of bytes to map. Multiples of 4096 should be used.
+ * @return `true` if the range was mapped, and `false` if not.
+ */
+bool paging_extend_region(uint32_t p_virtual, uint32_t p_size);
+
+/**
+ * @brief Trades the mappings of two ranges of kernel memory, so that the pages of each appear at the other's address
+ * without copying anything. Costs one pair of entries per page, or per large page where both ranges have one at the
+ * same offset. Pages without a frame can only end up in a range that the page fault handler backs on demand.
+ * @param p_first The virtual address of the first range, aligned to 4 KiB.
+ * @param p_second The virtual address of the second range, aligned to 4 KiB. Must not overlap the first.
+ * @param p_size The size of both ranges in bytes, as a multiple of 4 KiB.
+ * @return `true` if the mappings were traded, and `false` if they couldn't be, in which case nothing has changed.
+ */
+bool paging_exchange_region(uint32_t p_first, uint32_t p_second, uint32_t p_size);
+
+/**
+ * @brief Maps a range of physical memory to a specified virtual address like `paging_map_region()`, but uses large
+ * pages (4 MiB, or 2 MiB with PAE) wherever both addresses are aligned to one and the CPU supports them. Suited to
+ * large device memory such as framebuffers.
+ * @param p_physical The physical starting memory address
+ * @param p_virtual The desired virtual starting memory address
+ * @param p_size The number of bytes to map. Multiples of 4096 should be used.
+ * @return `true` if the whole range was mapped, and `false` if not.
+ */
+bool paging_map_large_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size);
+
+/**
+ * @brief Allocates a large region of memory from the physical allocator. The region starts on a large page boundary,
+ * and is backed as it is touched like a zero-filled region from `paging_reserve_region()`. Every whole large page of
+ * it is backed by a single large page (4 MiB, or 2 MiB with PAE) when the CPU supports them.
+ * @param p_size The number of bytes to allocate. Multiples of 4096 should be used.
+ * @return The virtual address of the region, or `NULL` if it could not be allocated.
+ */
+void *paging_allocate_large_region(uint32_t p_size);
+
+/**
+ * @brief Maps physical memory from address 0 upwards to `DIRECT_MAP_VIRTUAL_ADDRESS`, so that `physical_to_virtual()`
+ * can translate any address inside it with a single addition. The map is capped at `DIRECT_MAP_MAX_SIZE`.
+ * @param p_size The number of bytes of physical memory to map, normally the end of usable memory.
+ * @return `true` if the map was created, and `false` if not.
+ */
+bool paging_create_direct_map(uint32_t p_size);
+
+/**
+ * @brief Unmaps a region of memory and gives its frames back to the physical allocator. Works for any region whose
+ * frames came from the physical allocator, whether mapped with 4 KiB or large pages.
+ * @param p_virtual The virtual address of the region
+ * @param p_size The size of the region in bytes
+ */
+void paging_release_region(uint32_t p_virtual, uint32_t p_size);
+
+/**
+ * @brief Maps a single page of memory that the direct map doesn't reach into a small window of kernel memory, such as
+ * memory above 4 GiB for caches. Memory above 4 GiB needs PAE paging, and only a few pages can be mapped at once.
+ * @param p_physical The physical address, normally from `physical_alloc_high_page()`.
+ * @return The virtual address of `p_physical`, or `NULL` if the memory can't be reached or the window is full.
+ */
+void *paging_map_high_page(uint64_t p_physical);
+
+/**
+ * @brief Unmaps a page mapped by `paging_map_high_page()`, making room in the window for another.
+ * @param p_virtual An address inside the page
+ */
+void paging_unmap_high_page(void *p_virtual);
+
+/**
+ * @brief Creates a copy of the current address space, such as for `fork()`. Kernel memory is shared by every address
+ * space. User memory is shared copy-on-write, so both copies map the same frames read-only and a page is only copied
+ * once one of them writes to it. Only page tables are copied, so the cost depends on how many tables are in use rather
+ * than how much memory they map. Not supported with PAE paging.
+ * @return The physical address of the new page directory, or 0 if it couldn't be created.
+ */
+uint32_t paging_clone_address_space();
+
+/**
+ * @brief Makes another address space the current one.
+ * @param p_directory The physical address of its page directory, from `paging_clone_address_space()`.
+ */
+void paging_switch_address_space(uint32_t p_directory);
+
+/**
+ * @brief Frees an address space, along with its page tables and every frame of user memory that no other address
+ * space shares.
+ * @param p_directory The physical address of its page directory. Must not be the current address space, or the one
+ * the kernel booted with.
+ */
+void paging_destroy_address_space(uint32_t p_directory);
+
 /**
  * @brief Frees the data associated to the given handle. Handles should not be created manually as they are generated
  * by `paging_map_region()`.
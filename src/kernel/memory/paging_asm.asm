@@ -5,3 +5,82 @@ __tlb_flush:
     mov eax, [esp + 4]
     invlpg [eax]
     ret
+
+; Sets CR4.PSE so that page directory entries can map 4 MiB pages
+global __enable_pse
+__enable_pse:
+    mov eax, cr4
+    or eax, 0x00000010
+    mov cr4, eax
+    ret
+
+; Sets CR4.PGE so that entries marked global survive a reload of CR3
+global __enable_pge
+__enable_pge:
+    mov eax, cr4
+    or eax, 0x00000080
+    mov cr4, eax
+    ret
+
+; Reloads CR3, which flushes every TLB entry that isn't global
+global __reload_cr3
+__reload_cr3:
+    mov eax, cr3
+    mov cr3, eax
+    ret
+
+; Gets the address that caused the last page fault
+global __read_cr2
+__read_cr2:
+    mov eax, cr2
+    ret
+
+; Switches to another page directory
+global __load_cr3
+__load_cr3:
+    mov eax, [esp + 4]
+    mov cr3, eax
+    ret
+
+; Sets CR0.WP so that the kernel can't write to read-only pages either
+global __enable_write_protect
+__enable_write_protect:
+    mov eax, cr0
+    or eax, 0x00010000
+    mov cr0, eax
+    ret
+
+; Sets EFER.NXE so that entries can stop code from running in the memory they map. Only has an effect with PAE paging.
+global __enable_nx
+__enable_nx:
+    mov ecx, 0xc0000080
+    rdmsr
+    or eax, 0x00000800
+    wrmsr
+    ret
+
+section .kernel_lh.text
+
+; Switches to PAE paging with the given page directory pointer table. Paging has to be turned off while CR4.PAE
+; changes, so this lives in the identity-mapped part of the kernel, and the stack isn't touched until paging is back.
+global __enable_pae
+__enable_pae:
+    mov ecx, [esp + 4]
+    pushfd
+    cli
+
+    mov eax, cr0
+    and eax, 0x7fffffff
+    mov cr0, eax
+
+    mov eax, cr4
+    or eax, 0x00000020
+    mov cr4, eax
+    mov cr3, ecx
+
+    mov eax, cr0
+    or eax, 0x80000000
+    mov cr0, eax
+
+    popfd
+    ret
@@ -0,0 +1,686 @@
+#include "physical.h"
+#include "paging.h"
+
+#include <aurora/arch/cpuid.h>
+#include <aurora/memory.h>
+
+#define AUR_MODULE "physical"
+#include <aurora/debug.h>
+
+#include <string.h>
+
+#define PAGE_SIZE  0x1000
+#define PAGE_SHIFT 12
+
+// Marks the end of a free list, as frame 0 is a valid frame number.
+#define FRAME_NONE 0xffffffff
+
+// Frames are handed out as 32-bit addresses, so the buddy allocator ignores anything above 4 GiB. Memory past it can
+// only be reached with PAE, and is kept in a separate bitmap up to the 64 GiB that PAE can address.
+#define PHYSICAL_ADDRESS_LIMIT 0x100000000ULL
+#define HIGH_MEMORY_LIMIT	   0x1000000000ULL
+
+// ISA DMA can only reach the first 16 MiB of physical memory, and can't cross a 64 KiB boundary in one transfer
+#define DMA_FRAME_LIMIT (0x1000000 >> PAGE_SHIFT)
+#define DMA_MAX_ORDER	4
+
+// Number of frames kept cleared to zero ahead of time, for page tables and memory that is touched for the first time
+#define ZEROED_POOL_SIZE 64
+
+enum FrameFlags
+{
+	FRAME_RESERVED	= 0,	  // Frame is not managed by the allocator, or is part of a larger block
+	FRAME_FREE		= 1 << 0, // Frame is the first frame of a free block
+	FRAME_ALLOCATED = 1 << 1, // Frame is the first frame of an allocated block
+	FRAME_MANAGED	= 1 << 2, // Frame was handed to the allocator, and is never reserved memory. Kept for good.
+};
+
+// Descriptor for a single 4 KiB page frame. Only the first frame of a block has its list fields in use.
+struct PhysicalFrame
+{
+	uint32_t next;	 // Next free block of the same order, as a frame number
+	uint32_t prev;	 // Previous free block of the same order, as a frame number
+	uint8_t order;	 // Order of the block the frame is the head of
+	uint8_t flags;	 // `FrameFlags` for the frame
+	uint16_t shares; // Number of address spaces mapping the frame besides the first. Used by every frame.
+};
+
+struct PhysicalConfig
+{
+	struct PhysicalFrame *frames;				 // Descriptor for every frame below the highest usable address
+	uint32_t frame_count;						 // Number of descriptors in `frames`
+	uint32_t free_pages;						 // Number of frames currently free
+	uint32_t free_lists[PHYSICAL_MAX_ORDER + 1]; // First free block of each order
+	uint32_t *high_bitmap;						 // One bit for every frame from 4 GiB up, set if the frame is free
+	uint32_t high_frame_count;					 // Number of frames covered by `high_bitmap`
+	uint32_t high_free_pages;					 // Number of frames in `high_bitmap` that are free
+	uint32_t high_cursor;						 // Word of `high_bitmap` that the last allocation was taken from
+	uint32_t zeroed_pool[ZEROED_POOL_SIZE];		 // Frames that have already been cleared to zero
+	uint8_t zeroed_count;						 // Number of frames in `zeroed_pool`
+	bool zero_non_temporal;						 // Whether frames can be cleared without going through the cache
+};
+
+static struct PhysicalConfig physcfg = {0};
+
+static void _p_list_push(uint32_t p_frame, uint8_t p_order);
+static void _p_list_remove(uint32_t p_frame);
+static uint32_t _p_take_block(uint32_t p_frame, uint8_t p_order);
+static void _p_free_range(uint32_t p_frame, uint32_t p_count);
+static bool _p_frame_is_free(uint32_t p_frame);
+static bool _p_frame_in_use(uint32_t p_frame);
+static void _p_zero_page(void *p_page);
+static bool _p_drain_zeroed_pool();
+
+bool physical_initialize(struct AuMemoryRegion *p_regions, size_t p_region_count, uint32_t p_reserved_end)
+{
+	p_reserved_end = (p_reserved_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	// Find the highest usable frame, so we know how many descriptors are needed
+	uint64_t highest = 0;
+	for (int i = 0; i < p_region_count; i++)
+	{
+		if (!(p_regions[i].length_blocked & 1))
+			continue;
+
+		uint64_t end = p_regions[i].base_address + (p_regions[i].length_blocked & ~1);
+		if (end > PHYSICAL_ADDRESS_LIMIT)
+			end = PHYSICAL_ADDRESS_LIMIT;
+
+		if (end > highest)
+			highest = end;
+	}
+
+	physcfg.frame_count = (uint32_t)(highest >> PAGE_SHIFT);
+	if (physcfg.frame_count <= (p_reserved_end >> PAGE_SHIFT))
+	{
+		LOG_ERROR("No usable physical memory was found above %x.", p_reserved_end);
+		return false;
+	}
+
+	// The descriptor array goes in the first usable memory after the reserved area that can fit it
+	uint32_t array_size	   = (physcfg.frame_count * sizeof(struct PhysicalFrame) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	uint32_t array_address = 0;
+	for (int i = 0; i < p_region_count; i++)
+	{
+		if (!(p_regions[i].length_blocked & 1))
+			continue;
+
+		uint64_t start = p_regions[i].base_address;
+		uint64_t end   = start + (p_regions[i].length_blocked & ~1);
+		start		   = (start < p_reserved_end) ? p_reserved_end : (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+		if (end > PHYSICAL_ADDRESS_LIMIT)
+			end = PHYSICAL_ADDRESS_LIMIT;
+
+		if (end > start && end - start >= array_size)
+		{
+			array_address = (uint32_t)start;
+			break;
+		}
+	}
+
+	if (!array_address)
+	{
+		LOG_ERROR("Unable to find %u bytes of physical memory for the frame descriptors.", array_size);
+		return false;
+	}
+
+	physcfg.frames = paging_allocate_region(array_address, array_size);
+	if (!physcfg.frames)
+	{
+		LOG_ERROR("Failed to map the frame descriptors into virtual memory.");
+		return false;
+	}
+
+	// Every frame starts off reserved, and only usable memory is released into the allocator
+	memset(physcfg.frames, 0, array_size);
+	for (int i = 0; i <= PHYSICAL_MAX_ORDER; i++)
+	{
+		physcfg.free_lists[i] = FRAME_NONE;
+	}
+	physcfg.free_pages		  = 0;
+	physcfg.zeroed_count	  = 0;
+	physcfg.zero_non_temporal = cpuid_supports_feature(CPU_FEATURE_SSE2, 1);
+
+	// Regions are released from the top down, so that blocks at lower addresses sit at the front of the free lists and
+	// get used first.
+	for (int i = p_region_count - 1; i >= 0; i--)
+	{
+		if (!(p_regions[i].length_blocked & 1))
+			continue;
+
+		uint64_t start = p_regions[i].base_address;
+		uint64_t end   = start + (p_regions[i].length_blocked & ~1);
+		if (end > PHYSICAL_ADDRESS_LIMIT)
+			end = PHYSICAL_ADDRESS_LIMIT;
+		if (start < p_reserved_end)
+			start = p_reserved_end;
+
+		uint32_t first = (uint32_t)((start + PAGE_SIZE - 1) >> PAGE_SHIFT);
+		uint32_t last  = (uint32_t)(end >> PAGE_SHIFT);
+		if (first >= last)
+			continue;
+
+		for (uint32_t frame = first; frame < last; frame++)
+		{
+			physcfg.frames[frame].flags = FRAME_MANAGED;
+		}
+
+		// Skip over the frames holding the descriptor array
+		uint32_t array_first = array_address >> PAGE_SHIFT;
+		uint32_t array_last	 = array_first + (array_size >> PAGE_SHIFT);
+		if (array_first >= first && array_first < last)
+		{
+			for (uint32_t frame = array_first; frame < array_last; frame++)
+			{
+				physcfg.frames[frame].flags = FRAME_RESERVED;
+			}
+
+			_p_free_range(array_last, last - array_last);
+			_p_free_range(first, array_first - first);
+			continue;
+		}
+
+		_p_free_range(first, last - first);
+	}
+
+	LOG_INFO("%u KiB of physical memory is available for allocation.", physcfg.free_pages * (PAGE_SIZE / 1024));
+	return true;
+}
+
+uint32_t physical_alloc_order(uint8_t p_order)
+{
+	// Page tables can be requested before the allocator has been set up
+	if (p_order > PHYSICAL_MAX_ORDER || !physcfg.frames)
+	{
+		return 0;
+	}
+
+	// Take the smallest block that is large enough
+	uint8_t order = p_order;
+	while (order <= PHYSICAL_MAX_ORDER && physcfg.free_lists[order] == FRAME_NONE)
+	{
+		order++;
+	}
+
+	if (order > PHYSICAL_MAX_ORDER)
+	{
+		// Frames sitting in the zeroed pool are better used than not at all
+		return _p_drain_zeroed_pool() ? physical_alloc_order(p_order) : 0;
+	}
+
+	return _p_take_block(physcfg.free_lists[order], p_order);
+}
+
+void physical_free_order(uint32_t p_address, uint8_t p_order)
+{
+	uint32_t frame = p_address >> PAGE_SHIFT;
+	if (p_order > PHYSICAL_MAX_ORDER || frame >= physcfg.frame_count || (frame & ((1 << p_order) - 1)))
+	{
+		LOG_ERROR("Attempted to free invalid physical block %x (order %u).", p_address, p_order);
+		return;
+	}
+
+	if (!(physcfg.frames[frame].flags & FRAME_MANAGED))
+	{
+		LOG_ERROR("Attempted to free physical block %x, which the allocator doesn't manage.", p_address);
+		return;
+	}
+
+	if (_p_frame_is_free(frame))
+	{
+		LOG_ERROR("Attempted to free physical block %x, which is already free.", p_address);
+		return;
+	}
+
+	physcfg.free_pages += 1 << p_order;
+
+	// Merge with the buddy block for as long as it is free and the same size
+	uint8_t order = p_order;
+	while (order < PHYSICAL_MAX_ORDER)
+	{
+		uint32_t buddy = frame ^ (1 << order);
+		if (buddy >= physcfg.frame_count || !(physcfg.frames[buddy].flags & FRAME_FREE) ||
+			physcfg.frames[buddy].order != order)
+		{
+			break;
+		}
+
+		_p_list_remove(buddy);
+		physcfg.frames[frame].flags &= FRAME_MANAGED;
+		frame &= ~(1 << order);
+		order++;
+	}
+
+	_p_list_push(frame, order);
+}
+
+uint32_t physical_alloc_pages(uint32_t p_count)
+{
+	if (p_count == 0 || p_count > (1 << PHYSICAL_MAX_ORDER))
+	{
+		return 0;
+	}
+
+	uint8_t order = 0;
+	while ((1u << order) < p_count)
+	{
+		order++;
+	}
+
+	uint32_t address = physical_alloc_order(order);
+	if (!address)
+	{
+		return 0;
+	}
+
+	// Give back whatever is left over past the end of the request
+	uint32_t frame = address >> PAGE_SHIFT;
+	_p_free_range(frame + p_count, (1 << order) - p_count);
+	return address;
+}
+
+uint32_t physical_alloc_dma_pages(uint32_t p_count)
+{
+	if (p_count == 0 || p_count > (1 << DMA_MAX_ORDER) || !physcfg.frames)
+	{
+		return 0;
+	}
+
+	uint8_t order = 0;
+	while ((1u << order) < p_count)
+	{
+		order++;
+	}
+
+	// Blocks are aligned to their size, so one of 64 KiB or less never crosses a 64 KiB boundary. The free lists
+	// aren't sorted, so each one is searched for a block that is low enough.
+	for (uint8_t o = order; o <= PHYSICAL_MAX_ORDER; o++)
+	{
+		for (uint32_t frame = physcfg.free_lists[o]; frame != FRAME_NONE; frame = physcfg.frames[frame].next)
+		{
+			if (frame + (1 << o) > DMA_FRAME_LIMIT)
+			{
+				continue;
+			}
+
+			_p_take_block(frame, order);
+			_p_free_range(frame + p_count, (1 << order) - p_count);
+			return frame << PAGE_SHIFT;
+		}
+	}
+
+	return 0;
+}
+
+void physical_free_pages(uint32_t p_address, uint32_t p_count)
+{
+	if (!p_count)
+	{
+		return;
+	}
+
+	_p_free_range(p_address >> PAGE_SHIFT, p_count);
+}
+
+uint32_t physical_get_memory_end()
+{
+	// The end of the last frame below 4 GiB doesn't fit in 32 bits
+	return (physcfg.frame_count >= (PHYSICAL_ADDRESS_LIMIT >> PAGE_SHIFT)) ? 0xfffff000
+																		  : physcfg.frame_count << PAGE_SHIFT;
+}
+
+uint32_t physical_get_free_pages()
+{
+	return physcfg.free_pages;
+}
+
+bool physical_owns_page(uint32_t p_address)
+{
+	return _p_frame_in_use(p_address >> PAGE_SHIFT);
+}
+
+bool physical_share_page(uint32_t p_address)
+{
+	uint32_t frame = p_address >> PAGE_SHIFT;
+	if (!_p_frame_in_use(frame) || physcfg.frames[frame].shares == 0xffff)
+	{
+		return false;
+	}
+
+	physcfg.frames[frame].shares++;
+	return true;
+}
+
+uint16_t physical_get_page_shares(uint32_t p_address)
+{
+	uint32_t frame = p_address >> PAGE_SHIFT;
+	return _p_frame_in_use(frame) ? physcfg.frames[frame].shares : 0;
+}
+
+bool physical_release_page(uint32_t p_address)
+{
+	uint32_t frame = p_address >> PAGE_SHIFT;
+	if (!_p_frame_in_use(frame))
+	{
+		return false;
+	}
+
+	if (physcfg.frames[frame].shares)
+	{
+		physcfg.frames[frame].shares--;
+		return false;
+	}
+
+	_p_free_range(frame, 1);
+	return true;
+}
+
+uint32_t physical_alloc_zeroed_page()
+{
+	if (!physcfg.zeroed_count)
+	{
+		return 0;
+	}
+
+	return physcfg.zeroed_pool[--physcfg.zeroed_count];
+}
+
+void physical_refill_zeroed_pages()
+{
+	// Leave the last few frames for allocations that actually need them
+	while (physcfg.zeroed_count < ZEROED_POOL_SIZE && physcfg.free_pages > ZEROED_POOL_SIZE)
+	{
+		uint32_t frame = physical_alloc_order(0);
+		void *page	   = frame ? (void *)physical_to_virtual(frame) : NULL;
+		if (!page)
+		{
+			// Only frames in the direct map can be cleared without mapping them first
+			if (frame)
+			{
+				physical_free_order(frame, 0);
+			}
+			return;
+		}
+
+		_p_zero_page(page);
+		physcfg.zeroed_pool[physcfg.zeroed_count++] = frame;
+	}
+}
+
+bool physical_initialize_high(struct AuMemoryRegion *p_regions, size_t p_region_count)
+{
+	uint64_t highest = PHYSICAL_ADDRESS_LIMIT;
+	for (int i = 0; i < p_region_count; i++)
+	{
+		if (!(p_regions[i].length_blocked & 1))
+			continue;
+
+		uint64_t end = p_regions[i].base_address + (p_regions[i].length_blocked & ~1);
+		if (end > HIGH_MEMORY_LIMIT)
+			end = HIGH_MEMORY_LIMIT;
+
+		if (end > highest)
+			highest = end;
+	}
+
+	physcfg.high_frame_count = (uint32_t)((highest - PHYSICAL_ADDRESS_LIMIT) >> PAGE_SHIFT);
+	if (!physcfg.high_frame_count)
+	{
+		return true;
+	}
+
+	// The bitmap lives in ordinary memory below 4 GiB
+	uint32_t bitmap_size = ((physcfg.high_frame_count + 31) / 32 * 4 + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	physcfg.high_bitmap	 = paging_allocate_region(0, bitmap_size);
+	if (!physcfg.high_bitmap)
+	{
+		LOG_ERROR("Unable to allocate %u bytes for the high memory bitmap.", bitmap_size);
+		physcfg.high_frame_count = 0;
+		return false;
+	}
+	memset(physcfg.high_bitmap, 0, bitmap_size);
+
+	for (int i = 0; i < p_region_count; i++)
+	{
+		if (!(p_regions[i].length_blocked & 1))
+			continue;
+
+		uint64_t start = p_regions[i].base_address;
+		uint64_t end   = start + (p_regions[i].length_blocked & ~1);
+		if (start < PHYSICAL_ADDRESS_LIMIT)
+			start = PHYSICAL_ADDRESS_LIMIT;
+		if (end > HIGH_MEMORY_LIMIT)
+			end = HIGH_MEMORY_LIMIT;
+		if (start >= end)
+			continue;
+
+		uint32_t first = (uint32_t)((start - PHYSICAL_ADDRESS_LIMIT + PAGE_SIZE - 1) >> PAGE_SHIFT);
+		uint32_t last  = (uint32_t)((end - PHYSICAL_ADDRESS_LIMIT) >> PAGE_SHIFT);
+		for (uint32_t frame = first; frame < last; frame++)
+		{
+			// Whole words at a time where possible, as there can be millions of frames
+			if (!(frame & 31) && last - frame >= 32)
+			{
+				physcfg.high_bitmap[frame / 32] = 0xffffffff;
+				physcfg.high_free_pages += 32;
+				frame += 31;
+				continue;
+			}
+
+			physcfg.high_bitmap[frame / 32] |= 1u << (frame & 31);
+			physcfg.high_free_pages++;
+		}
+	}
+
+	LOG_INFO("%u MiB of physical memory above 4 GiB is available for caches.", physcfg.high_free_pages / 256);
+	return true;
+}
+
+uint64_t physical_alloc_high_page()
+{
+	// Carry on from the word the last frame came from, so a mostly full bitmap isn't scanned from the start every time
+	uint32_t words = (physcfg.high_frame_count + 31) / 32;
+	for (uint32_t i = 0; i < words; i++)
+	{
+		uint32_t word = (physcfg.high_cursor + i) % words;
+		if (!physcfg.high_bitmap[word])
+			continue;
+
+		uint32_t bit = __builtin_ctz(physcfg.high_bitmap[word]);
+		physcfg.high_bitmap[word] &= ~(1u << bit);
+		physcfg.high_free_pages--;
+		physcfg.high_cursor = word;
+		return PHYSICAL_ADDRESS_LIMIT + ((uint64_t)(word * 32 + bit) << PAGE_SHIFT);
+	}
+
+	return 0;
+}
+
+void physical_free_high_page(uint64_t p_address)
+{
+	uint64_t frame = (p_address - PHYSICAL_ADDRESS_LIMIT) >> PAGE_SHIFT;
+	if (p_address < PHYSICAL_ADDRESS_LIMIT || frame >= physcfg.high_frame_count || (p_address & (PAGE_SIZE - 1)))
+	{
+		LOG_ERROR("Attempted to free invalid high memory frame %llx.", p_address);
+		return;
+	}
+
+	uint32_t bit = 1u << (frame & 31);
+	if (physcfg.high_bitmap[frame / 32] & bit)
+	{
+		LOG_ERROR("Attempted to free high memory frame %llx, which is already free.", p_address);
+		return;
+	}
+
+	physcfg.high_bitmap[frame / 32] |= bit;
+	physcfg.high_free_pages++;
+}
+
+uint32_t physical_get_free_high_pages()
+{
+	return physcfg.high_free_pages;
+}
+
+/**
+ * @brief Clears a page to zero. Pages are cleared well before they are used, so where the CPU has SSE2 the stores
+ * bypass the cache instead of pushing out data that is still needed.
+ * @param p_page The virtual address of the page
+ */
+static void _p_zero_page(void *p_page)
+{
+	if (!physcfg.zero_non_temporal)
+	{
+		memset(p_page, 0, PAGE_SIZE);
+		return;
+	}
+
+	// MOVNTI works on general purpose registers, so unlike MOVNTDQ it doesn't need the SSE state to be enabled
+	uint32_t *words = p_page;
+	for (int i = 0; i < PAGE_SIZE / 4; i++)
+	{
+		__asm__ volatile("movnti %1, %0" : "=m"(words[i]) : "r"(0));
+	}
+	__asm__ volatile("sfence" : : : "memory");
+}
+
+/**
+ * @brief Gives every frame in the zeroed pool back to the allocator.
+ * @return `true` if any frames were given back, and `false` if the pool was already empty.
+ */
+static bool _p_drain_zeroed_pool()
+{
+	if (!physcfg.zeroed_count)
+	{
+		return false;
+	}
+
+	while (physcfg.zeroed_count)
+	{
+		physical_free_order(physcfg.zeroed_pool[--physcfg.zeroed_count], 0);
+	}
+	return true;
+}
+
+/**
+ * @brief Adds a block to the front of the free list for its order.
+ * @param p_frame The first frame of the block
+ * @param p_order The order of the block
+ */
+static void _p_list_push(uint32_t p_frame, uint8_t p_order)
+{
+	struct PhysicalFrame *f = &physcfg.frames[p_frame];
+	f->order				= p_order;
+	f->flags				= FRAME_MANAGED | FRAME_FREE;
+	f->prev					= FRAME_NONE;
+	f->next					= physcfg.free_lists[p_order];
+
+	if (f->next != FRAME_NONE)
+	{
+		physcfg.frames[f->next].prev = p_frame;
+	}
+	physcfg.free_lists[p_order] = p_frame;
+}
+
+/**
+ * @brief Takes a free block off of the free list for its order.
+ * @param p_frame The first frame of the block
+ */
+static void _p_list_remove(uint32_t p_frame)
+{
+	struct PhysicalFrame *f = &physcfg.frames[p_frame];
+	if (f->prev != FRAME_NONE)
+	{
+		physcfg.frames[f->prev].next = f->next;
+	}
+	else
+	{
+		physcfg.free_lists[f->order] = f->next;
+	}
+
+	if (f->next != FRAME_NONE)
+	{
+		physcfg.frames[f->next].prev = f->prev;
+	}
+
+	f->flags &= FRAME_MANAGED;
+	f->next = FRAME_NONE;
+	f->prev = FRAME_NONE;
+}
+
+/**
+ * @brief Takes a free block off of its list and splits it down to the requested size, handing the upper halves back
+ * to the allocator.
+ * @param p_frame The first frame of the free block
+ * @param p_order The order of the allocation, which must not be larger than the block
+ * @return The physical address of the allocation, which starts at the same frame as the block.
+ */
+static uint32_t _p_take_block(uint32_t p_frame, uint8_t p_order)
+{
+	uint8_t order = physcfg.frames[p_frame].order;
+	_p_list_remove(p_frame);
+
+	while (order > p_order)
+	{
+		order--;
+		_p_list_push(p_frame + (1 << order), order);
+	}
+
+	physcfg.frames[p_frame].order = p_order;
+	physcfg.frames[p_frame].flags = FRAME_MANAGED | FRAME_ALLOCATED;
+	physcfg.free_pages -= 1 << p_order;
+	return p_frame << PAGE_SHIFT;
+}
+
+/**
+ * @brief Frees an arbitrary run of frames by splitting it into the largest aligned blocks that fit. Blocks are freed
+ * from the end of the run backwards, so the lowest block ends up at the front of its free list.
+ * @param p_frame The first frame of the run
+ * @param p_count The number of frames in the run
+ */
+static void _p_free_range(uint32_t p_frame, uint32_t p_count)
+{
+	uint32_t end = p_frame + p_count;
+	while (end > p_frame)
+	{
+		uint8_t order = 0;
+		while (order < PHYSICAL_MAX_ORDER && (end & ((2u << order) - 1)) == 0 && (2u << order) <= end - p_frame)
+		{
+			order++;
+		}
+
+		end -= 1 << order;
+		physical_free_order(end << PAGE_SHIFT, order);
+	}
+}
+
+/**
+ * @brief Checks whether a frame is part of a free block. Only the first frame of a block is marked, so each block that
+ * could hold the frame is looked at in turn.
+ * @param p_frame The frame to check
+ * @return `true` if the frame is free, and `false` if not.
+ */
+static bool _p_frame_is_free(uint32_t p_frame)
+{
+	for (uint8_t order = 0; order <= PHYSICAL_MAX_ORDER; order++)
+	{
+		struct PhysicalFrame *head = &physcfg.frames[p_frame & ~((1u << order) - 1)];
+		if ((head->flags & FRAME_FREE) && head->order >= order)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Checks whether a frame has been handed out by the allocator. Reserved memory, such as the kernel image and
+ * device memory, never has been.
+ * @param p_frame The frame to check
+ * @return `true` if the frame is allocated, and `false` if it is free or isn't managed by the allocator.
+ */
+static bool _p_frame_in_use(uint32_t p_frame)
+{
+	return p_frame < physcfg.frame_count && (physcfg.frames[p_frame].flags & FRAME_MANAGED) &&
+		   !_p_frame_is_free(p_frame);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest block the physical allocator deals in is 2^PHYSICAL_MAX_ORDER pages (4 MiB).
+#define PHYSICAL_MAX_ORDER 10
+
+struct AuMemoryRegion
+{
+	uint64_t base_address;	 // The starting physical address of the region
+	uint64_t length_blocked; // The length of the region, assuming it is aligned
+							 // to a power of 2 greater than 1.
+};
+
+/**
+ * @brief Sets up the buddy allocator for physical page frames. Every usable region of the memory map above the given
+ * address is handed to the allocator, and everything below it is treated as already in use.
+ * @param p_regions The merged memory map to build the allocator from. Regions with bit 0 of their length set are
+ * usable.
+ * @param p_region_count The number of regions in the map
+ * @param p_reserved_end The first physical address that has not already been claimed by the kernel during boot
+ * @return `true` if the allocator was set up, and `false` if not.
+ */
+bool physical_initialize(struct AuMemoryRegion *p_regions, size_t p_region_count, uint32_t p_reserved_end);
+
+/**
+ * @brief Allocates a block of 2^N physically contiguous page frames, aligned to its own size.
+ * @param p_order The order of the block, up to `PHYSICAL_MAX_ORDER`
+ * @return The physical address of the block, or 0 if no block of that size is free.
+ */
+uint32_t physical_alloc_order(uint8_t p_order);
+
+/**
+ * @brief Returns a block of 2^N page frames to the allocator, merging it with its buddies where possible.
+ * @param p_address The physical address of the block
+ * @param p_order The order the block was allocated with
+ */
+void physical_free_order(uint32_t p_address, uint8_t p_order);
+
+/**
+ * @brief Allocates N physically contiguous page frames. Any frames beyond N in the underlying power-of-two block are
+ * returned to the allocator straight away.
+ * @param p_count The number of 4 KiB frames needed
+ * @return The physical address of the first frame, or 0 if there is no run of frames long enough.
+ */
+uint32_t physical_alloc_pages(uint32_t p_count);
+
+/**
+ * @brief Allocates N physically contiguous page frames that ISA DMA can reach, which means below 16 MiB and without
+ * crossing a 64 KiB boundary. Free them with `physical_free_pages()`.
+ * @param p_count The number of 4 KiB frames needed, at most 16.
+ * @return The physical address of the first frame, or 0 if no free run of frames is low enough.
+ */
+uint32_t physical_alloc_dma_pages(uint32_t p_count);
+
+/**
+ * @brief Returns N contiguous page frames to the allocator. The range does not need to match a single allocation, so
+ * callers may give back part of what they were handed.
+ * @param p_address The physical address of the first frame
+ * @param p_count The number of 4 KiB frames to free
+ */
+void physical_free_pages(uint32_t p_address, uint32_t p_count);
+
+/**
+ * @brief Gets the end of the highest usable memory that the allocator manages.
+ * @return The physical address just past the last frame, capped at the last page below 4 GiB.
+ */
+uint32_t physical_get_memory_end();
+
+/**
+ * @brief Gets the number of page frames that are currently free.
+ * @return The number of free 4 KiB frames.
+ */
+uint32_t physical_get_free_pages();
+
+/**
+ * @brief Checks whether a frame was handed out by the allocator and hasn't been freed since. Reserved memory, such as
+ * the kernel image and device memory, is never owned by the allocator.
+ * @param p_address The physical address of the frame
+ * @return `true` if the frame is allocated, and `false` if not.
+ */
+bool physical_owns_page(uint32_t p_address);
+
+/**
+ * @brief Records that another address space maps a frame, so that it isn't freed until every one of them is done with
+ * it.
+ * @param p_address The physical address of the frame
+ * @return `true` if the share was recorded, and `false` if the allocator doesn't manage the frame.
+ */
+bool physical_share_page(uint32_t p_address);
+
+/**
+ * @brief Gets the number of address spaces that map a frame besides the first.
+ * @param p_address The physical address of the frame
+ * @return The number of extra mappings, which is 0 for frames that aren't shared or aren't managed by the allocator.
+ */
+uint16_t physical_get_page_shares(uint32_t p_address);
+
+/**
+ * @brief Drops a single mapping of a frame. Shared frames lose a share, and the frame is freed once nothing else maps
+ * it. Frames the allocator doesn't own, as reported by `physical_owns_page()`, are left alone.
+ * @param p_address The physical address of the frame
+ * @return `true` if the frame was freed, and `false` if not.
+ */
+bool physical_release_page(uint32_t p_address);
+
+/**
+ * @brief Takes a page frame from the pool of frames that have already been cleared to zero.
+ * @return The physical address of the frame, or 0 if the pool is empty, in which case the caller has to clear a frame
+ * from `physical_alloc_pages()` itself.
+ */
+uint32_t physical_alloc_zeroed_page();
+
+/**
+ * @brief Clears free frames to zero until the pool of zeroed frames is full. Meant to be called while the CPU has
+ * nothing else to do, so that allocations don't have to clear memory themselves.
+ */
+void physical_refill_zeroed_pages();
+
+/**
+ * @brief Sets up the allocator for memory above 4 GiB, which can only be reached with PAE paging. Frames are handed
+ * out one at a time, and are never part of the direct map, so they suit caches that map them through
+ * `paging_map_high_page()` as needed.
+ * @param p_regions The merged memory map, as given to `physical_initialize()`
+ * @param p_region_count The number of regions in the map
+ * @return `true` if the allocator was set up, or there is no memory above 4 GiB, and `false` if not.
+ */
+bool physical_initialize_high(struct AuMemoryRegion *p_regions, size_t p_region_count);
+
+/**
+ * @brief Allocates a single page frame above 4 GiB.
+ * @return The physical address of the frame, or 0 if none are free.
+ */
+uint64_t physical_alloc_high_page();
+
+/**
+ * @brief Returns a page frame from `physical_alloc_high_page()` to the allocator.
+ * @param p_address The physical address of the frame
+ */
+void physical_free_high_page(uint64_t p_address);
+
+/**
+ * @brief Gets the number of page frames above 4 GiB that are currently free.
+ * @return The number of free 4 KiB frames.
+ */
+uint32_t physical_get_free_high_pages();
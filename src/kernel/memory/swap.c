@@ -0,0 +1,162 @@
+#include "swap.h"
+#include "physical.h"
+
+#include <aurora/hal/hal.h>
+#include <aurora/memdefs.h>
+#include <aurora/memory.h>
+
+#include <asm/io.h>
+
+#define AUR_MODULE "swap"
+#include <aurora/debug.h>
+
+#include <string.h>
+
+#define PAGE_SIZE		 0x1000
+#define SECTOR_SIZE		 512
+#define SECTORS_PER_SLOT (PAGE_SIZE / SECTOR_SIZE)
+
+// The HAL takes 16-bit LBAs, so nothing past the first 32 MiB of a drive can be used
+#define SWAP_MAX_SECTORS 0x10000
+#define SWAP_MAX_SLOTS	 (SWAP_MAX_SECTORS / SECTORS_PER_SLOT)
+
+// The last two bytes of a boot sector
+#define BOOT_SIGNATURE 0xaa55
+
+struct SwapConfig
+{
+	bool enabled;						// Whether a swap area has been set up
+	uint8_t drive;						// Drive the area is on
+	uint16_t lba;						// First sector of the area
+	uint32_t slot_count;				// Number of slots in the area, including slot 0 which is never used
+	uint32_t free_slots;				// Number of slots that don't hold a page
+	uint32_t next_slot;					// Slot to start looking for a free one from
+	uint32_t bounce;					// Physical address of the page that every transfer goes through
+	uint32_t used[SWAP_MAX_SLOTS / 32]; // Bitmap of the slots that hold a page
+};
+
+static struct SwapConfig swapcfg = {0};
+
+/**
+ * @brief Moves a page between the bounce buffer and the swap area. The drive signals that it is done through an
+ * interrupt, so interrupts are enabled for the transfer even when it comes from the page fault handler. Slots are
+ * read back at most once for each time they are written, so reads skip the block cache rather than filling it.
+ * @param p_slot The slot to transfer
+ * @param p_write Whether to write the bounce buffer to the slot, rather than read the slot into it.
+ * @return `true` if the transfer succeeded, and `false` if not.
+ */
+static bool _s_transfer(uint32_t p_slot, bool p_write)
+{
+	uint16_t lba  = swapcfg.lba + p_slot * SECTORS_PER_SLOT;
+	void *bounce  = (void *)physical_to_virtual(swapcfg.bounce);
+	uint32_t mask = interrupts_enable_save();
+	bool ret	  = p_write ? hal_write_bytes(swapcfg.drive, lba, bounce, PAGE_SIZE)
+							: hal_read_bytes_uncached(swapcfg.drive, lba, bounce, PAGE_SIZE) != NULL;
+	interrupts_restore(mask);
+	return ret;
+}
+
+bool swap_initialize(uint8_t p_drive, uint16_t p_lba, uint32_t p_sector_count)
+{
+	uint32_t slots = AMIN(p_sector_count, SWAP_MAX_SECTORS - p_lba) / SECTORS_PER_SLOT;
+	if (slots < 2)
+	{
+		LOG_ERROR("Swap area of %u sectors on drive %hhu is too small.", p_sector_count, p_drive);
+		return false;
+	}
+
+	uint32_t bounce = physical_alloc_dma_pages(1);
+	if (!bounce)
+	{
+		LOG_ERROR("Failed to allocate a buffer for swap that DMA can reach.");
+		return false;
+	}
+
+	swapcfg.drive  = p_drive;
+	swapcfg.lba	   = p_lba;
+	swapcfg.bounce = bounce;
+
+	// Anything with a boot sector is a real disk, which swapping onto would destroy
+	uint8_t *sector = (uint8_t *)physical_to_virtual(bounce);
+	if (!_s_transfer(0, false) || *(uint16_t *)(sector + SECTOR_SIZE - 2) == BOOT_SIGNATURE)
+	{
+		LOG_ERROR("Drive %hhu can't be read or has a boot sector, so it won't be used for swap.", p_drive);
+		physical_free_pages(bounce, 1);
+		return false;
+	}
+
+	// Slot 0 stands for no slot, so it is marked as used from the start
+	memset(swapcfg.used, 0, sizeof(swapcfg.used));
+	swapcfg.used[0]	   = 1;
+	swapcfg.slot_count = slots;
+	swapcfg.free_slots = slots - 1;
+	swapcfg.next_slot  = 1;
+	swapcfg.enabled	   = true;
+	LOG_INFO("Using %u KiB of drive %hhu for swap.", swapcfg.free_slots * PAGE_SIZE / KIBIBYTES_TO_BYTES, p_drive);
+	return true;
+}
+
+bool swap_is_enabled()
+{
+	return swapcfg.enabled;
+}
+
+uint32_t swap_write_page(const void *p_page)
+{
+	if (!swapcfg.enabled || !swapcfg.free_slots)
+	{
+		return 0;
+	}
+
+	// Slots are handed out round-robin, so that pages evicted together end up next to each other on the disk
+	uint32_t slot = swapcfg.next_slot;
+	while (swapcfg.used[slot / 32] & (1u << (slot % 32)))
+	{
+		slot = (slot + 1 < swapcfg.slot_count) ? slot + 1 : 1;
+	}
+
+	memcpy((void *)physical_to_virtual(swapcfg.bounce), p_page, PAGE_SIZE);
+	if (!_s_transfer(slot, true))
+	{
+		LOG_ERROR("Failed to write a page to swap slot %u.", slot);
+		return 0;
+	}
+
+	swapcfg.used[slot / 32] |= 1u << (slot % 32);
+	swapcfg.free_slots--;
+	swapcfg.next_slot = (slot + 1 < swapcfg.slot_count) ? slot + 1 : 1;
+	return slot;
+}
+
+bool swap_read_page(uint32_t p_slot, void *p_page)
+{
+	if (!swapcfg.enabled || !p_slot || p_slot >= swapcfg.slot_count)
+	{
+		return false;
+	}
+
+	if (!_s_transfer(p_slot, false))
+	{
+		LOG_ERROR("Failed to read swap slot %u.", p_slot);
+		return false;
+	}
+
+	memcpy(p_page, (void *)physical_to_virtual(swapcfg.bounce), PAGE_SIZE);
+	return true;
+}
+
+void swap_free_slot(uint32_t p_slot)
+{
+	if (!p_slot || p_slot >= swapcfg.slot_count || !(swapcfg.used[p_slot / 32] & (1u << (p_slot % 32))))
+	{
+		return;
+	}
+
+	swapcfg.used[p_slot / 32] &= ~(1u << (p_slot % 32));
+	swapcfg.free_slots++;
+}
+
+uint32_t swap_get_free_slots()
+{
+	return swapcfg.enabled ? swapcfg.free_slots : 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Sets up a range of sectors on a drive as the swap area, which pages of swappable regions are written out to
+ * once physical memory runs low. Transfers go through the HAL and wait on the drive with interrupts enabled, so
+ * nothing that runs with interrupts off may touch swappable memory.
+ * @param p_drive The drive the area is on
+ * @param p_lba The first sector of the area. The first page of the area is never written to, and the area is refused
+ * if it starts with a boot sector.
+ * @param p_sector_count The number of sectors in the area
+ * @return `true` if swap is now enabled, and `false` if the area can't be used.
+ */
+bool swap_initialize(uint8_t p_drive, uint16_t p_lba, uint32_t p_sector_count);
+
+/**
+ * @brief Checks whether a swap area has been set up.
+ * @return `true` if pages can be swapped out, and `false` if not.
+ */
+bool swap_is_enabled();
+
+/**
+ * @brief Writes a page out to a free slot of the swap area.
+ * @param p_page The virtual address of the page, aligned to 4 KiB.
+ * @return The slot the page was written to, or 0 if the area is full or the write failed. Slots are numbered from 1.
+ */
+uint32_t swap_write_page(const void *p_page);
+
+/**
+ * @brief Reads a page back from the swap area. The slot stays in use until it is freed.
+ * @param p_slot The slot the page was written to
+ * @param p_page The virtual address to read the page into, aligned to 4 KiB.
+ * @return `true` if the page was read, and `false` if not.
+ */
+bool swap_read_page(uint32_t p_slot, void *p_page);
+
+/**
+ * @brief Gives a slot back to the swap area once the page in it is no longer needed.
+ * @param p_slot The slot to free
+ */
+void swap_free_slot(uint32_t p_slot);
+
+/**
+ * @brief Gets the number of slots in the swap area that don't hold a page.
+ * @return The number of free slots, or 0 if swap is not enabled.
+ */
+uint32_t swap_get_free_slots();
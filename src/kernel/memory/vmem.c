@@ -0,0 +1,486 @@
+#include "vmem.h"
+
+#include <aurora/kdefs.h>
+#include <aurora/memdefs.h>
+
+#define AUR_MODULE "vmem"
+#include <aurora/debug.h>
+
+#define PAGE_SIZE 0x1000
+
+#define ALIGN(m_addr, m_bytes) ((m_addr + (m_bytes - 1)) & ~(m_bytes - 1))
+
+// Kernel memory stops where the page tables are mapped
+#define VMEM_KERNEL_END RECURSIVE_MAP_VIRTUAL_ADDRESS
+
+// Number of free extents that can exist at once across both spaces. Each one is a gap between two reservations, so
+// this is only reached if the address space is badly fragmented.
+#define VMEM_EXTENT_COUNT 512
+
+// A run of free virtual addresses. Extents are kept in an AVL tree ordered by address, where every node also knows
+// the largest extent below it, so that a fitting extent can be found without visiting the rest of the tree.
+struct VmemExtent
+{
+	struct VmemExtent *left;  // Subtree of extents at lower addresses, or the next unused extent in the pool
+	struct VmemExtent *right; // Subtree of extents at higher addresses
+	uint32_t start;			  // First address of the extent
+	uint32_t size;			  // Number of bytes in the extent
+	uint32_t largest;		  // Size of the largest extent in the subtree rooted here
+	uint8_t height;			  // Height of the subtree rooted here
+};
+
+struct VmemRange
+{
+	struct VmemExtent *root; // Root of the tree of free extents in the space
+	uint32_t start;			 // First address of the space
+	uint32_t end;			 // First address past the end of the space
+};
+
+struct VmemConfig
+{
+	struct VmemRange spaces[VMEM_SPACE_COUNT]; // The ranges addresses can be reserved from
+	struct VmemExtent *unused;				   // First extent in the pool that isn't in a tree
+	struct VmemExtent pool[VMEM_EXTENT_COUNT]; // Storage for every extent, as the heap is built on top of this
+};
+
+static struct VmemConfig vmemcfg = {0};
+
+/* TREE */
+
+static inline uint8_t _v_height(struct VmemExtent *p_node)
+{
+	return p_node ? p_node->height : 0;
+}
+
+static inline uint32_t _v_largest(struct VmemExtent *p_node)
+{
+	return p_node ? p_node->largest : 0;
+}
+
+/**
+ * @brief Recalculates the height and largest extent of a node from its children.
+ * @param p_node The node to update
+ */
+static void _v_update(struct VmemExtent *p_node)
+{
+	uint8_t left   = _v_height(p_node->left);
+	uint8_t right  = _v_height(p_node->right);
+	p_node->height = ((left > right) ? left : right) + 1;
+
+	uint32_t largest = p_node->size;
+	largest			 = AMAX(largest, _v_largest(p_node->left));
+	largest			 = AMAX(largest, _v_largest(p_node->right));
+	p_node->largest	 = largest;
+}
+
+static struct VmemExtent *_v_rotate_left(struct VmemExtent *p_node)
+{
+	struct VmemExtent *right = p_node->right;
+	p_node->right			 = right->left;
+	right->left				 = p_node;
+	_v_update(p_node);
+	_v_update(right);
+	return right;
+}
+
+static struct VmemExtent *_v_rotate_right(struct VmemExtent *p_node)
+{
+	struct VmemExtent *left = p_node->left;
+	p_node->left			= left->right;
+	left->right				= p_node;
+	_v_update(p_node);
+	_v_update(left);
+	return left;
+}
+
+/**
+ * @brief Updates a node whose subtrees have changed, and rotates it if they now differ in height by more than one.
+ * @param p_node The node to balance
+ * @return The node that has taken its place in the tree.
+ */
+static struct VmemExtent *_v_balance(struct VmemExtent *p_node)
+{
+	_v_update(p_node);
+	int balance = (int)_v_height(p_node->left) - (int)_v_height(p_node->right);
+	if (balance > 1)
+	{
+		if (_v_height(p_node->left->left) < _v_height(p_node->left->right))
+		{
+			p_node->left = _v_rotate_left(p_node->left);
+		}
+		return _v_rotate_right(p_node);
+	}
+
+	if (balance < -1)
+	{
+		if (_v_height(p_node->right->right) < _v_height(p_node->right->left))
+		{
+			p_node->right = _v_rotate_right(p_node->right);
+		}
+		return _v_rotate_left(p_node);
+	}
+
+	return p_node;
+}
+
+static struct VmemExtent *_v_insert(struct VmemExtent *p_root, struct VmemExtent *p_node)
+{
+	if (!p_root)
+	{
+		return p_node;
+	}
+
+	if (p_node->start < p_root->start)
+	{
+		p_root->left = _v_insert(p_root->left, p_node);
+	}
+	else
+	{
+		p_root->right = _v_insert(p_root->right, p_node);
+	}
+
+	return _v_balance(p_root);
+}
+
+/**
+ * @brief Takes the lowest extent out of a subtree.
+ * @param p_root The root of the subtree
+ * @param out_min The extent that was taken out
+ * @return The new root of the subtree.
+ */
+static struct VmemExtent *_v_remove_min(struct VmemExtent *p_root, struct VmemExtent **out_min)
+{
+	if (!p_root->left)
+	{
+		*out_min = p_root;
+		return p_root->right;
+	}
+
+	p_root->left = _v_remove_min(p_root->left, out_min);
+	return _v_balance(p_root);
+}
+
+/**
+ * @brief Takes an extent out of a subtree. The extent itself is left untouched.
+ * @param p_root The root of the subtree
+ * @param p_node The extent to take out, which must be in the subtree.
+ * @return The new root of the subtree.
+ */
+static struct VmemExtent *_v_remove(struct VmemExtent *p_root, struct VmemExtent *p_node)
+{
+	if (p_root != p_node)
+	{
+		if (p_node->start < p_root->start)
+		{
+			p_root->left = _v_remove(p_root->left, p_node);
+		}
+		else
+		{
+			p_root->right = _v_remove(p_root->right, p_node);
+		}
+		return _v_balance(p_root);
+	}
+
+	if (!p_root->left || !p_root->right)
+	{
+		return p_root->left ? p_root->left : p_root->right;
+	}
+
+	// The next extent up takes the removed one's place
+	struct VmemExtent *next	 = NULL;
+	struct VmemExtent *right = _v_remove_min(p_root->right, &next);
+	next->left				 = p_root->left;
+	next->right				 = right;
+	return _v_balance(next);
+}
+
+/**
+ * @brief Finds the lowest extent of at least a given size.
+ * @param p_root The root of the tree to search
+ * @param p_size The smallest size the extent can have
+ * @return The extent, or `NULL` if none are large enough.
+ */
+static struct VmemExtent *_v_find_fit(struct VmemExtent *p_root, uint32_t p_size)
+{
+	struct VmemExtent *node = p_root;
+	while (node)
+	{
+		if (_v_largest(node->left) >= p_size)
+		{
+			node = node->left;
+		}
+		else if (node->size >= p_size)
+		{
+			return node;
+		}
+		else if (_v_largest(node->right) >= p_size)
+		{
+			node = node->right;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Finds an extent that shares at least one address with a range.
+ * @param p_root The root of the tree to search
+ * @param p_start The first address of the range
+ * @param p_end The first address past the end of the range
+ * @return The extent, or `NULL` if the whole range is reserved.
+ */
+static struct VmemExtent *_v_find_overlap(struct VmemExtent *p_root, uint32_t p_start, uint32_t p_end)
+{
+	struct VmemExtent *node = p_root;
+	while (node)
+	{
+		if (node->start + node->size <= p_start)
+		{
+			node = node->right;
+		}
+		else if (node->start >= p_end)
+		{
+			node = node->left;
+		}
+		else
+		{
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+/* EXTENTS */
+
+/**
+ * @brief Gets the space that an address belongs to.
+ * @param p_address The address to look up
+ * @return The space, or `NULL` if the address isn't managed by the allocator.
+ */
+static struct VmemRange *_v_space_of(uint32_t p_address)
+{
+	for (int i = 0; i < VMEM_SPACE_COUNT; i++)
+	{
+		struct VmemRange *space = &vmemcfg.spaces[i];
+		if (p_address >= space->start && p_address < space->end)
+		{
+			return space;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Adds a free extent to a space, without merging it with its neighbours.
+ * @param p_space The space to add the extent to
+ * @param p_start The first address of the extent
+ * @param p_size The size of the extent in bytes
+ * @return `true` if the extent was added, and `false` if the pool has run out.
+ */
+static bool _v_add_extent(struct VmemRange *p_space, uint32_t p_start, uint32_t p_size)
+{
+	struct VmemExtent *extent = vmemcfg.unused;
+	if (!extent)
+	{
+		LOG_ERROR("Out of virtual memory extents, %u bytes at %x can't be used again.", p_size, p_start);
+		return false;
+	}
+	vmemcfg.unused = extent->left;
+
+	extent->left	= NULL;
+	extent->right	= NULL;
+	extent->start	= p_start;
+	extent->size	= p_size;
+	extent->largest = p_size;
+	extent->height	= 1;
+	p_space->root	= _v_insert(p_space->root, extent);
+	return true;
+}
+
+/**
+ * @brief Takes a free extent out of a space and puts it back in the pool.
+ * @param p_space The space the extent is in
+ * @param p_extent The extent to remove
+ */
+static void _v_remove_extent(struct VmemRange *p_space, struct VmemExtent *p_extent)
+{
+	p_space->root  = _v_remove(p_space->root, p_extent);
+	p_extent->left = vmemcfg.unused;
+	vmemcfg.unused = p_extent;
+}
+
+/**
+ * @brief Reserves part of a free extent, leaving whatever is on either side of it free.
+ * @param p_space The space the extent is in
+ * @param p_extent The extent to reserve from
+ * @param p_start The first address to reserve, which must be inside the extent.
+ * @param p_size The number of bytes to reserve, which must fit inside the extent.
+ * @return `true` if the range was reserved, and `false` if the pool had no room to split the extent.
+ */
+static bool _v_carve(struct VmemRange *p_space, struct VmemExtent *p_extent, uint32_t p_start, uint32_t p_size)
+{
+	uint32_t before = p_start - p_extent->start;
+	uint32_t after	= p_extent->start + p_extent->size - (p_start + p_size);
+	if (before && after && !vmemcfg.unused)
+	{
+		LOG_ERROR("Out of virtual memory extents, unable to reserve %u bytes at %x.", p_size, p_start);
+		return false;
+	}
+
+	uint32_t start = p_extent->start;
+	_v_remove_extent(p_space, p_extent);
+	if (before)
+	{
+		_v_add_extent(p_space, start, before);
+	}
+	if (after)
+	{
+		_v_add_extent(p_space, p_start + p_size, after);
+	}
+	return true;
+}
+
+void vmem_initialize(uint32_t p_kernel_start)
+{
+	vmemcfg.unused = NULL;
+	for (int i = VMEM_EXTENT_COUNT - 1; i >= 0; i--)
+	{
+		vmemcfg.pool[i].left = vmemcfg.unused;
+		vmemcfg.unused		 = &vmemcfg.pool[i];
+	}
+
+	struct VmemRange *kernel = &vmemcfg.spaces[VMEM_SPACE_KERNEL];
+	kernel->root			 = NULL;
+	kernel->start			 = p_kernel_start;
+	kernel->end				 = VMEM_KERNEL_END;
+	_v_add_extent(kernel, kernel->start, kernel->end - kernel->start);
+
+	struct VmemRange *user = &vmemcfg.spaces[VMEM_SPACE_USER];
+	user->root			   = NULL;
+	user->start			   = USER_ALLOC_VIRTUAL_ADDRESS;
+	user->end			   = USER_ALLOC_END_VIRTUAL_ADDRESS;
+	_v_add_extent(user, user->start, user->end - user->start);
+}
+
+uint32_t vmem_reserve(enum VmemSpace p_space, uint32_t p_size, uint32_t p_alignment)
+{
+	if (p_space >= VMEM_SPACE_COUNT || !p_size || (p_alignment & (p_alignment - 1)))
+	{
+		return 0;
+	}
+
+	p_size		= ALIGN(p_size, PAGE_SIZE);
+	p_alignment = AMAX(p_alignment, PAGE_SIZE);
+
+	// Asking for the worst-case padding up front means any extent the search finds will fit, so it never has to
+	// backtrack. The cost is that an extent that would only fit because it happens to be aligned already is skipped.
+	uint32_t needed = p_size + p_alignment - PAGE_SIZE;
+	if (needed < p_size)
+	{
+		return 0;
+	}
+
+	struct VmemRange *space	  = &vmemcfg.spaces[p_space];
+	struct VmemExtent *extent = _v_find_fit(space->root, needed);
+	if (!extent)
+	{
+		return 0;
+	}
+
+	uint32_t start = ALIGN(extent->start, p_alignment);
+	return _v_carve(space, extent, start, p_size) ? start : 0;
+}
+
+bool vmem_reserve_at(uint32_t p_address, uint32_t p_size)
+{
+	struct VmemRange *space = _v_space_of(p_address);
+	if (!space || !p_size)
+	{
+		return false;
+	}
+
+	p_size					  = ALIGN(p_size, PAGE_SIZE);
+	struct VmemExtent *extent = _v_find_overlap(space->root, p_address, p_address + p_size);
+	if (!extent || extent->start > p_address || p_size > extent->start + extent->size - p_address)
+	{
+		return false;
+	}
+
+	return _v_carve(space, extent, p_address, p_size);
+}
+
+void vmem_claim(uint32_t p_address, uint32_t p_size)
+{
+	if (!p_size)
+	{
+		return;
+	}
+
+	uint32_t start = p_address & ~(PAGE_SIZE - 1);
+	uint32_t end   = ALIGN(p_address + p_size, PAGE_SIZE);
+	if (end <= start)
+	{
+		end = 0xfffff000;
+	}
+
+	for (int i = 0; i < VMEM_SPACE_COUNT; i++)
+	{
+		struct VmemRange *space = &vmemcfg.spaces[i];
+		struct VmemExtent *extent;
+		while ((extent = _v_find_overlap(space->root, start, end)))
+		{
+			uint32_t first = AMAX(start, extent->start);
+			uint32_t last  = extent->start + extent->size;
+			last		   = AMIN(end, last);
+			if (!_v_carve(space, extent, first, last - first))
+			{
+				break;
+			}
+		}
+	}
+}
+
+void vmem_release(uint32_t p_address, uint32_t p_size)
+{
+	struct VmemRange *space = _v_space_of(p_address);
+	if (!space || !p_size)
+	{
+		return;
+	}
+
+	uint32_t start = p_address;
+	uint32_t end   = ALIGN(p_address + p_size, PAGE_SIZE);
+	if (end > space->end || end <= start)
+	{
+		end = space->end;
+	}
+
+	if (_v_find_overlap(space->root, start, end))
+	{
+		LOG_WARNING("Virtual memory at %x was released while part of it is already free.", start);
+		return;
+	}
+
+	// Merge with the free extents directly before and after the range
+	struct VmemExtent *prev = (start > space->start) ? _v_find_overlap(space->root, start - 1, start) : NULL;
+	if (prev)
+	{
+		start = prev->start;
+		_v_remove_extent(space, prev);
+	}
+
+	struct VmemExtent *next = (end < space->end) ? _v_find_overlap(space->root, end, end + 1) : NULL;
+	if (next)
+	{
+		end = next->start + next->size;
+		_v_remove_extent(space, next);
+	}
+
+	_v_add_extent(space, start, end - start);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Ranges of virtual memory that addresses can be reserved from
+enum VmemSpace
+{
+	VMEM_SPACE_KERNEL = 0, // From the end of the kernel image up to `RECURSIVE_MAP_VIRTUAL_ADDRESS`
+	VMEM_SPACE_USER	  = 1, // From `USER_ALLOC_VIRTUAL_ADDRESS` up to `USER_ALLOC_END_VIRTUAL_ADDRESS`
+	VMEM_SPACE_COUNT,
+};
+
+/**
+ * @brief Sets up the virtual address allocator, with both address spaces entirely free.
+ * @param p_kernel_start The first address after the kernel image, where kernel memory can be reserved from. Must be
+ * aligned to 4 KiB.
+ */
+void vmem_initialize(uint32_t p_kernel_start);
+
+/**
+ * @brief Reserves a range of unused virtual addresses. The lowest range that is sure to fit the request is used.
+ * @param p_space The address space to reserve the range from
+ * @param p_size The size of the range in bytes, rounded up to 4 KiB.
+ * @param p_alignment The alignment of the range as a power of 2, or 0 for 4 KiB. Ranges aligned to more than 4 KiB are
+ * taken from the first free extent that can hold the range however it is aligned.
+ * @return The first address of the range, or 0 if there is no free range large enough.
+ */
+uint32_t vmem_reserve(enum VmemSpace p_space, uint32_t p_size, uint32_t p_alignment);
+
+/**
+ * @brief Reserves a range of virtual addresses at a fixed position, which is used to grow an existing range in place.
+ * @param p_address The first address of the range, aligned to 4 KiB.
+ * @param p_size The size of the range in bytes, rounded up to 4 KiB.
+ * @return `true` if the whole range was free and is now reserved, and `false` if not.
+ */
+bool vmem_reserve_at(uint32_t p_address, uint32_t p_size);
+
+/**
+ * @brief Takes any free addresses in a range out of the allocator. Used for mappings made at a fixed address, which
+ * own their range whether it has been reserved or not. Addresses outside of both spaces are ignored.
+ * @param p_address The first address of the range
+ * @param p_size The size of the range in bytes
+ */
+void vmem_claim(uint32_t p_address, uint32_t p_size);
+
+/**
+ * @brief Gives a range of addresses back to the allocator, merging it with the free ranges on either side. Addresses
+ * outside of both spaces are ignored.
+ * @param p_address The first address of the range, aligned to 4 KiB.
+ * @param p_size The size of the range in bytes, rounded up to 4 KiB.
+ */
+void vmem_release(uint32_t p_address, uint32_t p_size);
@@ -1,12 +1,21 @@
 #include "stdlib.h"
 
+#if defined(__is_libk)
+#include <aurora/memory.h>
+#else
 #include <string.h>
+#endif
 
 void *calloc(size_t nmemb, size_t size)
 {
+#if defined(__is_libk)
+	// The kernel knows which pages are still untouched, and so already zero
+	return kcalloc(nmemb, size);
+#else
 	void *ret = malloc(size * nmemb);
 	if (!ret)
 		return NULL;
 	memset(ret, 0, size * nmemb);
 	return ret;
+#endif
 }
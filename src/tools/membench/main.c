@@ -0,0 +1,391 @@
+#include "mock.h"
+
+#include <aurora/memory.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 0x1000
+
+// Every trace samples heap fragmentation after this many operations
+#define SAMPLE_INTERVAL 1024
+
+struct BenchState
+{
+	uint64_t ops;			// Number of allocator calls made by the trace
+	uint32_t live_bytes;	// Number of bytes the trace currently has allocated
+	uint32_t peak_live;		// Largest value `live_bytes` has reached
+	uint32_t peak_mapped;	// Largest number of bytes the allocators have had mapped at once
+	uint8_t worst_fragment; // Highest fragmentation seen in any sample
+	uint32_t corruptions;	// Number of allocations whose contents were overwritten by another
+	uint32_t random;		// State of the random number generator
+};
+
+// A single allocation made by a trace
+struct Slot
+{
+	uint8_t *mem;  // The allocated memory, or NULL if the slot is empty
+	uint32_t size; // The number of bytes requested
+	uint8_t tag;   // Byte stamped on the allocation, checked again before it is freed
+};
+
+struct Trace
+{
+	const char *name; // Name printed in the results
+	void (*run)();	  // Runs the trace. Every allocation must be freed before it returns.
+};
+
+static struct BenchState state;
+
+/**
+ * @brief Gets a pseudo-random number, so that every run of a trace makes the same calls.
+ * @return The next number in the sequence.
+ */
+static uint32_t _bench_random()
+{
+	// xorshift32
+	state.random ^= state.random << 13;
+	state.random ^= state.random >> 17;
+	state.random ^= state.random << 5;
+	return state.random;
+}
+
+/**
+ * @brief Updates the peak counters, and every `SAMPLE_INTERVAL` operations the worst fragmentation.
+ */
+static void _bench_sample()
+{
+	state.ops++;
+	state.peak_live	  = AMAX(state.peak_live, state.live_bytes);
+	state.peak_mapped = AMAX(state.peak_mapped, mock_get_mapped_pages() * PAGE_SIZE);
+
+	if (state.ops % SAMPLE_INTERVAL == 0)
+	{
+		struct HeapStatistics stats;
+		kalloc_get_heap_statistics(&stats);
+		state.worst_fragment = AMAX(state.worst_fragment, stats.fragmentation);
+	}
+}
+
+/**
+ * @brief Stamps the first and last bytes of an allocation, which is enough to catch blocks that overlap.
+ * @param p_slot The slot to stamp
+ */
+static void _bench_stamp(struct Slot *p_slot)
+{
+	p_slot->mem[0]				  = p_slot->tag;
+	p_slot->mem[p_slot->size - 1] = p_slot->tag;
+}
+
+/**
+ * @brief Checks that the stamp on an allocation is still intact.
+ * @param p_slot The slot to check
+ */
+static void _bench_check(struct Slot *p_slot)
+{
+	if (p_slot->mem[0] != p_slot->tag || p_slot->mem[p_slot->size - 1] != p_slot->tag)
+	{
+		state.corruptions++;
+	}
+}
+
+static void _bench_alloc(struct Slot *p_slot, uint32_t p_size)
+{
+	p_slot->mem	 = kalloc(p_size);
+	p_slot->size = p_size;
+	p_slot->tag	 = _bench_random();
+	if (!p_slot->mem)
+	{
+		state.corruptions++;
+		return;
+	}
+
+	_bench_stamp(p_slot);
+	state.live_bytes += p_size;
+	_bench_sample();
+}
+
+static void _bench_free(struct Slot *p_slot)
+{
+	if (!p_slot->mem)
+	{
+		return;
+	}
+
+	_bench_check(p_slot);
+	kfree(p_slot->mem);
+	state.live_bytes -= p_slot->size;
+	p_slot->mem = NULL;
+	_bench_sample();
+}
+
+static void _bench_realloc(struct Slot *p_slot, uint32_t p_size)
+{
+	// Only the first byte is sure to survive a shrink, so move the end stamp along with the size
+	_bench_check(p_slot);
+	uint8_t *mem = krealloc(p_slot->mem, p_size);
+	if (!mem || mem[0] != p_slot->tag)
+	{
+		state.corruptions++;
+		return;
+	}
+
+	state.live_bytes += p_size - p_slot->size;
+	p_slot->mem	 = mem;
+	p_slot->size = p_size;
+	_bench_stamp(p_slot);
+	_bench_sample();
+}
+
+/* TRACES */
+
+/**
+ * @brief Mimics opening files through the VFS. Each open allocates a file and a handle, reads a couple of directory
+ * clusters that are freed straight away, and grows the file's data a sector at a time. Files are closed oldest first.
+ */
+static void _trace_fat_open()
+{
+	enum
+	{
+		OPEN_FILES = 16,
+		OPENS	   = 20000,
+	};
+	struct Slot files[OPEN_FILES][3] = {0};
+
+	for (int i = 0; i < OPENS; i++)
+	{
+		struct Slot *file = files[i % OPEN_FILES];
+		for (int j = 0; j < 3; j++)
+		{
+			_bench_free(&file[j]);
+		}
+
+		struct Slot cluster[2];
+		_bench_alloc(&file[0], 40); // FAT_File
+		_bench_alloc(&cluster[0], 512);
+		_bench_alloc(&cluster[1], 4096);
+		_bench_free(&cluster[0]);
+		_bench_free(&cluster[1]);
+
+		// File data, read in one sector at a time
+		uint32_t size = 512 + _bench_random() % (64 * 1024);
+		_bench_alloc(&file[1], 512);
+		for (uint32_t loaded = 1024; loaded <= size; loaded += 512)
+		{
+			_bench_realloc(&file[1], loaded);
+		}
+		_bench_alloc(&file[2], 16); // VFS_Handle
+	}
+
+	for (int i = 0; i < OPEN_FILES; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			_bench_free(&files[i][j]);
+		}
+	}
+}
+
+/**
+ * @brief Allocates, frees and reallocates random slots with random sizes. Most sizes fit the slab allocator, and about
+ * one in sixteen is a large block of up to 256 KiB.
+ */
+static void _trace_random()
+{
+	enum
+	{
+		SLOTS = 4096,
+		STEPS = 400000,
+	};
+	static struct Slot slots[SLOTS];
+
+	for (int i = 0; i < STEPS; i++)
+	{
+		struct Slot *slot = &slots[_bench_random() % SLOTS];
+		uint32_t size	  = 1 + _bench_random() % 2048;
+		if (_bench_random() % 16 == 0)
+		{
+			size = 2049 + _bench_random() % (256 * 1024);
+		}
+
+		if (!slot->mem)
+		{
+			_bench_alloc(slot, size);
+		}
+		else if (_bench_random() % 4)
+		{
+			_bench_free(slot);
+		}
+		else
+		{
+			_bench_realloc(slot, size);
+		}
+	}
+
+	for (int i = 0; i < SLOTS; i++)
+	{
+		_bench_free(&slots[i]);
+	}
+}
+
+/**
+ * @brief Fills memory with objects of mixed sizes, then frees them either newest or oldest first.
+ * @param p_lifo Whether to free the newest objects first
+ */
+static void _trace_ordered(bool p_lifo)
+{
+	enum
+	{
+		OBJECTS = 8192,
+		ROUNDS	= 20,
+	};
+	static struct Slot slots[OBJECTS];
+
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		for (int i = 0; i < OBJECTS; i++)
+		{
+			_bench_alloc(&slots[i], (i % 32 == 0) ? 4096 + _bench_random() % (64 * 1024) : 1 + _bench_random() % 1024);
+		}
+
+		for (int i = 0; i < OBJECTS; i++)
+		{
+			_bench_free(&slots[p_lifo ? OBJECTS - 1 - i : i]);
+		}
+	}
+}
+
+static void _trace_lifo()
+{
+	_trace_ordered(true);
+}
+
+static void _trace_fifo()
+{
+	_trace_ordered(false);
+}
+
+/**
+ * @brief Grows two buffers side by side in 512-byte steps up to 4 MiB, the way a file is loaded a sector at a time.
+ * Growing them together means neither can always sit at the end of its heap.
+ */
+static void _trace_realloc_growth()
+{
+	enum
+	{
+		FINAL_SIZE = 4 * 1024 * 1024,
+		STEP	   = 512,
+		ROUNDS	   = 4,
+	};
+
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		struct Slot buffers[2];
+		_bench_alloc(&buffers[0], STEP);
+		_bench_alloc(&buffers[1], STEP);
+		for (uint32_t size = 2 * STEP; size <= FINAL_SIZE; size += STEP)
+		{
+			_bench_realloc(&buffers[0], size);
+			_bench_realloc(&buffers[1], size);
+		}
+
+		_bench_free(&buffers[0]);
+		_bench_free(&buffers[1]);
+	}
+}
+
+static const struct Trace traces[] = {
+	{"fat-open", _trace_fat_open},
+	{"random", _trace_random},
+	{"lifo", _trace_lifo},
+	{"fifo", _trace_fifo},
+	{"realloc-growth", _trace_realloc_growth},
+};
+
+/**
+ * @brief Runs a single trace on freshly initialized allocators and prints its results.
+ * @param p_trace The trace to run
+ * @param p_seed The seed for the random number generator
+ * @return `true` if the trace ran without errors, and `false` if not.
+ */
+static bool _bench_run(const struct Trace *p_trace, uint32_t p_seed)
+{
+	if (!mock_initialize())
+	{
+		return false;
+	}
+
+	memset(&state, 0, sizeof(struct BenchState));
+	state.random = p_seed;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	p_trace->run();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	uint32_t overhead = state.peak_live ? (uint32_t)((uint64_t)state.peak_mapped * 100 / state.peak_live) : 0;
+
+	// Everything has been freed, so each heap should be back to a single free block
+	struct HeapStatistics stats;
+	kalloc_get_heap_statistics(&stats);
+	bool coalesced = stats.free_blocks == stats.heap_count;
+	bool ok		   = !state.corruptions && !mock_get_error_count() && coalesced && state.live_bytes == 0;
+
+	printf("%-15s %9llu ops %7.2f Mops/s  peak %6u KiB live, %6u KiB mapped (%4u%% of live)  worst frag %3u%%  %s\n",
+		   p_trace->name,
+		   (unsigned long long)state.ops,
+		   seconds > 0 ? state.ops / seconds / 1e6 : 0.0,
+		   state.peak_live / 1024,
+		   state.peak_mapped / 1024,
+		   overhead,
+		   state.worst_fragment,
+		   ok ? "OK" : "FAILED");
+
+	if (!ok)
+	{
+		printf("    %u corrupted allocations, %u errors logged, %u free blocks across %u heaps\n",
+			   state.corruptions,
+			   mock_get_error_count(),
+			   stats.free_blocks,
+			   stats.heap_count);
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	const char *only = argc > 1 ? argv[1] : NULL;
+	uint32_t seed	 = argc > 2 ? strtoul(argv[2], NULL, 0) : 0x12345678;
+	if (!seed)
+	{
+		seed = 1;
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++)
+	{
+		if (only && strcmp(only, "all") && strcmp(only, traces[i].name))
+			continue;
+
+		// The allocators can't be torn down, so every trace gets a fresh process
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			exit(_bench_run(&traces[i], seed) ? 0 : 1);
+		}
+
+		int status = 1;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			failed++;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
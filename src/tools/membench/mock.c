@@ -0,0 +1,407 @@
+#include "mock.h"
+
+#include "paging.h"
+#include "physical.h"
+#include "swap.h"
+
+#include <aurora/arch/cpuid.h>
+#include <aurora/memory.h>
+
+#include <boot/bootstructs.h>
+
+#define AUR_MODULE "mock"
+#include <aurora/debug.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE 0x1000
+
+// The mapping is split in two. The lower half stands in for physical memory, and is where addresses handed to
+// `paging_allocate_region()` end up. The upper half is the window that heaps are mapped into.
+#define MOCK_PHYSICAL_SIZE (128 * 1024 * 1024)
+#define MOCK_WINDOW_SIZE   (128 * 1024 * 1024)
+#define MOCK_WINDOW_PAGES  (MOCK_WINDOW_SIZE / PAGE_SIZE)
+
+struct MockConfig
+{
+	uint8_t *base;							   // Start of the host mapping
+	uint32_t window_frames[MOCK_WINDOW_PAGES]; // "Physical" frame behind each page of the window, or 0 if unmapped
+	uint32_t mapped_pages;					   // Number of pages currently mapped in the window
+	uint32_t errors;						   // Number of errors logged by the allocators
+};
+
+static struct MockConfig mock = {0};
+
+/**
+ * @brief Gets the window page that a virtual address falls in.
+ * @param p_virtual The virtual address
+ * @return The index of the page, or `MOCK_WINDOW_PAGES` if the address is outside the window.
+ */
+static uint32_t _mock_window_page(uint32_t p_virtual)
+{
+	uint32_t window = (uint32_t)(uintptr_t)mock.base + MOCK_PHYSICAL_SIZE;
+	if (p_virtual < window || p_virtual - window >= MOCK_WINDOW_SIZE)
+	{
+		return MOCK_WINDOW_PAGES;
+	}
+
+	return (p_virtual - window) / PAGE_SIZE;
+}
+
+/**
+ * @brief Gets the virtual address of a page in the window.
+ * @param p_page The index of the page
+ * @return The virtual address of the page.
+ */
+static uint32_t _mock_window_address(uint32_t p_page)
+{
+	return (uint32_t)(uintptr_t)mock.base + MOCK_PHYSICAL_SIZE + p_page * PAGE_SIZE;
+}
+
+/**
+ * @brief Maps newly allocated frames to a range of the window, as the kernel does when a heap is created or grown.
+ * @param p_page The first page of the range, which must be unmapped.
+ * @param p_count The number of pages to map
+ * @return `true` if every page was mapped, and `false` if the frames ran out, in which case nothing is left mapped.
+ */
+static bool _mock_map_frames(uint32_t p_page, uint32_t p_count)
+{
+	uint32_t mapped = 0;
+	while (mapped < p_count)
+	{
+		uint32_t count	= AMIN(p_count - mapped, 1024);
+		uint32_t frames = physical_alloc_pages(count);
+		if (!frames)
+		{
+			break;
+		}
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			mock.window_frames[p_page + mapped + i] = frames + i * PAGE_SIZE;
+		}
+		mapped += count;
+	}
+
+	if (mapped == p_count)
+	{
+		mock.mapped_pages += p_count;
+		return true;
+	}
+
+	for (uint32_t i = 0; i < mapped; i++)
+	{
+		physical_free_pages(mock.window_frames[p_page + i], 1);
+		mock.window_frames[p_page + i] = 0;
+	}
+	return false;
+}
+
+/**
+ * @brief Finds the first run of unmapped pages in the window that is long enough, like `find_next_free_region()`.
+ * @param p_count The number of pages needed
+ * @param p_alignment The alignment of the first page, in pages.
+ * @return The index of the first page, or `MOCK_WINDOW_PAGES` if there is no run long enough.
+ */
+static uint32_t _mock_find_window_range(uint32_t p_count, uint32_t p_alignment)
+{
+	uint32_t run = 0;
+	for (uint32_t i = 0; i < MOCK_WINDOW_PAGES; i++)
+	{
+		if (mock.window_frames[i] || (run == 0 && (i % p_alignment)))
+		{
+			run = 0;
+			continue;
+		}
+
+		if (++run == p_count)
+		{
+			return i - p_count + 1;
+		}
+	}
+
+	return MOCK_WINDOW_PAGES;
+}
+
+void log_message(enum LogLevel p_level, const char *p_module, const char *p_message, ...)
+{
+	if (p_level <= LEVEL_ERROR)
+	{
+		mock.errors++;
+	}
+
+	// Only errors matter to a trace, so everything else is hidden unless asked for
+	if (p_level > LEVEL_ERROR && !getenv("MEMBENCH_VERBOSE"))
+	{
+		return;
+	}
+
+	va_list args;
+	va_start(args, p_message);
+	printf("[%s] ", p_module);
+	vprintf(p_message, args);
+	printf("\n");
+	va_end(args);
+
+	if (p_level == LEVEL_FATAL)
+	{
+		abort();
+	}
+}
+
+bool cpuid_supports_feature(enum CPU_Features p_feature, int reg)
+{
+	// Every host the bench runs on has SSE2, which is the only feature the allocators ask about
+	return p_feature == CPU_FEATURE_SSE2 && reg == 1;
+}
+
+void paging_initialize(uint32_t *p_phys_mem_start, bool p_use_pae)
+{
+	(void)p_phys_mem_start;
+	(void)p_use_pae;
+}
+
+bool paging_is_pae_enabled()
+{
+	return false;
+}
+
+bool swap_initialize(uint8_t p_drive, uint16_t p_lba, uint32_t p_sector_count)
+{
+	// There is no disk to swap to, and the host has plenty of memory anyway
+	(void)p_drive;
+	(void)p_lba;
+	(void)p_sector_count;
+	return false;
+}
+
+bool paging_map_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
+{
+	// Device memory isn't backed by anything on the host, so pretend it was mapped
+	(void)p_physical;
+	(void)p_virtual;
+	(void)p_size;
+	return true;
+}
+
+bool paging_map_large_region(uint32_t p_physical, uint32_t p_virtual, uint32_t p_size)
+{
+	return paging_map_region(p_physical, p_virtual, p_size);
+}
+
+void *paging_allocate_region(uint32_t p_address, uint32_t p_size)
+{
+	uint32_t count = (p_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	// Fixed physical memory is "identity-mapped" into the lower half of the host mapping
+	if (p_address)
+	{
+		return (p_address + p_size <= MOCK_PHYSICAL_SIZE) ? mock.base + p_address : NULL;
+	}
+
+	uint32_t page = _mock_find_window_range(count, 1);
+	if (page == MOCK_WINDOW_PAGES || !_mock_map_frames(page, count))
+	{
+		return NULL;
+	}
+
+	return (void *)(uintptr_t)_mock_window_address(page);
+}
+
+void *paging_reserve_region(uint32_t p_size, PagingPolicy p_policy)
+{
+	// The host already backs its memory as it is touched, so the window is mapped straight away
+	(void)p_policy;
+	return paging_allocate_region(0, p_size);
+}
+
+bool paging_commit_region(uint32_t p_virtual, uint32_t p_size)
+{
+	(void)p_virtual;
+	(void)p_size;
+	return true;
+}
+
+bool paging_extend_region(uint32_t p_virtual, uint32_t p_size)
+{
+	uint32_t page  = _mock_window_page(p_virtual);
+	uint32_t count = (p_size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (page == MOCK_WINDOW_PAGES || page + count > MOCK_WINDOW_PAGES)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (mock.window_frames[page + i])
+		{
+			return false;
+		}
+	}
+
+	return _mock_map_frames(page, count);
+}
+
+bool paging_exchange_region(uint32_t p_first, uint32_t p_second, uint32_t p_size)
+{
+	uint32_t first	= _mock_window_page(p_first);
+	uint32_t second = _mock_window_page(p_second);
+	uint32_t count	= p_size / PAGE_SIZE;
+	if (first == MOCK_WINDOW_PAGES || second == MOCK_WINDOW_PAGES || first + count > MOCK_WINDOW_PAGES ||
+		second + count > MOCK_WINDOW_PAGES || (first < second + count && second < first + count))
+	{
+		return false;
+	}
+
+	// The host memory behind the window doesn't follow its frames around, so the contents are traded by hand
+	static uint8_t scratch[PAGE_SIZE];
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t *a = (uint8_t *)(uintptr_t)_mock_window_address(first + i);
+		uint8_t *b = (uint8_t *)(uintptr_t)_mock_window_address(second + i);
+		memcpy(scratch, a, PAGE_SIZE);
+		memcpy(a, b, PAGE_SIZE);
+		memcpy(b, scratch, PAGE_SIZE);
+
+		uint32_t frame				   = mock.window_frames[first + i];
+		mock.window_frames[first + i]  = mock.window_frames[second + i];
+		mock.window_frames[second + i] = frame;
+	}
+
+	return true;
+}
+
+void paging_free_region(uint32_t p_virtual, uint32_t p_size)
+{
+	uint32_t page  = _mock_window_page(p_virtual);
+	uint32_t count = (p_size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (page == MOCK_WINDOW_PAGES)
+	{
+		return;
+	}
+
+	for (uint32_t i = 0; i < count && page + i < MOCK_WINDOW_PAGES; i++)
+	{
+		if (mock.window_frames[page + i])
+		{
+			mock.window_frames[page + i] = 0;
+			mock.mapped_pages--;
+		}
+	}
+
+	// Let the host take the memory back too, so that unmapped pages really are gone
+	madvise((void *)(uintptr_t)p_virtual, count * PAGE_SIZE, MADV_DONTNEED);
+}
+
+bool paging_create_direct_map(uint32_t p_size)
+{
+	// Physical memory is already linear in the lower half of the host mapping
+	(void)p_size;
+	return true;
+}
+
+void *paging_allocate_large_region(uint32_t p_size)
+{
+	uint32_t count = (p_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	// 4 MiB pages are only a matter of alignment here
+	uint32_t page = _mock_find_window_range(count, 1024);
+	if (page == MOCK_WINDOW_PAGES || !_mock_map_frames(page, count))
+	{
+		return NULL;
+	}
+
+	return (void *)(uintptr_t)_mock_window_address(page);
+}
+
+void paging_release_region(uint32_t p_virtual, uint32_t p_size)
+{
+	uint32_t page = _mock_window_page(p_virtual);
+	for (uint32_t i = 0; page != MOCK_WINDOW_PAGES && i < p_size / PAGE_SIZE; i++)
+	{
+		if (mock.window_frames[page + i])
+		{
+			physical_free_pages(mock.window_frames[page + i], 1);
+		}
+	}
+
+	paging_free_region(p_virtual, p_size);
+}
+
+uint32_t virtual_to_physical(uint32_t p_virtual)
+{
+	uint32_t page = _mock_window_page(p_virtual);
+	if (page != MOCK_WINDOW_PAGES)
+	{
+		return mock.window_frames[page] ? mock.window_frames[page] + (p_virtual & (PAGE_SIZE - 1)) : 0;
+	}
+
+	uint32_t offset = p_virtual - (uint32_t)(uintptr_t)mock.base;
+	return (offset < MOCK_PHYSICAL_SIZE) ? offset : 0;
+}
+
+uint32_t physical_to_virtual(uint32_t p_address)
+{
+	return (p_address < MOCK_PHYSICAL_SIZE) ? (uint32_t)(uintptr_t)mock.base + p_address : 0;
+}
+
+bool is_valid_address(void *p_virtual)
+{
+	return virtual_to_physical((uint32_t)(uintptr_t)p_virtual) != 0;
+}
+
+bool is_valid_range(uint32_t p_start, uint32_t p_end)
+{
+	for (uint32_t address = p_start & ~(PAGE_SIZE - 1); address < p_end; address += PAGE_SIZE)
+	{
+		if (!virtual_to_physical(address))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool mock_initialize()
+{
+	// The allocators store pointers in 32-bit fields, so everything has to live below 4 GiB. A hint is enough on
+	// 32-bit hosts, and keeps 64-bit hosts honest.
+	void *base = mmap((void *)0x40000000,
+					  MOCK_PHYSICAL_SIZE + MOCK_WINDOW_SIZE,
+					  PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+					  -1,
+					  0);
+	if (base == MAP_FAILED || (uint64_t)(uintptr_t)base + MOCK_PHYSICAL_SIZE + MOCK_WINDOW_SIZE > 0x100000000ULL)
+	{
+		printf("Unable to map the mock memory below 4 GiB.\n");
+		return false;
+	}
+	mock.base = base;
+
+	// Mirror a typical PC: low memory below the EBDA, and everything from 1 MiB up
+	static struct MemoryRegion regions[] = {
+		{0x00000000, 0x0009fc00, MEMORY_REGION_USABLE, 0},
+		{0x0009fc00, 0x00060400, MEMORY_REGION_RESERVED, 0},
+		{0x00100000, MOCK_PHYSICAL_SIZE - 0x00100000, MEMORY_REGION_USABLE, 0},
+	};
+	static struct MemoryMap map = {sizeof(regions) / sizeof(regions[0]), regions};
+
+	// The kernel image is taken to be 1 MiB
+	return initialize_memory(&map, 0x00100000);
+}
+
+uint32_t mock_get_mapped_pages()
+{
+	return mock.mapped_pages;
+}
+
+uint32_t mock_get_error_count()
+{
+	return mock.errors;
+}
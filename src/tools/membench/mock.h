@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Maps the host memory that stands in for physical and virtual memory, and initializes the kernel allocators on
+ * top of it with a typical PC memory map.
+ * @return `true` if the allocators are ready to use, and `false` if not.
+ */
+bool mock_initialize();
+
+/**
+ * @brief Gets the number of pages that the allocators currently have mapped for their heaps.
+ * @return The number of 4 KiB pages mapped.
+ */
+uint32_t mock_get_mapped_pages();
+
+/**
+ * @brief Gets the number of errors the allocators have logged so far. A correct trace should never cause one.
+ * @return The number of errors logged.
+ */
+uint32_t mock_get_error_count();